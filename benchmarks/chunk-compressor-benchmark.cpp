@@ -0,0 +1,104 @@
+#include <random>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "lib/chunk-compressor/chunk-compressor.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+constexpr size_t kChunkSize = 8 << 20;
+
+// Log-like text, the kind of content compression is meant for
+const std::string& textChunk() {
+    static const std::string chunk = [] {
+        std::mt19937_64 random(42);
+        std::string text;
+        text.reserve(kChunkSize);
+
+        static constexpr const char* kLevels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+        for (size_t line = 0; text.size() < kChunkSize; ++line) {
+            text += "2024-05-" + std::to_string(1 + line % 28) + " 12:" + std::to_string(line % 60) + " [" +
+                    kLevels[random() % 4] + "] worker-" + std::to_string(random() % 16) +
+                    ": processed request " + std::to_string(random() % 100'000) + " in " +
+                    std::to_string(random() % 500) + "ms\n";
+        }
+
+        text.resize(kChunkSize);
+        return text;
+    }();
+
+    return chunk;
+}
+
+// Random bytes stand in for media and archives, which don't compress
+const std::string& randomChunk() {
+    static const std::string chunk = [] {
+        std::mt19937_64 random(7);
+        std::string bytes(kChunkSize, '\0');
+
+        for (char& byte : bytes) {
+            byte = static_cast<char>(random());
+        }
+
+        return bytes;
+    }();
+
+    return chunk;
+}
+
+// Throughput and ratio of text chunks per zstd level
+void BM_CompressText(benchmark::State& state) {
+    const std::string& chunk = textChunk();
+    const ftes::CompressionOptions options{.level = static_cast<int>(state.range(0))};
+    size_t compressed_size = chunk.size();
+
+    for (auto _ : state) {
+        const auto compressed = ftes::ChunkCompressor::compress(chunk, options);
+        compressed_size = compressed ? compressed->size() : chunk.size();
+        benchmark::DoNotOptimize(compressed);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk.size()));
+    state.counters["ratio"] = static_cast<double>(chunk.size()) / static_cast<double>(compressed_size);
+}
+
+// Cost of detecting incompressible chunks, only the sample gets compressed
+void BM_CompressRandom(benchmark::State& state) {
+    const std::string& chunk = randomChunk();
+    const ftes::CompressionOptions options{.level = static_cast<int>(state.range(0))};
+    bool skipped = false;
+
+    for (auto _ : state) {
+        const auto compressed = ftes::ChunkCompressor::compress(chunk, options);
+        skipped = !compressed;
+        benchmark::DoNotOptimize(compressed);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk.size()));
+    state.counters["skipped"] = skipped ? 1 : 0;
+}
+
+void BM_DecompressText(benchmark::State& state) {
+    const std::string& chunk = textChunk();
+    const auto compressed = ftes::ChunkCompressor::compress(chunk, {.level = static_cast<int>(state.range(0))});
+
+    if (!compressed) {
+        state.SkipWithError("Text chunk didn't compress");
+        return;
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ftes::ChunkCompressor::decompress(*compressed));
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_CompressText)->Arg(1)->Arg(3)->Arg(6)->Arg(9)->Arg(15)->Arg(19)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CompressRandom)->Arg(1)->Arg(3)->Arg(19)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DecompressText)->Arg(1)->Arg(3)->Arg(19)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,192 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/fuse.h>
+
+#include <benchmark/benchmark.h>
+
+#include "lib/fuse-filesystem/fuse-filesystem.hpp"
+
+namespace fes = fuse_external_storage;
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+// Backend that answers from memory, so only the FUSE layer is measured
+class NoopStorage final : public fes::ExternalStorageInterface {
+public:
+    explicit NoopStorage(const size_t dir_entries) {
+        for (size_t i = 0; i < dir_entries; ++i) {
+            entries_.push_back({"/dir/file_" + std::to_string(i), 1, 0, 0, 4096, false});
+        }
+    }
+
+    struct stat getAttr(std::filesystem::path& path) override {
+        struct stat st = {};
+        st.st_mode = path == "/dir" ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+        st.st_nlink = 1;
+        st.st_size = 4096;
+        return st;
+    }
+
+    std::vector<ftes::FileInfo> listDir(const std::filesystem::path&) override { return entries_; }
+    int createFile(const std::filesystem::path&, mode_t) override { return 0; }
+    int readFile(const std::filesystem::path&, char*, const size_t size, off_t) override { return static_cast<int>(size); }
+    int writeFile(const std::filesystem::path&, const char*, const size_t size, off_t) override { return static_cast<int>(size); }
+    int unlinkFile(const std::filesystem::path&) override { return 0; }
+    int createDir(const std::filesystem::path&, mode_t) override { return 0; }
+    int removeDir(const std::filesystem::path&) override { return 0; }
+    int rename(const std::filesystem::path&, const std::filesystem::path&) override { return 0; }
+    int fetchFile(const std::filesystem::path&, const std::filesystem::path&) override { return 0; }
+    int storeFile(const std::filesystem::path&, const std::filesystem::path&,
+                  const std::vector<fes::ByteRange>&) override { return 0; }
+    int syncMetadata() override { return 0; }
+
+private:
+    std::vector<ftes::FileInfo> entries_;
+};
+
+// Runs FuseFilesystem's operations in libfuse's own request loop without a
+// kernel mount: libfuse accepts an already open device as /dev/fd/N, here
+// one end of a socket pair, and requests are written to the other end in
+// the kernel's wire format
+class FuseLoop {
+public:
+    explicit FuseLoop(const size_t dir_entries) {
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds_) != 0) {
+            throw std::runtime_error("socketpair failed");
+        }
+
+        state_.mount_path = "/";
+        state_.storage_interface = std::make_unique<NoopStorage>(dir_entries);
+
+        char program[] = "fuse-filesystem-benchmark";
+        char* argv[] = {program, nullptr};
+        fuse_args args = FUSE_ARGS_INIT(1, argv);
+
+        const auto& operations = fes::FuseFilesystem::getOperations();
+        fuse_ = fuse_new(&args, &operations, sizeof(operations), &state_);
+
+        const std::string device = "/dev/fd/" + std::to_string(fds_[1]);
+        if (fuse_ == nullptr || fuse_mount(fuse_, device.c_str()) != 0) {
+            throw std::runtime_error("fuse setup failed");
+        }
+
+        loop_ = std::thread([this] { fuse_loop(fuse_); });
+
+        fuse_init_in init = {};
+        init.major = FUSE_KERNEL_VERSION;
+        init.minor = FUSE_KERNEL_MINOR_VERSION;
+        call(FUSE_INIT, 0, &init, sizeof(init));
+    }
+
+    ~FuseLoop() {
+        // The loop sees end of file and returns, the session closes its end
+        fuse_exit(fuse_);
+        ::close(fds_[0]);
+        loop_.join();
+        fuse_destroy(fuse_);
+    }
+
+    // Sends one request and returns the reply payload, throwing on errors
+    std::string call(const uint32_t opcode, const uint64_t node, const void* arg, const size_t arg_size) {
+        fuse_in_header header = {};
+        header.len = static_cast<uint32_t>(sizeof(header) + arg_size);
+        header.opcode = opcode;
+        header.unique = ++unique_;
+        header.nodeid = node;
+
+        std::string request(reinterpret_cast<const char*>(&header), sizeof(header));
+        request.append(static_cast<const char*>(arg), arg_size);
+
+        if (::send(fds_[0], request.data(), request.size(), 0) != static_cast<ssize_t>(request.size())) {
+            throw std::runtime_error("send failed");
+        }
+
+        const ssize_t n = ::recv(fds_[0], reply_.data(), reply_.size(), 0);
+        fuse_out_header out = {};
+        if (n < static_cast<ssize_t>(sizeof(out))) {
+            throw std::runtime_error("short reply");
+        }
+
+        std::memcpy(&out, reply_.data(), sizeof(out));
+        if (out.error != 0) {
+            throw std::runtime_error("request failed: " + std::to_string(out.error));
+        }
+
+        return {reply_.data() + sizeof(out), static_cast<size_t>(n) - sizeof(out)};
+    }
+
+    uint64_t lookup(const uint64_t parent, const std::string& name) {
+        const std::string reply = call(FUSE_LOOKUP, parent, name.c_str(), name.size() + 1);
+
+        fuse_entry_out entry = {};
+        std::memcpy(&entry, reply.data(), sizeof(entry));
+        return entry.nodeid;
+    }
+
+private:
+    int fds_[2] = {-1, -1};
+    fes::FuseState state_;
+    fuse* fuse_ = nullptr;
+    std::thread loop_;
+    uint64_t unique_ = 0;
+    std::vector<char> reply_ = std::vector<char>(1 << 20);
+};
+
+// lookup goes through path resolution and ff_getattr
+void BM_Lookup(benchmark::State& state) {
+    FuseLoop loop(0);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(loop.lookup(FUSE_ROOT_ID, "file"));
+    }
+}
+
+void BM_GetAttr(benchmark::State& state) {
+    FuseLoop loop(0);
+    const uint64_t node = loop.lookup(FUSE_ROOT_ID, "file");
+    const fuse_getattr_in arg = {};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(loop.call(FUSE_GETATTR, node, &arg, sizeof(arg)));
+    }
+}
+
+// opendir, one readdir covering the whole listing and releasedir, like ls
+void BM_ReadDir(benchmark::State& state) {
+    FuseLoop loop(state.range(0));
+    const uint64_t node = loop.lookup(FUSE_ROOT_ID, "dir");
+
+    for (auto _ : state) {
+        const fuse_open_in open_arg = {};
+        const std::string open_reply = loop.call(FUSE_OPENDIR, node, &open_arg, sizeof(open_arg));
+
+        fuse_open_out opened = {};
+        std::memcpy(&opened, open_reply.data(), sizeof(opened));
+
+        fuse_read_in read_arg = {};
+        read_arg.fh = opened.fh;
+        read_arg.size = 1 << 20;
+        benchmark::DoNotOptimize(loop.call(FUSE_READDIR, node, &read_arg, sizeof(read_arg)));
+
+        fuse_release_in release_arg = {};
+        release_arg.fh = opened.fh;
+        loop.call(FUSE_RELEASEDIR, node, &release_arg, sizeof(release_arg));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK(BM_Lookup);
+BENCHMARK(BM_GetAttr);
+BENCHMARK(BM_ReadDir)->Arg(16)->Arg(1024);
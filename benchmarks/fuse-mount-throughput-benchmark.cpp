@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "lib/fuse-filesystem/fuse-filesystem.hpp"
+#include "lib/local-object-storage/local-object-storage.hpp"
+
+namespace fes = fuse_external_storage;
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+constexpr size_t kFileSize = 64 << 20;
+
+// What the mount ran with before the init stage: libfuse's request sizes and
+// every file's pages dropped on open
+fes::KernelCacheOptions kernelCacheOptions(const bool tuned) {
+    if (!tuned) {
+        return {
+            .page_cache = false,
+            .writeback_cache = false,
+            .max_write = 0,
+            .max_readahead = 0,
+            .async_read = true,
+            .splice = false,
+        };
+    }
+
+    fes::KernelCacheOptions options;
+    options.writeback_cache = true;
+    return options;
+}
+
+// Mounts FuseFilesystem through the kernel over a LocalObjectStorage in a
+// temporary directory, so reads and writes take the whole way through the
+// page cache, /dev/fuse and libfuse. Needs /dev/fuse and fusermount3
+class Mount {
+public:
+    explicit Mount(const fes::KernelCacheOptions& kernel_cache) {
+        char root[] = "/tmp/fuse-mount-benchmark-XXXXXX";
+        if (mkdtemp(root) == nullptr) {
+            throw std::runtime_error("mkdtemp failed");
+        }
+        root_ = root;
+        std::filesystem::create_directory(mountPoint());
+
+        state_.mount_path = mountPoint();
+        state_.storage_interface = std::make_unique<ftes::LocalObjectStorage>(
+            ftes::LocalStorageOptions{.root = root_ / "storage"}
+        );
+        state_.kernel_cache = kernel_cache;
+
+        char program[] = "fuse-mount-throughput-benchmark";
+        char* argv[] = {program, nullptr};
+        fuse_args args = FUSE_ARGS_INIT(1, argv);
+
+        const auto& operations = fes::FuseFilesystem::getOperations();
+        fuse_ = fuse_new(&args, &operations, sizeof(operations), &state_);
+
+        if (fuse_ == nullptr || fuse_mount(fuse_, mountPoint().c_str()) != 0) {
+            if (fuse_ != nullptr) {
+                fuse_destroy(fuse_);
+            }
+            std::filesystem::remove_all(root_);
+            throw std::runtime_error("mounting failed, is /dev/fuse available?");
+        }
+
+        loop_ = std::thread([this] { fuse_loop_mt(fuse_, 0); });
+    }
+
+    ~Mount() {
+        // Unmounting fails the loop's reads of the device, so it returns
+        fuse_exit(fuse_);
+        fuse_unmount(fuse_);
+        loop_.join();
+        fuse_destroy(fuse_);
+
+        std::filesystem::remove_all(root_);
+    }
+
+    [[nodiscard]] std::filesystem::path mountPoint() const { return root_ / "mnt"; }
+
+private:
+    std::filesystem::path root_;
+    fes::FuseState state_;
+    fuse* fuse_ = nullptr;
+    std::thread loop_;
+};
+
+// Writes kFileSize bytes to path in blocks of block_size, false on any error
+bool writeFile(const std::filesystem::path& path, const size_t block_size) {
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    const std::vector<char> block(block_size, 'x');
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < kFileSize; offset += block_size) {
+        ok = ::write(fd, block.data(), block_size) == static_cast<ssize_t>(block_size);
+    }
+
+    // Release stores the file, which is part of what a write costs
+    return ::close(fd) == 0 && ok;
+}
+
+// Sequential write of a whole file, created and closed every iteration
+void BM_SequentialWrite(benchmark::State& state) {
+    const bool tuned = state.range(0) != 0;
+    const size_t block_size = state.range(1) * 1024;
+
+    std::unique_ptr<Mount> mount;
+    try {
+        mount = std::make_unique<Mount>(kernelCacheOptions(tuned));
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const auto path = mount->mountPoint() / "written";
+
+    for (auto _ : state) {
+        if (!writeFile(path, block_size)) {
+            state.SkipWithError("write failed");
+            return;
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kFileSize));
+}
+
+// Sequential read of a whole file, opened every iteration. Cold reads drop the
+// file's pages first, warm ones find them cached when the mount keeps them
+void BM_SequentialRead(benchmark::State& state) {
+    const bool tuned = state.range(0) != 0;
+    const size_t block_size = state.range(1) * 1024;
+    const bool cold = state.range(2) != 0;
+
+    std::unique_ptr<Mount> mount;
+    try {
+        mount = std::make_unique<Mount>(kernelCacheOptions(tuned));
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const auto path = mount->mountPoint() / "read";
+    if (!writeFile(path, 1 << 20)) {
+        state.SkipWithError("preparing the file failed");
+        return;
+    }
+
+    std::vector<char> block(block_size);
+
+    for (auto _ : state) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            state.SkipWithError("open failed");
+            return;
+        }
+
+        if (cold) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+
+        size_t total = 0;
+        ssize_t n;
+        while ((n = ::read(fd, block.data(), block_size)) > 0) {
+            total += n;
+        }
+        ::close(fd);
+
+        if (n < 0 || total != kFileSize) {
+            state.SkipWithError("read failed");
+            return;
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kFileSize));
+}
+
+} // namespace
+
+BENCHMARK(BM_SequentialWrite)
+    ->ArgNames({"tuned", "block_kib"})
+    ->ArgsProduct({{0, 1}, {4, 1024}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_SequentialRead)
+    ->ArgNames({"tuned", "block_kib", "cold"})
+    ->ArgsProduct({{0, 1}, {4, 1024}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
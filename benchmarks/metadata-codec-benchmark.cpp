@@ -0,0 +1,101 @@
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+#include "lib/metadata-codec/metadata-codec.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+using json = nlohmann::json;
+
+namespace {
+
+constexpr size_t kEntries = 100'000;
+constexpr size_t kFilesPerDir = 64;
+
+// Metadata document shaped like a real mount: nested directories, a mix of
+// small single-chunk files and larger chunked ones
+const json& metadataDocument() {
+    static const json metadata = [] {
+        json files = json::array();
+
+        for (size_t i = 0; i < kEntries; ++i) {
+            const std::string dir = "/projects/project_" + std::to_string(i / (kFilesPerDir * 16)) + "/dir_" + std::to_string(i / kFilesPerDir);
+
+            json entry = {
+                {"path", dir + "/file_" + std::to_string(i) + ".txt"},
+                {"message_id", 0},
+                {"size", (i * 7919) % (32 << 20)},
+                {"is_dir", false},
+                {"ctime", 1'700'000'000 + static_cast<int64_t>(i)},
+                {"mtime", 1'700'000'000 + static_cast<int64_t>(i) + 60},
+                {"chunk_size", 8 << 20},
+            };
+
+            json chunks = json::array();
+            for (size_t c = 0; c <= i % 4; ++c) {
+                chunks.push_back(static_cast<int64_t>(10 * i + c));
+            }
+            entry["chunks"] = std::move(chunks);
+
+            files.push_back(std::move(entry));
+        }
+
+        return json{{"version", 1}, {"files", std::move(files)}};
+    }();
+
+    return metadata;
+}
+
+void BM_JsonEncode(benchmark::State& state) {
+    const auto& metadata = metadataDocument();
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        const std::string encoded = metadata.dump();
+        bytes = encoded.size();
+        benchmark::DoNotOptimize(encoded.data());
+    }
+
+    state.counters["bytes"] = static_cast<double>(bytes);
+}
+
+void BM_JsonDecode(benchmark::State& state) {
+    const std::string encoded = metadataDocument().dump();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(json::parse(encoded));
+    }
+
+    state.counters["bytes"] = static_cast<double>(encoded.size());
+}
+
+void BM_BinaryEncode(benchmark::State& state) {
+    const auto& metadata = metadataDocument();
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        const std::string encoded = ftes::MetadataCodec::encode(metadata, static_cast<int>(state.range(0)));
+        bytes = encoded.size();
+        benchmark::DoNotOptimize(encoded.data());
+    }
+
+    state.counters["bytes"] = static_cast<double>(bytes);
+}
+
+void BM_BinaryDecode(benchmark::State& state) {
+    const std::string encoded = ftes::MetadataCodec::encode(metadataDocument(), static_cast<int>(state.range(0)));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ftes::MetadataCodec::decode(encoded));
+    }
+
+    state.counters["bytes"] = static_cast<double>(encoded.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_JsonEncode)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_JsonDecode)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BinaryEncode)->Arg(1)->Arg(3)->Arg(9)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BinaryDecode)->Arg(1)->Arg(3)->Arg(9)->Unit(benchmark::kMillisecond);
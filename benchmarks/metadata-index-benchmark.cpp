@@ -0,0 +1,160 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "lib/metadata-index/metadata-index.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+constexpr size_t kFilesPerDir = 64;
+
+// Flat tree of /dir_<i>/file_<j> with kFilesPerDir files per directory,
+// built once per size and shared between benchmarks
+ftes::MetadataIndex& indexWithEntries(const size_t total_entries) {
+    static std::map<size_t, ftes::MetadataIndex> indexes;
+
+    auto [it, inserted] = indexes.try_emplace(total_entries);
+    if (!inserted) {
+        return it->second;
+    }
+
+    const size_t dirs = total_entries / (kFilesPerDir + 1);
+    for (size_t i = 0; i < dirs; ++i) {
+        const std::string dir = "/dir_" + std::to_string(i);
+        it->second.upsert({dir, 0, 0, 0, 0, true});
+
+        for (size_t j = 0; j < kFilesPerDir; ++j) {
+            it->second.upsert({dir + "/file_" + std::to_string(j), static_cast<int64_t>(i * kFilesPerDir + j + 1), 0, 0, 4096, false});
+        }
+    }
+
+    return it->second;
+}
+
+// Metadata documents of indexWithEntries, for the load benchmark
+const nlohmann::json& documentWithEntries(const size_t total_entries) {
+    static std::map<size_t, nlohmann::json> documents;
+
+    auto [it, inserted] = documents.try_emplace(total_entries);
+    if (inserted) {
+        it->second = indexWithEntries(total_entries).toJson();
+    }
+
+    return it->second;
+}
+
+// Existing file paths spread over the whole tree, so lookups don't all hit one bucket
+std::vector<std::string> samplePaths(const size_t total_entries) {
+    const size_t dirs = total_entries / (kFilesPerDir + 1);
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 1024; ++i) {
+        paths.push_back("/dir_" + std::to_string(i * 7919 % dirs) + "/file_" + std::to_string(i % kFilesPerDir));
+    }
+
+    return paths;
+}
+
+void entryCounts(benchmark::internal::Benchmark* benchmark) {
+    benchmark->Arg(1'000)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+}
+
+void BM_Find(benchmark::State& state) {
+    const auto& index = indexWithEntries(state.range(0));
+    const auto paths = samplePaths(state.range(0));
+    size_t i = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.find(paths[i++ % paths.size()]));
+    }
+}
+
+void BM_FindMissing(benchmark::State& state) {
+    const auto& index = indexWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.find("/dir_1/missing"));
+    }
+}
+
+void BM_UpsertErase(benchmark::State& state) {
+    auto& index = indexWithEntries(state.range(0));
+    const ftes::FileInfo info{"/dir_1/new_file", 1, 0, 0, 4096, false};
+
+    for (auto _ : state) {
+        index.upsert(info);
+        index.erase(info.path);
+    }
+}
+
+void BM_NormalizePath(benchmark::State& state) {
+    const std::vector<std::filesystem::path> paths = {
+        "/dir_1/file_1", "dir_1/file_1", "/dir_1/sub/../file_1", "/projects/project_12/dir_345/file_6789.txt/", ".",
+    };
+    size_t i = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ftes::MetadataIndex::normalizePath(paths[i++ % paths.size()]));
+    }
+}
+
+void BM_ToJson(benchmark::State& state) {
+    const auto& index = indexWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.toJson());
+    }
+}
+
+void BM_Load(benchmark::State& state) {
+    const auto& document = documentWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        ftes::MetadataIndex index;
+        index.load(document);
+        benchmark::DoNotOptimize(index.size());
+    }
+}
+
+void BM_ListDir(benchmark::State& state) {
+    const auto& index = indexWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.children("/dir_1"));
+    }
+
+    state.counters["entries"] = static_cast<double>(index.size());
+}
+
+void BM_RemoveDirEmptinessCheck(benchmark::State& state) {
+    const auto& index = indexWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.hasChildren("/dir_1"));
+    }
+}
+
+void BM_RenameDir(benchmark::State& state) {
+    auto& index = indexWithEntries(state.range(0));
+
+    for (auto _ : state) {
+        index.rename("/dir_1", "/dir_1_renamed");
+        index.rename("/dir_1_renamed", "/dir_1");
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_Find)->Apply(entryCounts);
+BENCHMARK(BM_FindMissing)->Apply(entryCounts);
+BENCHMARK(BM_UpsertErase)->Apply(entryCounts);
+BENCHMARK(BM_NormalizePath);
+BENCHMARK(BM_ToJson)->Apply(entryCounts)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Load)->Apply(entryCounts)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ListDir)->Apply(entryCounts);
+BENCHMARK(BM_RemoveDirEmptinessCheck)->Apply(entryCounts);
+BENCHMARK(BM_RenameDir)->Apply(entryCounts);
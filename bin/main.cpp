@@ -6,7 +6,10 @@
 
 #include "lib/parser/parser.hpp"
 #include "lib/fuse-filesystem/fuse-filesystem.hpp"
+#include "lib/fuse-filesystem/fuse-lowlevel-filesystem.hpp"
 #include "lib/telegram-external-storage/telegram-external-storage.hpp"
+#include "lib/local-object-storage/local-object-storage.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
 #include "lib/telegram-api/telegram-api.hpp"
 
 namespace fes = fuse_external_storage;
@@ -15,18 +18,77 @@ namespace ftes = fuse_telegram_external_storage;
 int main(const int argc, char** argv) {
     fes::ParserInterface* parser = new fes::FuseArgsParser("libfuse-telegram-storage-args-parser");
 
-    auto [fuse_argc, fuse_argv, mount_point] = parser->Parse(argc, argv);
+    const auto args = parser->Parse(argc, argv);
+    fes::Logger::setLevel(args.log_level);
+
+    if (!args.trace_file.empty()) {
+        fes::SpanTracer::start({.output = args.trace_file, .max_spans = args.trace_max_spans});
+    }
 
     const auto operations = fes::FuseFilesystem::getOperations();
 
+    ftes::TelegramStorageOptions storage_options{
+        .cache_dir = args.cache_dir,
+        .cache_size_bytes = args.cache_size_bytes,
+        .chunk_size_bytes = args.chunk_size_bytes,
+    };
+    storage_options.api.connections = args.http_connections;
+    storage_options.api.api_url = args.api_url;
+    storage_options.compression.level = args.compression_level;
+    storage_options.prefetch.sequential_window = args.prefetch_window;
+    storage_options.prefetch.max_in_flight_bytes = args.prefetch_budget_bytes;
+    storage_options.journal_max_records = args.journal_max_records;
+    storage_options.commit_delay = std::chrono::milliseconds(args.commit_delay_ms);
+    storage_options.commit_max_batch = args.commit_max_batch;
+    storage_options.upload.workers = args.upload_workers;
+
+    for (const auto& [api_token, chat_id] : args.extra_bots) {
+        storage_options.extra_bots.push_back({api_token, chat_id});
+    }
+
+    std::unique_ptr<fes::ExternalStorageInterface> storage;
+
+    if (!args.local_storage_dir.empty()) {
+        storage = std::make_unique<ftes::LocalObjectStorage>(ftes::LocalStorageOptions{
+            .root = args.local_storage_dir,
+            .latency = std::chrono::microseconds(static_cast<int64_t>(args.emulated_latency_ms * 1000)),
+            .bandwidth_bytes_per_second = args.emulated_bandwidth_bytes,
+            .error_rate = args.emulated_error_rate,
+        });
+    } else {
+        storage = std::make_unique<ftes::TelegramExternalStorage>(std::getenv("API_TOKEN"), storage_options);
+    }
+
     auto* state = new fes::FuseState{
-        .mount_path = mount_point,
-        .storage_interface =
-            std::make_unique<ftes::TelegramExternalStorage>(std::getenv("API_TOKEN")),
+        .mount_path = args.mount_point,
+        .storage_interface = std::move(storage),
+        .kernel_cache = {
+            .page_cache = args.page_cache,
+            .writeback_cache = args.writeback_cache,
+            .max_write = args.max_write_bytes,
+            .max_readahead = args.max_readahead_bytes,
+            .async_read = args.async_read,
+            .splice = args.splice,
+        },
     };
 
-    const int fuse_return = fuse_main(fuse_argc, fuse_argv, &operations, state);
+    int fuse_return;
+
+    if (args.inode_frontend) {
+        fes::FuseLowlevelFilesystem filesystem(*state, {
+            .entry_timeout = args.entry_timeout,
+            .attr_timeout = args.attr_timeout,
+        });
+        fuse_return = filesystem.run(args.fuse_argc, args.fuse_argv);
+    } else {
+        fuse_return = fuse_main(args.fuse_argc, args.fuse_argv, &operations, state);
+    }
 
     delete state;
+
+    // After the storage is gone, so the final commit and uploads are in the trace
+    fes::SpanTracer::dump();
+    fes::Logger::flush();
+
     return fuse_return;
 }
@@ -8,6 +8,12 @@ FetchContent_Declare(
 )
 FetchContent_MakeAvailable(TgBot)
 
+# HTTP client behind the Telegram API connection pool
+find_package(CURL REQUIRED)
+
+# SHA-256 for content deduplication
+find_package(OpenSSL REQUIRED)
+
 # CLI parser
 FetchContent_Declare(
         cli11_proj
@@ -23,4 +29,29 @@ FetchContent_Declare(
 )
 FetchContent_MakeAvailable(json)
 
+# zstd for metadata and chunk compression
+set(ZSTD_BUILD_PROGRAMS OFF CACHE BOOL "" FORCE)
+set(ZSTD_BUILD_SHARED OFF CACHE BOOL "" FORCE)
+set(ZSTD_BUILD_TESTS OFF CACHE BOOL "" FORCE)
+
+FetchContent_Declare(
+        zstd
+        URL https://github.com/facebook/zstd/releases/download/v1.5.6/zstd-1.5.6.tar.gz
+        SOURCE_SUBDIR build/cmake
+)
+FetchContent_MakeAvailable(zstd)
+
+# Microbenchmarks
+if (BUILD_BENCHMARKS)
+    set(BENCHMARK_ENABLE_TESTING OFF CACHE BOOL "" FORCE)
+    set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE BOOL "" FORCE)
+
+    FetchContent_Declare(
+            benchmark
+            GIT_REPOSITORY https://github.com/google/benchmark.git
+            GIT_TAG v1.9.1
+    )
+    FetchContent_MakeAvailable(benchmark)
+endif()
+
 set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -D_FILE_OFFSET_BITS=64 -Wall -lfuse3")
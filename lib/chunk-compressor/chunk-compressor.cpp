@@ -0,0 +1,67 @@
+#include "chunk-compressor.hpp"
+
+#include <stdexcept>
+
+#include <zstd.h>
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+std::string compressFrame(const std::string_view data, const int level) {
+    std::string out(ZSTD_compressBound(data.size()), '\0');
+
+    const size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), level);
+    if (ZSTD_isError(size)) {
+        throw std::runtime_error(std::string("Chunk compression failed: ") + ZSTD_getErrorName(size));
+    }
+
+    out.resize(size);
+    return out;
+}
+
+bool saves(const size_t compressed, const size_t original, const double min_savings) {
+    return static_cast<double>(compressed) <= static_cast<double>(original) * (1.0 - min_savings);
+}
+
+} // namespace
+
+std::optional<std::string> ftes::ChunkCompressor::compress(const std::string_view data, const CompressionOptions& options) {
+    if (options.level <= 0 || data.empty()) {
+        return std::nullopt;
+    }
+
+    // Already compressed data is detected on a cheap sample before paying for the whole chunk
+    if (data.size() > options.sample_bytes) {
+        const auto sample = data.substr(0, options.sample_bytes);
+
+        if (!saves(compressFrame(sample, 1).size(), sample.size(), options.min_savings)) {
+            return std::nullopt;
+        }
+    }
+
+    std::string compressed = compressFrame(data, options.level);
+
+    if (!saves(compressed.size(), data.size(), options.min_savings)) {
+        return std::nullopt;
+    }
+
+    return compressed;
+}
+
+std::string ftes::ChunkCompressor::decompress(const std::string_view data) {
+    // ZSTD_compress records the content size in the frame header
+    const unsigned long long size = ZSTD_getFrameContentSize(data.data(), data.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        throw std::runtime_error("Stored chunk is not a zstd frame");
+    }
+
+    std::string out(size, '\0');
+
+    const size_t result = ZSTD_decompress(out.data(), out.size(), data.data(), data.size());
+    if (ZSTD_isError(result) || result != size) {
+        throw std::runtime_error("Chunk decompression failed");
+    }
+
+    return out;
+}
@@ -0,0 +1,32 @@
+#ifndef CHUNK_COMPRESSOR_HPP
+#define CHUNK_COMPRESSOR_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace fuse_telegram_external_storage {
+
+    struct CompressionOptions {
+        // zstd level chunks are compressed with, 0 stores everything raw
+        int level = 0;
+
+        // The start of a chunk is compressed at level 1 first, chunks whose
+        // sample doesn't shrink by min_savings (media, archives) stay raw
+        size_t sample_bytes = 64ULL << 10;
+        double min_savings = 0.1;
+    };
+
+    class ChunkCompressor {
+    public:
+        // Compressed form of data, or nothing if it isn't worth storing compressed
+        static std::optional<std::string> compress(std::string_view data, const CompressionOptions& options);
+
+        // Throws if data isn't a complete zstd frame
+        static std::string decompress(std::string_view data);
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //CHUNK_COMPRESSOR_HPP
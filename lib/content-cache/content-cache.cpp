@@ -0,0 +1,309 @@
+#include "content-cache.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+    constexpr const char* kLockFile = ".lock";
+    constexpr const char* kDownloadPrefix = "download-";
+
+    // Digits only, with at least one of them
+    bool isNumber(const std::string_view text) {
+        return !text.empty() && std::ranges::all_of(text, [](const char c) { return c >= '0' && c <= '9'; });
+    }
+
+    // Names downloadPath() hands out: download-<message ID>-<counter>
+    bool isDownloadName(std::string_view name) {
+        if (!name.starts_with(kDownloadPrefix)) {
+            return false;
+        }
+        name.remove_prefix(std::strlen(kDownloadPrefix));
+
+        const size_t separator = name.find('-');
+        return separator != std::string_view::npos && isNumber(name.substr(0, separator)) &&
+               isNumber(name.substr(separator + 1));
+    }
+
+} // namespace
+
+ftes::ContentCache::ContentCache(std::filesystem::path cache_dir, const uint64_t max_bytes)
+    : max_bytes_(max_bytes), in_max_bytes_(max_bytes / 4)
+{
+    lockDirectory(cache_dir);
+    loadExisting();
+}
+
+ftes::ContentCache::~ContentCache() {
+    if (lock_fd_ >= 0) {
+        close(lock_fd_);
+    }
+}
+
+std::optional<int> ftes::ContentCache::read(const int64_t message_id, char* buf, const size_t size, const off_t offset) {
+    fuse_external_storage::TraceSpan span("disk", "cacheRead", message_id);
+    int fd;
+
+    {
+        std::lock_guard lock(mutex_);
+
+        fd = openForRead(message_id);
+        if (fd < 0) {
+            ++stats_.misses;
+            return std::nullopt;
+        }
+        ++stats_.hits;
+    }
+
+    // The descriptor stays valid even if the entry gets evicted meanwhile
+    const ssize_t bytes_read = pread(fd, buf, size, offset);
+    const int error = errno;
+    close(fd);
+
+    return bytes_read < 0 ? -error : static_cast<int>(bytes_read);
+}
+
+bool ftes::ContentCache::contains(const int64_t message_id) const {
+    std::lock_guard lock(mutex_);
+    return entries_.contains(message_id);
+}
+
+bool ftes::ContentCache::copyTo(const int64_t message_id, const std::filesystem::path& dest_path) {
+    fuse_external_storage::TraceSpan span("disk", "cacheCopy", message_id);
+    std::lock_guard lock(mutex_);
+
+    const int fd = openForRead(message_id);
+    if (fd < 0) {
+        ++stats_.misses;
+        return false;
+    }
+    close(fd);
+    ++stats_.hits;
+
+    std::error_code ec;
+    std::filesystem::copy_file(objectPath(message_id), dest_path, std::filesystem::copy_options::overwrite_existing, ec);
+
+    return !ec;
+}
+
+std::filesystem::path ftes::ContentCache::downloadPath(const int64_t message_id) {
+    std::lock_guard lock(mutex_);
+
+    return cache_dir_ / ("download-" + std::to_string(message_id) + "-" + std::to_string(++download_counter_));
+}
+
+void ftes::ContentCache::insert(const int64_t message_id, const std::filesystem::path& file) {
+    fuse_external_storage::TraceSpan span("disk", "cacheInsert", message_id);
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(file, ec);
+
+    std::lock_guard lock(mutex_);
+
+    if (ec || size > max_bytes_ || entries_.contains(message_id)) {
+        std::filesystem::remove(file, ec);
+        return;
+    }
+
+    while (bytes_ + size > max_bytes_ && !entries_.empty()) {
+        evictOne();
+    }
+
+    std::filesystem::rename(file, objectPath(message_id), ec);
+    if (ec) {
+        FES_LOG(kError) << "[ContentCache] Failed to store object " << message_id << ": " << ec.message();
+        std::filesystem::remove(file, ec);
+        return;
+    }
+
+    // Objects evicted from the FIFO and requested again go straight to the LRU
+    Entry entry{size, Queue::kIn, {}};
+
+    if (const auto ghost = ghosts_.find(message_id); ghost != ghosts_.end()) {
+        ghost_queue_.erase(ghost->second);
+        ghosts_.erase(ghost);
+
+        entry.queue = Queue::kMain;
+        entry.position = main_queue_.insert(main_queue_.end(), message_id);
+    } else {
+        entry.position = in_queue_.insert(in_queue_.end(), message_id);
+        in_bytes_ += size;
+    }
+
+    bytes_ += size;
+    entries_.emplace(message_id, entry);
+}
+
+void ftes::ContentCache::erase(const int64_t message_id) {
+    std::lock_guard lock(mutex_);
+
+    if (const auto it = entries_.find(message_id); it != entries_.end()) {
+        removeEntry(it);
+    }
+
+    if (const auto ghost = ghosts_.find(message_id); ghost != ghosts_.end()) {
+        ghost_queue_.erase(ghost->second);
+        ghosts_.erase(ghost);
+    }
+}
+
+ftes::ContentCache::Stats ftes::ContentCache::stats() const {
+    std::lock_guard lock(mutex_);
+
+    Stats stats = stats_;
+    stats.bytes = bytes_;
+    stats.entries = entries_.size();
+
+    return stats;
+}
+
+std::filesystem::path ftes::ContentCache::objectPath(const int64_t message_id) const {
+    return cache_dir_ / std::to_string(message_id);
+}
+
+int ftes::ContentCache::openForRead(const int64_t message_id) {
+    const auto it = entries_.find(message_id);
+    if (it == entries_.end()) {
+        return -1;
+    }
+
+    const int fd = open(objectPath(message_id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // Removed behind our back, forget about it
+        removeEntry(it);
+        return -1;
+    }
+
+    // Hits in the FIFO don't promote, that is what keeps scans out of the LRU
+    if (it->second.queue == Queue::kMain) {
+        main_queue_.splice(main_queue_.end(), main_queue_, it->second.position);
+    }
+
+    return fd;
+}
+
+void ftes::ContentCache::evictOne() {
+    const bool evict_in = !in_queue_.empty() && (in_bytes_ > in_max_bytes_ || main_queue_.empty());
+    const int64_t victim = evict_in ? in_queue_.front() : main_queue_.front();
+
+    removeEntry(entries_.find(victim));
+    ++stats_.evictions;
+
+    if (evict_in) {
+        rememberGhost(victim);
+    }
+}
+
+void ftes::ContentCache::rememberGhost(const int64_t message_id) {
+    ghosts_[message_id] = ghost_queue_.insert(ghost_queue_.end(), message_id);
+
+    if (ghost_queue_.size() > kGhostEntries) {
+        ghosts_.erase(ghost_queue_.front());
+        ghost_queue_.pop_front();
+    }
+}
+
+void ftes::ContentCache::removeEntry(const std::unordered_map<int64_t, Entry>::iterator it) {
+    const auto& [message_id, entry] = *it;
+
+    if (entry.queue == Queue::kIn) {
+        in_queue_.erase(entry.position);
+        in_bytes_ -= entry.size;
+    } else {
+        main_queue_.erase(entry.position);
+    }
+    bytes_ -= entry.size;
+
+    std::error_code ec;
+    std::filesystem::remove(objectPath(message_id), ec);
+
+    entries_.erase(it);
+}
+
+void ftes::ContentCache::lockDirectory(const std::filesystem::path& cache_dir) {
+    for (size_t attempt = 0; attempt < 64; ++attempt) {
+        std::filesystem::path candidate = cache_dir;
+        if (attempt > 0) {
+            candidate += "." + std::to_string(attempt);
+        }
+
+        std::filesystem::create_directories(candidate);
+
+        const int fd = open((candidate / kLockFile).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open the lock of cache directory " + candidate.string() + ": " +
+                                     std::strerror(errno));
+        }
+
+        // Released by the kernel when the mount exits, however it exits
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            cache_dir_ = std::move(candidate);
+            lock_fd_ = fd;
+
+            if (attempt > 0) {
+                FES_LOG(kWarning) << "[ContentCache] " << cache_dir << " is used by another mount, caching in "
+                                  << cache_dir_;
+            }
+            return;
+        }
+
+        close(fd);
+    }
+
+    throw std::runtime_error("Every cache directory next to " + cache_dir.string() + " is used by another mount");
+}
+
+void ftes::ContentCache::loadExisting() {
+    struct CachedObject {
+        int64_t message_id;
+        uint64_t size;
+        std::filesystem::file_time_type last_write;
+    };
+
+    std::vector<CachedObject> objects;
+    std::error_code ec;
+
+    for (const auto& file : std::filesystem::directory_iterator(cache_dir_, ec)) {
+        const std::string name = file.path().filename().string();
+
+        // Leftovers of interrupted downloads, nobody else writes here while we hold the lock
+        if (isDownloadName(name)) {
+            std::filesystem::remove(file.path(), ec);
+            continue;
+        }
+
+        // Anything else isn't ours to delete
+        int64_t message_id = 0;
+        const auto [end, parse_error] = std::from_chars(name.data(), name.data() + name.size(), message_id);
+        if (!isNumber(name) || parse_error != std::errc() || end != name.data() + name.size()) {
+            continue;
+        }
+
+        objects.push_back({message_id, file.file_size(ec), file.last_write_time(ec)});
+    }
+
+    // Objects that survived a previous mount count as frequently used
+    std::ranges::sort(objects, {}, &CachedObject::last_write);
+
+    for (const auto& object : objects) {
+        if (bytes_ + object.size > max_bytes_) {
+            std::filesystem::remove(objectPath(object.message_id), ec);
+            continue;
+        }
+
+        entries_.emplace(object.message_id, Entry{object.size, Queue::kMain, main_queue_.insert(main_queue_.end(), object.message_id)});
+        bytes_ += object.size;
+    }
+
+    FES_LOG(kInfo) << "[ContentCache] Loaded " << entries_.size() << " cached objects (" << bytes_ << " bytes)";
+}
@@ -0,0 +1,102 @@
+#ifndef CONTENT_CACHE_HPP
+#define CONTENT_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace fuse_telegram_external_storage {
+
+    // Size-capped on-disk cache of downloaded file content, keyed by message ID.
+    // Message IDs are only unique within one storage, so each storage gets a
+    // directory of its own, which one mount at a time holds a lock on.
+    // A message never changes its content, so entries never need invalidation,
+    // only eviction. Eviction follows 2Q: objects seen once live in a FIFO, and
+    // only objects read again after falling out of it are promoted to the LRU,
+    // so one large sequential scan can't flush the working set
+    class ContentCache {
+    public:
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            uint64_t bytes = 0;
+            uint64_t entries = 0;
+        };
+
+        // Uses cache_dir, or cache_dir.1, cache_dir.2, ... while another
+        // mount of the same storage holds the lock on it
+        ContentCache(std::filesystem::path cache_dir, uint64_t max_bytes);
+        ~ContentCache();
+
+        ContentCache(const ContentCache&) = delete;
+        ContentCache& operator=(const ContentCache&) = delete;
+
+        // Read from a cached object, nullopt on a miss
+        std::optional<int> read(int64_t message_id, char* buf, size_t size, off_t offset);
+
+        [[nodiscard]] bool contains(int64_t message_id) const;
+
+        // Copy a cached object to dest_path, false on a miss
+        bool copyTo(int64_t message_id, const std::filesystem::path& dest_path);
+
+        // Unique path inside the cache directory to download an object into
+        std::filesystem::path downloadPath(int64_t message_id);
+
+        // Move a downloaded file into the cache. The file is removed if it
+        // doesn't fit into the budget
+        void insert(int64_t message_id, const std::filesystem::path& file);
+
+        void erase(int64_t message_id);
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        enum class Queue { kIn, kMain };
+
+        struct Entry {
+            uint64_t size;
+            Queue queue;
+            std::list<int64_t>::iterator position;
+        };
+
+        // Number of evicted IDs remembered to recognise a second access
+        static constexpr size_t kGhostEntries = 4096;
+
+        [[nodiscard]] std::filesystem::path objectPath(int64_t message_id) const;
+
+        // Callers hold mutex_
+        int openForRead(int64_t message_id);
+        void evictOne();
+        void rememberGhost(int64_t message_id);
+        void removeEntry(std::unordered_map<int64_t, Entry>::iterator it);
+
+        // Takes the lock on the first free directory of the cache_dir family
+        void lockDirectory(const std::filesystem::path& cache_dir);
+        void loadExisting();
+
+        std::filesystem::path cache_dir_;
+        int lock_fd_ = -1;
+        uint64_t max_bytes_;
+        uint64_t in_max_bytes_;
+
+        mutable std::mutex mutex_;
+        std::unordered_map<int64_t, Entry> entries_;
+        std::list<int64_t> in_queue_;   // FIFO of objects read once
+        std::list<int64_t> main_queue_; // LRU of objects read again
+        std::list<int64_t> ghost_queue_;
+        std::unordered_map<int64_t, std::list<int64_t>::iterator> ghosts_;
+
+        uint64_t bytes_ = 0;
+        uint64_t in_bytes_ = 0;
+        uint64_t download_counter_ = 0;
+
+        Stats stats_;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //CONTENT_CACHE_HPP
@@ -0,0 +1,64 @@
+#include "content-hash.hpp"
+
+#include <array>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+
+namespace ftes = fuse_telegram_external_storage;
+
+std::string ftes::ContentHash::sha256(const std::string_view data) {
+    std::array<unsigned char, kDigestBytes> digest{};
+    unsigned int digest_size = 0;
+
+    if (!EVP_Digest(data.data(), data.size(), digest.data(), &digest_size, EVP_sha256(), nullptr)) {
+        throw std::runtime_error("SHA-256 failed");
+    }
+
+    return toHex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest_size));
+}
+
+std::string ftes::ContentHash::toHex(const std::string_view digest) {
+    static constexpr char kDigits[] = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(digest.size() * 2);
+
+    for (const char byte : digest) {
+        hex.push_back(kDigits[static_cast<unsigned char>(byte) >> 4]);
+        hex.push_back(kDigits[static_cast<unsigned char>(byte) & 0x0F]);
+    }
+
+    return hex;
+}
+
+std::string ftes::ContentHash::fromHex(const std::string_view hex) {
+    const auto nibble = [](const char c) -> int {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    };
+
+    if (hex.size() != kDigestBytes * 2) {
+        return {};
+    }
+
+    std::string digest(kDigestBytes, '\0');
+
+    for (size_t i = 0; i < kDigestBytes; ++i) {
+        const int high = nibble(hex[2 * i]);
+        const int low = nibble(hex[2 * i + 1]);
+
+        if (high < 0 || low < 0) {
+            return {};
+        }
+
+        digest[i] = static_cast<char>(high << 4 | low);
+    }
+
+    return digest;
+}
@@ -0,0 +1,26 @@
+#ifndef CONTENT_HASH_HPP
+#define CONTENT_HASH_HPP
+
+#include <string>
+#include <string_view>
+
+namespace fuse_telegram_external_storage {
+
+    // SHA-256 of stored content, used to find chunks that are already uploaded.
+    // OpenSSL picks the SHA-NI or AVX2 implementation the CPU supports
+    class ContentHash {
+    public:
+        static constexpr size_t kDigestBytes = 32;
+
+        // Lowercase hex digest
+        static std::string sha256(std::string_view data);
+
+        static std::string toHex(std::string_view digest);
+
+        // Empty if hex isn't a well-formed digest
+        static std::string fromHex(std::string_view hex);
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //CONTENT_HASH_HPP
@@ -2,6 +2,8 @@
 #define EXTERNAL_STORAGE_INTERFACE_HPP
 
 #include <filesystem>
+#include <functional>
+#include <string>
 #include <vector>
 #include "lib/telegram-api/telegram-api.hpp"
 
@@ -10,8 +12,19 @@
 
 namespace fuse_external_storage {
 
+    // Part of a file modified since it was last stored
+    struct ByteRange {
+        off_t offset;
+        size_t size;
+    };
+
     class ExternalStorageInterface {
     public:
+        // Starts the storage's background threads. Called from the FUSE init
+        // callback, after libfuse has forked into the background: threads
+        // started before that don't exist in the daemon
+        virtual void start() {}
+
         virtual struct stat getAttr(std::filesystem::path& path) = 0;
         virtual std::vector<fuse_telegram_external_storage::FileInfo> listDir(const std::filesystem::path& path) = 0;
         virtual int createFile(const std::filesystem::path& path, mode_t mode) = 0;
@@ -22,6 +35,33 @@ namespace fuse_external_storage {
         virtual int removeDir(const std::filesystem::path& path) = 0;
         virtual int rename(const std::filesystem::path& from, const std::filesystem::path& to) = 0;
 
+        // Whole-file transfers used by write-back handles: one download when a
+        // handle is first written to, one upload when it is flushed. Storages
+        // may use dirty_ranges to skip re-uploading unchanged parts
+        virtual int fetchFile(const std::filesystem::path& path, const std::filesystem::path& local_path) = 0;
+        virtual int storeFile(const std::filesystem::path& path, const std::filesystem::path& local_path,
+                              const std::vector<ByteRange>& dirty_ranges) = 0;
+
+        // Storages may batch metadata changes, this commits them before returning
+        virtual int syncMetadata() = 0;
+
+        // -EIO while the last version stored for path failed to upload after
+        // storeFile returned, for its fsync, flush and open to report. With
+        // wait the path's uploads finish first and a failed one is retried
+        virtual int checkUpload([[maybe_unused]] const std::filesystem::path& path, [[maybe_unused]] bool wait) {
+            return 0;
+        }
+
+        // Appends metrics of the storage in the Prometheus text format, served
+        // after the FUSE ones in the mount's stats file
+        virtual void writeStats([[maybe_unused]] std::string& out) const {}
+
+        // Called after metadata committed by another mount has replaced the
+        // local copy, so frontends that let the kernel cache attributes can
+        // revalidate them. It may run inside any storage call and must not block.
+        // Set before mounting, an empty function removes it
+        virtual void setRemoteChangeListener([[maybe_unused]] std::function<void()> listener) {}
+
         virtual ~ExternalStorageInterface() = default;
     };
 
@@ -0,0 +1,150 @@
+#include "file-handle.hpp"
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
+namespace fes = fuse_external_storage;
+
+fes::FileHandle::FileHandle() {
+    std::string staging_template = (std::filesystem::temp_directory_path() / "fuse_staging_XXXXXX").string();
+
+    fd_ = mkstemp(staging_template.data());
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to create staging file");
+    }
+
+    staging_path_ = staging_template;
+}
+
+fes::FileHandle::~FileHandle() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(staging_path_, ec);
+}
+
+void fes::FileHandle::markLoaded(const bool dirty) {
+    std::lock_guard lock(mutex_);
+
+    loaded_ = true;
+    dirty_ = dirty_ || dirty;
+}
+
+void fes::FileHandle::markTruncated(const off_t old_size) {
+    std::lock_guard lock(mutex_);
+    markTruncatedLocked(old_size);
+}
+
+std::optional<int> fes::FileHandle::readStaged(char* buf, const size_t size, const off_t offset) {
+    std::lock_guard lock(mutex_);
+
+    if (!loaded_) {
+        return std::nullopt;
+    }
+
+    TraceSpan span("disk", "stagingRead", staging_path_.native());
+    const ssize_t bytes_read = pread(fd_, buf, size, offset);
+    return bytes_read < 0 ? -errno : static_cast<int>(bytes_read);
+}
+
+int fes::FileHandle::write(ExternalStorageInterface& storage, const std::filesystem::path& path,
+                           const char* buf, const size_t size, const off_t offset) {
+    std::lock_guard lock(mutex_);
+
+    if (const int error = ensureLoaded(storage, path)) {
+        return error;
+    }
+
+    TraceSpan span("disk", "stagingWrite", staging_path_.native());
+    const ssize_t bytes_written = pwrite(fd_, buf, size, offset);
+    if (bytes_written < 0) {
+        return -errno;
+    }
+
+    if (!dirty_ranges_.empty() && dirty_ranges_.back().offset + static_cast<off_t>(dirty_ranges_.back().size) == offset) {
+        dirty_ranges_.back().size += bytes_written;
+    } else {
+        dirty_ranges_.push_back({offset, static_cast<size_t>(bytes_written)});
+    }
+
+    dirty_ = true;
+    return static_cast<int>(bytes_written);
+}
+
+int fes::FileHandle::truncate(ExternalStorageInterface& storage, const std::filesystem::path& path, const off_t size) {
+    std::lock_guard lock(mutex_);
+
+    // Truncating to zero doesn't need the old content, only its size
+    if (size == 0 && !loaded_) {
+        std::filesystem::path current_path = path;
+        markTruncatedLocked(storage.getAttr(current_path).st_size);
+        return 0;
+    }
+
+    if (const int error = ensureLoaded(storage, path)) {
+        return error;
+    }
+
+    struct stat st = {};
+    if (fstat(fd_, &st) != 0 || ftruncate(fd_, size) != 0) {
+        return -errno;
+    }
+
+    // Both the cut-off tail and a zero-filled extension count as modified
+    if (st.st_size != size) {
+        const off_t from = std::min(st.st_size, size);
+        dirty_ranges_.push_back({from, static_cast<size_t>(std::max(st.st_size, size) - from)});
+    }
+
+    dirty_ = true;
+    return 0;
+}
+
+int fes::FileHandle::flush(ExternalStorageInterface& storage, const std::filesystem::path& path) {
+    std::lock_guard lock(mutex_);
+
+    if (!dirty_) {
+        return 0;
+    }
+
+    FES_LOG(kDebug) << "[FileHandle] Uploading staged content of " << path;
+
+    if (const int error = storage.storeFile(path, staging_path_, dirty_ranges_)) {
+        return error;
+    }
+
+    dirty_ = false;
+    dirty_ranges_.clear();
+    return 0;
+}
+
+void fes::FileHandle::markTruncatedLocked(const off_t old_size) {
+    loaded_ = true;
+    dirty_ = true;
+
+    // The staging file is still empty, so every old byte reads as a hole now
+    if (old_size > 0) {
+        dirty_ranges_.push_back({0, static_cast<size_t>(old_size)});
+    }
+}
+
+int fes::FileHandle::ensureLoaded(ExternalStorageInterface& storage, const std::filesystem::path& path) {
+    if (loaded_) {
+        return 0;
+    }
+
+    // Partial writes need the existing content underneath them
+    if (const int error = storage.fetchFile(path, staging_path_)) {
+        return error;
+    }
+
+    loaded_ = true;
+    return 0;
+}
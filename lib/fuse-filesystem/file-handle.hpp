@@ -0,0 +1,65 @@
+#ifndef FILE_HANDLE_HPP
+#define FILE_HANDLE_HPP
+
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse.h>
+
+#include "lib/external-storage-interface.hpp"
+
+namespace fuse_external_storage {
+
+// Write-back state of one open file, stored in fuse_file_info::fh.
+// Writes land in a local staging file and reach the storage as a single
+// upload when the handle is flushed or released
+class FileHandle {
+public:
+    FileHandle();
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    [[nodiscard]] static FileHandle* fromInfo(const fuse_file_info* fi) {
+        return fi ? reinterpret_cast<FileHandle*>(fi->fh) : nullptr;
+    }
+
+    // Treat the (empty) staging file as the file content without downloading,
+    // used for freshly created files
+    void markLoaded(bool dirty);
+
+    // Same for O_TRUNC opens, where the old_size bytes the file had are gone
+    // and count as modified, so none of the stored content is reused
+    void markTruncated(off_t old_size);
+
+    // Returns nullopt if nothing has been staged yet and the read should go to the storage
+    std::optional<int> readStaged(char* buf, size_t size, off_t offset);
+
+    int write(ExternalStorageInterface& storage, const std::filesystem::path& path, const char* buf, size_t size, off_t offset);
+    int truncate(ExternalStorageInterface& storage, const std::filesystem::path& path, off_t size);
+
+    // Upload the staged content if it changed since the last flush
+    int flush(ExternalStorageInterface& storage, const std::filesystem::path& path);
+
+private:
+    int ensureLoaded(ExternalStorageInterface& storage, const std::filesystem::path& path);
+    void markTruncatedLocked(off_t old_size);
+
+    std::mutex mutex_;
+    std::filesystem::path staging_path_;
+    int fd_ = -1;
+
+    bool loaded_ = false;
+    bool dirty_ = false;
+
+    // Written since the last flush, sequential writes are merged into one range
+    std::vector<ByteRange> dirty_ranges_;
+};
+
+} // fuse_external_storage
+
+#endif //FILE_HANDLE_HPP
@@ -0,0 +1,167 @@
+#include "file-operations.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "lib/logger/logger.hpp"
+
+namespace fes = fuse_external_storage;
+
+int fes::FileOperations::open(FuseState& state, const std::string_view path, const std::filesystem::path& storage_path,
+                              fuse_file_info* fi, struct stat& st) {
+    // The stats are rendered on every read, so the kernel mustn't cache them or trust their size
+    if (path == FuseFilesystem::kStatsPath) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+
+        fi->direct_io = 1;
+        fi->fh = 0;
+        return 0;
+    }
+
+    try {
+        std::filesystem::path attr_path = storage_path;
+        st = state.storage_interface->getAttr(attr_path);
+    } catch ([[maybe_unused]] const std::exception& e) {
+        return -ENOENT;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return -EISDIR;
+    }
+
+    // A version whose upload failed after its release is reported here
+    if (const int result = state.storage_interface->checkUpload(storage_path, true)) {
+        return result;
+    }
+
+    fi->fh = 0;
+
+    // Read-only opens go straight to the storage and need no staging
+    if ((fi->flags & O_ACCMODE) == O_RDONLY) {
+        return 0;
+    }
+
+    try {
+        auto* handle = new FileHandle();
+
+        if (fi->flags & O_TRUNC) {
+            handle->markTruncated(st.st_size);
+        }
+
+        fi->fh = reinterpret_cast<uint64_t>(handle);
+        return 0;
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::open] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+int fes::FileOperations::read(FuseState& state, const std::string_view path, const std::filesystem::path& storage_path,
+                              char* buf, const size_t size, const off_t offset, fuse_file_info* fi) {
+    if (path == FuseFilesystem::kStatsPath) {
+        const std::string stats = FuseFilesystem::renderStats(&state);
+        if (offset >= static_cast<off_t>(stats.size())) {
+            return 0;
+        }
+
+        const size_t length = std::min(size, stats.size() - static_cast<size_t>(offset));
+        memcpy(buf, stats.data() + offset, length);
+
+        return static_cast<int>(length);
+    }
+
+    try {
+        // Reads through a written handle must see the staged data
+        if (auto* handle = FileHandle::fromInfo(fi)) {
+            if (const auto bytes_read = handle->readStaged(buf, size, offset)) {
+                return *bytes_read;
+            }
+        }
+
+        return state.storage_interface->readFile(storage_path, buf, size, offset);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::read] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+int fes::FileOperations::write(FuseState& state, const std::filesystem::path& storage_path, const char* buf,
+                               const size_t size, const off_t offset, fuse_file_info* fi) {
+    try {
+        // Writes are staged locally and uploaded once on flush/release
+        if (auto* handle = FileHandle::fromInfo(fi)) {
+            return handle->write(*state.storage_interface, storage_path, buf, size, offset);
+        }
+
+        return state.storage_interface->writeFile(storage_path, buf, size, offset);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::write] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+int fes::FileOperations::truncate(FuseState& state, const std::string_view path,
+                                  const std::filesystem::path& storage_path, const off_t size, fuse_file_info* fi) {
+    if (path == FuseFilesystem::kStatsPath) {
+        return -EACCES;
+    }
+
+    try {
+        if (auto* handle = FileHandle::fromInfo(fi)) {
+            return handle->truncate(*state.storage_interface, storage_path, size);
+        }
+
+        // Truncate by path: stage, cut and upload in one go
+        FileHandle handle;
+        if (const int result = handle.truncate(*state.storage_interface, storage_path, size)) {
+            return result;
+        }
+
+        return handle.flush(*state.storage_interface, storage_path);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::truncate] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+int fes::FileOperations::flush(FuseState& state, const std::filesystem::path& storage_path, fuse_file_info* fi) {
+    auto* handle = FileHandle::fromInfo(fi);
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        if (const int result = handle->flush(*state.storage_interface, storage_path)) {
+            return result;
+        }
+
+        // Uploads run in the background, an earlier one may have failed since
+        return state.storage_interface->checkUpload(storage_path, false);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::flush] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+int fes::FileOperations::fsync(FuseState& state, const std::filesystem::path& storage_path, fuse_file_info* fi) {
+    try {
+        if (auto* handle = FileHandle::fromInfo(fi)) {
+            if (const int result = handle->flush(*state.storage_interface, storage_path)) {
+                return result;
+            }
+        }
+
+        if (const int result = state.storage_interface->checkUpload(storage_path, true)) {
+            return result;
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[FileOperations::fsync] Error: " << e.what();
+        return -EIO;
+    }
+
+    // The new content is only durable once the metadata pointing at it is
+    return state.storage_interface->syncMetadata();
+}
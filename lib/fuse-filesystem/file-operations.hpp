@@ -0,0 +1,41 @@
+#ifndef FILE_OPERATIONS_HPP
+#define FILE_OPERATIONS_HPP
+
+#include <filesystem>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "lib/fuse-filesystem/fuse-filesystem.hpp"
+
+namespace fuse_external_storage {
+
+// File handlers shared by the path and the inode frontend, which resolve the
+// path before and reply after. path is the one in the mount, storage_path the
+// one the storage knows the file by. All return -errno on failure
+class FileOperations {
+public:
+    // Sets up fi for the file and fills st with its attributes. The stats file
+    // is opened with direct_io and leaves st untouched
+    static int open(FuseState& state, std::string_view path, const std::filesystem::path& storage_path,
+                    fuse_file_info* fi, struct stat& st);
+
+    // Returns the number of bytes read into buf
+    static int read(FuseState& state, std::string_view path, const std::filesystem::path& storage_path, char* buf,
+                    size_t size, off_t offset, fuse_file_info* fi);
+
+    // Returns the number of bytes written
+    static int write(FuseState& state, const std::filesystem::path& storage_path, const char* buf, size_t size,
+                     off_t offset, fuse_file_info* fi);
+
+    // Through the handle if the file is open, otherwise straight to the storage
+    static int truncate(FuseState& state, std::string_view path, const std::filesystem::path& storage_path, off_t size,
+                        fuse_file_info* fi);
+
+    static int flush(FuseState& state, const std::filesystem::path& storage_path, fuse_file_info* fi);
+    static int fsync(FuseState& state, const std::filesystem::path& storage_path, fuse_file_info* fi);
+};
+
+} // fuse_external_storage
+
+#endif //FILE_OPERATIONS_HPP
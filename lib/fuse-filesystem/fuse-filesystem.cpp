@@ -1,12 +1,15 @@
 #include "fuse-filesystem.hpp"
-#include <iostream>
 #include <cstring>
+#include <algorithm>
+
+#include "lib/fuse-filesystem/file-operations.hpp"
+#include "lib/logger/logger.hpp"
 
 namespace fes = fuse_external_storage;
 
 std::pair<std::filesystem::path, int> fes::FuseFilesystem::getFullCurrentPath(const char* mounted_fs_path, const FuseState* state) {
     if (!state) {
-        std::cerr << "[getFullCurrentPath] Error: FUSE state is null!" << std::endl;
+        FES_LOG(kError) << "[getFullCurrentPath] Error: FUSE state is null!";
         return {"", -EIO};
     }
 
@@ -15,14 +18,72 @@ std::pair<std::filesystem::path, int> fes::FuseFilesystem::getFullCurrentPath(co
         current_path /= mounted_fs_path;
     }
 
-    std::cerr << "[getFullCurrentPath] Current path: " << current_path << std::endl;
-    std::cerr << "[getFullCurrentPath] Path in mounted fs: " << mounted_fs_path << std::endl;
+    FES_LOG(kTrace) << "[getFullCurrentPath] Current path: " << current_path;
+    FES_LOG(kTrace) << "[getFullCurrentPath] Path in mounted fs: " << mounted_fs_path;
 
     return {current_path, 0};
 }
 
+void fes::applyKernelCacheOptions(fuse_conn_info* conn, const KernelCacheOptions& options) {
+    const auto request = [conn](const unsigned capability, const bool enabled, const char* name) {
+        if (!enabled) {
+            conn->want &= ~capability;
+        } else if (conn->capable & capability) {
+            conn->want |= capability;
+        } else {
+            FES_LOG(kWarning) << "[init] Kernel doesn't support " << name;
+        }
+    };
+
+    request(FUSE_CAP_ASYNC_READ, options.async_read, "async reads");
+    request(FUSE_CAP_WRITEBACK_CACHE, options.writeback_cache, "writeback caching");
+    request(FUSE_CAP_SPLICE_READ, options.splice, "splice reads");
+    request(FUSE_CAP_SPLICE_WRITE, options.splice, "splice writes");
+    request(FUSE_CAP_SPLICE_MOVE, options.splice, "splice moves");
+
+    // libfuse caps it by its buffer size and asks the kernel for the pages needed
+    if (options.max_write > 0) {
+        conn->max_write = options.max_write;
+    }
+
+    // The kernel only lowers its read-ahead here, raising it goes through /sys/class/bdi
+    if (options.max_readahead > 0) {
+        if (options.max_readahead > conn->max_readahead) {
+            FES_LOG(kInfo) << "[init] Read-ahead is capped at " << conn->max_readahead << " bytes by the kernel";
+        }
+        conn->max_readahead = std::min(options.max_readahead, conn->max_readahead);
+    }
+
+    FES_LOG(kInfo) << "[init] Max write " << conn->max_write << " bytes, read-ahead " << conn->max_readahead
+                   << " bytes, writeback cache " << ((conn->want & FUSE_CAP_WRITEBACK_CACHE) ? "on" : "off");
+}
+
+void* fes::FuseFilesystem::ff_init(fuse_conn_info* conn, fuse_config* cfg) {
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    // Cached pages are dropped on open when getattr reports a new mtime or size
+    cfg->kernel_cache = 0;
+    cfg->auto_cache = state->kernel_cache.page_cache ? 1 : 0;
+
+    applyKernelCacheOptions(conn, state->kernel_cache);
+
+    // libfuse has daemonized by now, so threads started here keep running
+    state->storage_interface->start();
+    SpanTracer::startDumpThread();
+
+    return state;
+}
+
+std::string fes::FuseFilesystem::renderStats(const FuseState* state) {
+    std::string out;
+    state->stats.writePrometheus(out, "fes_fuse", "op");
+    state->storage_interface->writeStats(out);
+
+    return out;
+}
+
 int fes::FuseFilesystem::ff_getattr(const char* path, struct stat* stbuf, fuse_file_info* fi) {
-    std::cerr << "[ff_getattr] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_getattr] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -47,17 +108,25 @@ int fes::FuseFilesystem::ff_getattr(const char* path, struct stat* stbuf, fuse_f
         return 0;
     }
 
+    if (path == kStatsPath) {
+        stbuf->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = static_cast<off_t>(renderStats(state).size());
+
+        return 0;
+    }
+
     try {
         *stbuf = state->storage_interface->getAttr(current_path);
         return 0;
     } catch (const std::exception& e) {
-        std::cerr << "[ff_getattr] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_getattr] Error: " << e.what();
         return -ENOENT;
     }
 }
 
 int fes::FuseFilesystem::ff_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, fuse_file_info* fi, fuse_readdir_flags flags) {
-    std::cerr << "[ff_readdir] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_readdir] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -71,7 +140,7 @@ int fes::FuseFilesystem::ff_readdir(const char* path, void* buf, fuse_fill_dir_t
 
     try {
         const auto entries = state->storage_interface->listDir(path);
-        std::cerr << "[ff_readdir] Got " << entries.size() << " entries" << std::endl;
+        FES_LOG(kDebug) << "[ff_readdir] Got " << entries.size() << " entries";
 
         for (const auto& entry : entries) {
             struct stat st = {};
@@ -85,76 +154,57 @@ int fes::FuseFilesystem::ff_readdir(const char* path, void* buf, fuse_fill_dir_t
 
             // Extract just the filename from the full path
             std::string name = std::filesystem::path(entry.path).filename().string();
-            std::cerr << "[ff_readdir] Adding entry: " << name << std::endl;
+            FES_LOG(kTrace) << "[ff_readdir] Adding entry: " << name;
 
             filler(buf, name.c_str(), &st, 0, static_cast<fuse_fill_dir_flags>(0));
         }
 
         return 0;
     } catch (const std::exception& e) {
-        std::cerr << "[ff_readdir] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_readdir] Error: " << e.what();
         return -EIO;
     }
 }
 
 int fes::FuseFilesystem::ff_open(const char* path, fuse_file_info* fi) {
-    std::cerr << "[ff_open] " << path << std::endl;
-    const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+    FES_LOG(kTrace) << "[ff_open] " << path;
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
     if (error) {
         return error;
     }
 
-    try {
-        const struct stat st = state->storage_interface->getAttr(current_path);
-
-        if (S_ISDIR(st.st_mode)) {
-            return -EISDIR;
-        }
-
-        return 0;
-    } catch ([[maybe_unused]] const std::exception& e) {
-        return -ENOENT;
-    }
+    struct stat st = {};
+    return FileOperations::open(*state, path, current_path, fi, st);
 }
 
 int fes::FuseFilesystem::ff_read(const char* path, char* buf, size_t size, off_t offset, fuse_file_info* fi) {
-    std::cerr << "[ff_read] " << path << std::endl;
-    const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+    FES_LOG(kTrace) << "[ff_read] " << path;
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
     if (error) {
         return error;
     }
 
-    try {
-        return state->storage_interface->readFile(current_path, buf, size, offset);
-    } catch (const std::exception& e) {
-        std::cerr << "[ff_read] Error: " << e.what() << std::endl;
-        return -EIO;
-    }
+    return FileOperations::read(*state, path, current_path, buf, size, offset, fi);
 }
 
 int fes::FuseFilesystem::ff_write(const char* path, const char* buf, size_t size, off_t offset, fuse_file_info* fi) {
-    std::cerr << "[ff_write] " << path << std::endl;
-    const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+    FES_LOG(kTrace) << "[ff_write] " << path;
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
     if (error) {
         return error;
     }
 
-    try {
-        return state->storage_interface->writeFile(current_path, buf, size, offset);
-    } catch (const std::exception& e) {
-        std::cerr << "[ff_write] Error: " << e.what() << std::endl;
-        return -EIO;
-    }
+    return FileOperations::write(*state, current_path, buf, size, offset, fi);
 }
 
 int fes::FuseFilesystem::ff_create(const char* path, mode_t mode, fuse_file_info* fi) {
-    std::cerr << "[ff_create] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_create] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -163,15 +213,24 @@ int fes::FuseFilesystem::ff_create(const char* path, mode_t mode, fuse_file_info
     }
 
     try {
-        return state->storage_interface->createFile(current_path, mode);
+        if (const int result = state->storage_interface->createFile(current_path, mode)) {
+            return result;
+        }
+
+        // A new file is empty, so there is nothing to download before writing
+        auto* handle = new FileHandle();
+        handle->markLoaded(false);
+
+        fi->fh = reinterpret_cast<uint64_t>(handle);
+        return 0;
     } catch (const std::exception& e) {
-        std::cerr << "[ff_create] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_create] Error: " << e.what();
         return -EIO;
     }
 }
 
 int fes::FuseFilesystem::ff_unlink(const char* path) {
-    std::cerr << "[ff_unlink] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_unlink] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -182,13 +241,13 @@ int fes::FuseFilesystem::ff_unlink(const char* path) {
     try {
         return state->storage_interface->unlinkFile(current_path);
     } catch (const std::exception& e) {
-        std::cerr << "[ff_unlink] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_unlink] Error: " << e.what();
         return -EIO;
     }
 }
 
 int fes::FuseFilesystem::ff_rename(const char* path_from, const char* path_to, [[maybe_unused]] unsigned int flags) {
-    std::cerr << "[ff_rename] " << path_from << " to " << path_to << std::endl;
+    FES_LOG(kTrace) << "[ff_rename] " << path_from << " to " << path_to;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path_from, error_from] = getFullCurrentPath(path_from, state);
@@ -204,13 +263,13 @@ int fes::FuseFilesystem::ff_rename(const char* path_from, const char* path_to, [
     try {
         return state->storage_interface->rename(current_path_from, current_path_to);
     } catch (const std::exception& e) {
-        std::cerr << "[ff_rename] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_rename] Error: " << e.what();
         return -EIO;
     }
 }
 
 int fes::FuseFilesystem::ff_mkdir(const char* path, mode_t mode) {
-    std::cerr << "[ff_mkdir] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_mkdir] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -221,13 +280,13 @@ int fes::FuseFilesystem::ff_mkdir(const char* path, mode_t mode) {
     try {
         return state->storage_interface->createDir(current_path, mode);
     } catch (const std::exception& e) {
-        std::cerr << "[ff_mkdir] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_mkdir] Error: " << e.what();
         return -EIO;
     }
 }
 
 int fes::FuseFilesystem::ff_rmdir(const char* path) {
-    std::cerr << "[ff_rmdir] " << path << std::endl;
+    FES_LOG(kTrace) << "[ff_rmdir] " << path;
     const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
 
     auto [current_path, error] = getFullCurrentPath(path, state);
@@ -238,7 +297,84 @@ int fes::FuseFilesystem::ff_rmdir(const char* path) {
     try {
         return state->storage_interface->removeDir(current_path);
     } catch (const std::exception& e) {
-        std::cerr << "[ff_rmdir] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[ff_rmdir] Error: " << e.what();
         return -EIO;
     }
-}
\ No newline at end of file
+}
+
+int fes::FuseFilesystem::ff_truncate(const char* path, off_t size, fuse_file_info* fi) {
+    FES_LOG(kTrace) << "[ff_truncate] " << path << " to " << size;
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    auto [current_path, error] = getFullCurrentPath(path, state);
+    if (error) {
+        return error;
+    }
+
+    return FileOperations::truncate(*state, path, current_path, size, fi);
+}
+
+int fes::FuseFilesystem::ff_flush(const char* path, fuse_file_info* fi) {
+    FES_LOG(kTrace) << "[ff_flush] " << path;
+
+    if (!FileHandle::fromInfo(fi)) {
+        return 0;
+    }
+
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    auto [current_path, error] = getFullCurrentPath(path, state);
+    if (error) {
+        return error;
+    }
+
+    return FileOperations::flush(*state, current_path, fi);
+}
+
+int fes::FuseFilesystem::ff_fsync(const char* path, [[maybe_unused]] int datasync, fuse_file_info* fi) {
+    FES_LOG(kTrace) << "[ff_fsync] " << path;
+    auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    auto [current_path, error] = getFullCurrentPath(path, state);
+    if (error) {
+        return error;
+    }
+
+    return FileOperations::fsync(*state, current_path, fi);
+}
+
+int fes::FuseFilesystem::ff_fsyncdir(const char* path, [[maybe_unused]] int datasync, [[maybe_unused]] fuse_file_info* fi) {
+    FES_LOG(kTrace) << "[ff_fsyncdir] " << path;
+    const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    return state->storage_interface->syncMetadata();
+}
+
+int fes::FuseFilesystem::ff_release(const char* path, fuse_file_info* fi) {
+    FES_LOG(kTrace) << "[ff_release] " << path;
+    const auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+
+    auto* handle = FileHandle::fromInfo(fi);
+    if (!handle) {
+        return 0;
+    }
+
+    int result = 0;
+
+    auto [current_path, error] = getFullCurrentPath(path, state);
+    if (error) {
+        result = error;
+    } else {
+        try {
+            result = handle->flush(*state->storage_interface, current_path);
+        } catch (const std::exception& e) {
+            FES_LOG(kError) << "[ff_release] Error: " << e.what();
+            result = -EIO;
+        }
+    }
+
+    delete handle;
+    fi->fh = 0;
+
+    return result;
+}
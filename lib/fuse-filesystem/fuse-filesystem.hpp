@@ -1,23 +1,101 @@
 #ifndef FUSE_FILESYSTEM_HPP
 #define FUSE_FILESYSTEM_HPP
 
+#include <algorithm>
 #include <filesystem>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
 
 #define FUSE_USE_VERSION 31
 #include <fuse3/fuse.h>
 
 #include "lib/external-storage-interface.hpp"
+#include "lib/fuse-filesystem/file-handle.hpp"
+#include "lib/operation-stats/operation-stats.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
 
 namespace fuse_external_storage {
 
+// How far the kernel may cache and batch I/O of the mount, applied when the
+// connection is initialized
+struct KernelCacheOptions {
+    // Keep file pages cached across opens until the file's mtime or size change
+    bool page_cache = true;
+
+    // Buffer writes in the page cache and send them in large batches
+    bool writeback_cache = false;
+
+    // Largest write request and read-ahead window in bytes, 0 keeps the defaults
+    uint32_t max_write = 1 << 20;
+    uint32_t max_readahead = 1 << 20;
+
+    // Several reads of one file in flight at once
+    bool async_read = true;
+
+    // Move request data through pipes instead of copying it
+    bool splice = false;
+};
+
+// Requests the capabilities and sizes of options the kernel supports
+void applyKernelCacheOptions(fuse_conn_info* conn, const KernelCacheOptions& options);
+
 struct FuseState {
     std::filesystem::path mount_path;
     std::unique_ptr<ExternalStorageInterface> storage_interface;
+
+    KernelCacheOptions kernel_cache;
+
+    // Calls, errors and latency of every callback, by operation
+    OperationStats stats;
+};
+
+// Operation name usable as a template argument
+template <size_t N>
+struct OperationName {
+    char value[N];
+
+    constexpr OperationName(const char (&name)[N]) { std::copy_n(name, N, value); }
+};
+
+// FUSE callback recorded in FuseState::stats under Name and traced as a span
+// carrying the path. Bytes returned by read and write are counted as read and written
+template <OperationName Name, auto Callback>
+struct MeasuredOperation;
+
+template <OperationName Name, typename... Args, int (*Callback)(Args...)>
+struct MeasuredOperation<Name, Callback> {
+    static int call(Args... args) {
+        const char* path = std::get<0>(std::forward_as_tuple(args...));
+        TraceSpan span("fuse", Name.value, path ? path : "");
+
+        auto* state = static_cast<FuseState*>(fuse_get_context()->private_data);
+        if (!state) {
+            return Callback(args...);
+        }
+
+        auto& operation = state->stats.operation(Name.value);
+        OperationStats::Timer timer(operation);
+
+        const int result = Callback(args...);
+        if (result >= 0) {
+            timer.succeed();
+        }
+
+        if (result > 0 && std::string_view(Name.value) == "read") {
+            operation.bytes_read.fetch_add(result, std::memory_order_relaxed);
+        } else if (result > 0 && std::string_view(Name.value) == "write") {
+            operation.bytes_written.fetch_add(result, std::memory_order_relaxed);
+        }
+
+        return result;
+    }
 };
 
 class FuseFilesystem {
 public:
+    static void* ff_init(fuse_conn_info*, fuse_config*);
     static int ff_getattr(const char*, struct stat*, fuse_file_info*);
     static int ff_readdir(const char*, void*, fuse_fill_dir_t, off_t, fuse_file_info*, fuse_readdir_flags);
     static int ff_open(const char*, fuse_file_info*);
@@ -28,27 +106,45 @@ public:
     static int ff_rename(const char*, const char*, unsigned int flags);
     static int ff_mkdir(const char*, mode_t);
     static int ff_rmdir(const char*);
+    static int ff_truncate(const char*, off_t, fuse_file_info*);
+    static int ff_flush(const char*, fuse_file_info*);
+    static int ff_fsync(const char*, int, fuse_file_info*);
+    static int ff_release(const char*, fuse_file_info*);
+    static int ff_fsyncdir(const char*, int, fuse_file_info*);
 
     [[nodiscard]] static const fuse_operations& getOperations() {
         return operations_;
     }
 
+    // Hidden read-only file with the stats of the mount in the Prometheus
+    // text format. It isn't listed and exists only in the mount
+    static constexpr std::string_view kStatsPath = "/.fes-stats";
+
+    // Contents of the stats file, shared with the low-level frontend
+    static std::string renderStats(const FuseState* state);
+
 private:
     // inline static const std::string fuse_directory_name_ = "fuse-external-fs";
 
     static std::pair<std::filesystem::path, int> getFullCurrentPath(const char*, const FuseState*);
 
     static constexpr fuse_operations operations_ = {
-        .getattr    = ff_getattr,
-        .mkdir      = ff_mkdir,
-        .unlink     = ff_unlink,
-        .rmdir      = ff_rmdir,
-        .rename     = ff_rename,
-        .open       = ff_open,
-        .read       = ff_read,
-        .write      = ff_write,
-        .readdir    = ff_readdir,
-        .create     = ff_create,
+        .getattr    = MeasuredOperation<"getattr", ff_getattr>::call,
+        .mkdir      = MeasuredOperation<"mkdir", ff_mkdir>::call,
+        .unlink     = MeasuredOperation<"unlink", ff_unlink>::call,
+        .rmdir      = MeasuredOperation<"rmdir", ff_rmdir>::call,
+        .rename     = MeasuredOperation<"rename", ff_rename>::call,
+        .truncate   = MeasuredOperation<"truncate", ff_truncate>::call,
+        .open       = MeasuredOperation<"open", ff_open>::call,
+        .read       = MeasuredOperation<"read", ff_read>::call,
+        .write      = MeasuredOperation<"write", ff_write>::call,
+        .flush      = MeasuredOperation<"flush", ff_flush>::call,
+        .release    = MeasuredOperation<"release", ff_release>::call,
+        .fsync      = MeasuredOperation<"fsync", ff_fsync>::call,
+        .readdir    = MeasuredOperation<"readdir", ff_readdir>::call,
+        .fsyncdir   = MeasuredOperation<"fsyncdir", ff_fsyncdir>::call,
+        .init       = ff_init,
+        .create     = MeasuredOperation<"create", ff_create>::call,
     };
 };
 
@@ -0,0 +1,724 @@
+#include "fuse-lowlevel-filesystem.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include "lib/fuse-filesystem/file-handle.hpp"
+#include "lib/fuse-filesystem/file-operations.hpp"
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
+namespace fes = fuse_external_storage;
+
+namespace {
+
+    // Inode number reported by plain readdir for entries the kernel hasn't looked up
+    constexpr ino_t kUnknownIno = 0xffffffff;
+
+    // Listing of an open directory, taken on opendir so offsets stay stable
+    struct DirectoryHandle {
+        std::string path;
+        std::vector<fuse_telegram_external_storage::FileInfo> entries;
+    };
+
+    std::string parentOf(const std::string& path) {
+        const size_t separator = path.rfind('/');
+        return separator == 0 ? "/" : path.substr(0, separator);
+    }
+
+} // namespace
+
+fes::OperationStats& fes::requestStats(fuse_req_t req) {
+    return FuseLowlevelFilesystem::fromRequest(req).state().stats;
+}
+
+fes::FuseLowlevelFilesystem::FuseLowlevelFilesystem(FuseState& state, const LowlevelOptions options)
+    : state_(state), options_(options) {}
+
+int fes::FuseLowlevelFilesystem::run(const int argc, char** argv) {
+    fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    fuse_cmdline_opts opts = {};
+
+    if (fuse_parse_cmdline(&args, &opts) != 0) {
+        return 1;
+    }
+
+    if (opts.show_help || opts.show_version) {
+        if (opts.show_help) {
+            fuse_cmdline_help();
+            fuse_lowlevel_help();
+        } else {
+            fuse_lowlevel_version();
+        }
+
+        fuse_opt_free_args(&args);
+        return 0;
+    }
+
+    if (!opts.mountpoint) {
+        FES_LOG(kError) << "[FuseLowlevelFilesystem] No mount point given";
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    int result = -1;
+
+    session_ = fuse_session_new(&args, &operations_, sizeof(operations_), this);
+    if (session_ && fuse_set_signal_handlers(session_) == 0) {
+        if (fuse_session_mount(session_, opts.mountpoint) == 0) {
+            fuse_daemonize(opts.foreground);
+
+            state_.storage_interface->setRemoteChangeListener([this] { onRemoteChange(); });
+            notifier_ = std::jthread([this](const std::stop_token& stop_token) { notifierLoop(stop_token); });
+
+            FES_LOG(kInfo) << "[FuseLowlevelFilesystem] Serving " << opts.mountpoint << " with entry timeout "
+                           << options_.entry_timeout << "s and attribute timeout " << options_.attr_timeout << "s";
+
+            result = opts.singlethread ? fuse_session_loop(session_) : fuse_session_loop_mt(session_, opts.clone_fd);
+
+            state_.storage_interface->setRemoteChangeListener({});
+            notifier_.request_stop();
+            notifier_.join();
+
+            fuse_session_unmount(session_);
+        }
+
+        fuse_remove_signal_handlers(session_);
+    }
+
+    if (session_) {
+        fuse_session_destroy(session_);
+        session_ = nullptr;
+    }
+
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+
+    return result == 0 ? 0 : 1;
+}
+
+void fes::FuseLowlevelFilesystem::ll_init(void* userdata, fuse_conn_info* conn) {
+    auto& self = *static_cast<FuseLowlevelFilesystem*>(userdata);
+    applyKernelCacheOptions(conn, self.state_.kernel_cache);
+
+    // The session has daemonized by now, so threads started here keep running
+    self.state_.storage_interface->start();
+    SpanTracer::startDumpThread();
+}
+
+int fes::FuseLowlevelFilesystem::ll_lookup(fuse_req_t req, const fuse_ino_t parent, const char* name) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    if (!parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string path = InodeTable::childPath(*parent_path, name);
+    FES_LOG(kTrace) << "[ll_lookup] " << path;
+
+    struct stat st = {};
+    if (const int error = self.statPath(path, st)) {
+        return error;
+    }
+
+    const fuse_entry_param entry = self.makeEntry(path, st);
+    fuse_reply_entry(req, &entry);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_forget(fuse_req_t req, const fuse_ino_t ino, const uint64_t nlookup) {
+    fromRequest(req).inodes_.forget(ino, nlookup);
+    fuse_reply_none(req);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_forget_multi(fuse_req_t req, const size_t count, fuse_forget_data* forgets) {
+    auto& self = fromRequest(req);
+
+    for (size_t i = 0; i < count; ++i) {
+        self.inodes_.forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_getattr(fuse_req_t req, const fuse_ino_t ino, [[maybe_unused]] fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_getattr] " << *path;
+
+    struct stat st = {};
+    if (const int error = self.statPath(*path, st)) {
+        return error;
+    }
+
+    st.st_ino = ino;
+    self.inodes_.remember(ino, st);
+    fuse_reply_attr(req, &st, self.attrTimeout(*path));
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_setattr(fuse_req_t req, const fuse_ino_t ino, struct stat* attr, const int to_set,
+                                            fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_setattr] " << *path;
+
+    // Only the size is stored, mode, owner and time changes are accepted and dropped
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        if (const int result = FileOperations::truncate(self.state_, *path, *path, attr->st_size, fi)) {
+            return result;
+        }
+    }
+
+    struct stat st = {};
+    if (const int error = self.statPath(*path, st)) {
+        return error;
+    }
+
+    // Still being written through a handle, the staged size is the current one
+    if ((to_set & FUSE_SET_ATTR_SIZE) && FileHandle::fromInfo(fi)) {
+        st.st_size = attr->st_size;
+    }
+
+    st.st_ino = ino;
+    self.inodes_.remember(ino, st);
+    fuse_reply_attr(req, &st, self.attrTimeout(*path));
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_mkdir(fuse_req_t req, const fuse_ino_t parent, const char* name, const mode_t mode) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    if (!parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string path = InodeTable::childPath(*parent_path, name);
+    FES_LOG(kTrace) << "[ll_mkdir] " << path;
+
+    try {
+        if (const int result = self.state_.storage_interface->createDir(path, mode)) {
+            return result;
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_mkdir] Error: " << e.what();
+        return -EIO;
+    }
+
+    struct stat st = {};
+    if (const int error = self.statPath(path, st)) {
+        return error;
+    }
+
+    const fuse_entry_param entry = self.makeEntry(path, st);
+    fuse_reply_entry(req, &entry);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_unlink(fuse_req_t req, const fuse_ino_t parent, const char* name) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    if (!parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string path = InodeTable::childPath(*parent_path, name);
+    FES_LOG(kTrace) << "[ll_unlink] " << path;
+
+    try {
+        if (const int result = self.state_.storage_interface->unlinkFile(path)) {
+            return result;
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_unlink] Error: " << e.what();
+        return -EIO;
+    }
+
+    self.inodes_.unlink(path);
+    fuse_reply_err(req, 0);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_rmdir(fuse_req_t req, const fuse_ino_t parent, const char* name) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    if (!parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string path = InodeTable::childPath(*parent_path, name);
+    FES_LOG(kTrace) << "[ll_rmdir] " << path;
+
+    try {
+        if (const int result = self.state_.storage_interface->removeDir(path)) {
+            return result;
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_rmdir] Error: " << e.what();
+        return -EIO;
+    }
+
+    self.inodes_.unlink(path);
+    fuse_reply_err(req, 0);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_rename(fuse_req_t req, const fuse_ino_t parent, const char* name,
+                                           const fuse_ino_t new_parent, const char* new_name,
+                                           [[maybe_unused]] const unsigned int flags) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    const auto new_parent_path = self.inodes_.path(new_parent);
+    if (!parent_path || !new_parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string from = InodeTable::childPath(*parent_path, name);
+    const std::string to = InodeTable::childPath(*new_parent_path, new_name);
+    FES_LOG(kTrace) << "[ll_rename] " << from << " to " << to;
+
+    try {
+        if (const int result = self.state_.storage_interface->rename(from, to)) {
+            return result;
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_rename] Error: " << e.what();
+        return -EIO;
+    }
+
+    self.inodes_.rename(from, to);
+    fuse_reply_err(req, 0);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_open(fuse_req_t req, const fuse_ino_t ino, fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_open] " << *path;
+
+    struct stat st = {};
+    if (const int result = FileOperations::open(self.state_, *path, *path, fi, st)) {
+        return result;
+    }
+
+    // Like auto_cache of the path frontend, pages survive the open unless the
+    // file changed since its attributes were last sent to the kernel
+    if (!fi->direct_io) {
+        const bool changed = self.inodes_.remember(ino, st);
+        fi->keep_cache = self.state_.kernel_cache.page_cache && !changed ? 1 : 0;
+    }
+
+    fuse_reply_open(req, fi);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_read(fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset,
+                                         fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_read] " << *path;
+
+    std::vector<char> buf(size);
+
+    const int result = FileOperations::read(self.state_, *path, *path, buf.data(), size, offset, fi);
+    if (result < 0) {
+        return result;
+    }
+
+    fuse_reply_buf(req, buf.data(), result);
+    return result;
+}
+
+int fes::FuseLowlevelFilesystem::ll_write(fuse_req_t req, const fuse_ino_t ino, const char* buf, const size_t size,
+                                          const off_t offset, fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_write] " << *path;
+
+    const int result = FileOperations::write(self.state_, *path, buf, size, offset, fi);
+    if (result < 0) {
+        return result;
+    }
+
+    fuse_reply_write(req, result);
+    return result;
+}
+
+int fes::FuseLowlevelFilesystem::ll_flush(fuse_req_t req, const fuse_ino_t ino, fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    if (FileHandle::fromInfo(fi)) {
+        const auto path = self.inodes_.path(ino);
+        if (!path) {
+            return -ESTALE;
+        }
+
+        FES_LOG(kTrace) << "[ll_flush] " << *path;
+
+        if (const int result = FileOperations::flush(self.state_, *path, fi)) {
+            return result;
+        }
+    }
+
+    fuse_reply_err(req, 0);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_release(fuse_req_t req, const fuse_ino_t ino, fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    auto* handle = FileHandle::fromInfo(fi);
+    if (!handle) {
+        fuse_reply_err(req, 0);
+        return 0;
+    }
+
+    int result = -ESTALE;
+
+    if (const auto path = self.inodes_.path(ino)) {
+        FES_LOG(kTrace) << "[ll_release] " << *path;
+
+        try {
+            result = handle->flush(*self.state_.storage_interface, *path);
+        } catch (const std::exception& e) {
+            FES_LOG(kError) << "[ll_release] Error: " << e.what();
+            result = -EIO;
+        }
+    }
+
+    delete handle;
+    fi->fh = 0;
+
+    if (result < 0) {
+        return result;
+    }
+
+    fuse_reply_err(req, 0);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_fsync(fuse_req_t req, const fuse_ino_t ino, [[maybe_unused]] const int datasync,
+                                          fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_fsync] " << *path;
+
+    if (const int result = FileOperations::fsync(self.state_, *path, fi)) {
+        return result;
+    }
+
+    fuse_reply_err(req, 0);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_opendir(fuse_req_t req, const fuse_ino_t ino, fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto path = self.inodes_.path(ino);
+    if (!path) {
+        return -ESTALE;
+    }
+
+    FES_LOG(kTrace) << "[ll_opendir] " << *path;
+
+    try {
+        auto* directory = new DirectoryHandle{*path, self.state_.storage_interface->listDir(*path)};
+        fi->fh = reinterpret_cast<uint64_t>(directory);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_opendir] Error: " << e.what();
+        return -EIO;
+    }
+
+    fuse_reply_open(req, fi);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_readdir(fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset,
+                                            fuse_file_info* fi) {
+    return fromRequest(req).readDirectory(req, ino, size, offset, fi, false);
+}
+
+int fes::FuseLowlevelFilesystem::ll_readdirplus(fuse_req_t req, const fuse_ino_t ino, const size_t size,
+                                                const off_t offset, fuse_file_info* fi) {
+    return fromRequest(req).readDirectory(req, ino, size, offset, fi, true);
+}
+
+int fes::FuseLowlevelFilesystem::ll_releasedir(fuse_req_t req, [[maybe_unused]] const fuse_ino_t ino, fuse_file_info* fi) {
+    delete reinterpret_cast<DirectoryHandle*>(fi->fh);
+    fi->fh = 0;
+
+    fuse_reply_err(req, 0);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_fsyncdir(fuse_req_t req, [[maybe_unused]] const fuse_ino_t ino,
+                                             [[maybe_unused]] const int datasync, [[maybe_unused]] fuse_file_info* fi) {
+    if (const int result = fromRequest(req).state_.storage_interface->syncMetadata()) {
+        return result;
+    }
+
+    fuse_reply_err(req, 0);
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::ll_create(fuse_req_t req, const fuse_ino_t parent, const char* name, const mode_t mode,
+                                           fuse_file_info* fi) {
+    auto& self = fromRequest(req);
+
+    const auto parent_path = self.inodes_.path(parent);
+    if (!parent_path) {
+        return -ESTALE;
+    }
+
+    const std::string path = InodeTable::childPath(*parent_path, name);
+    FES_LOG(kTrace) << "[ll_create] " << path;
+
+    FileHandle* handle;
+
+    try {
+        if (const int result = self.state_.storage_interface->createFile(path, mode)) {
+            return result;
+        }
+
+        // A new file is empty, so there is nothing to download before writing
+        handle = new FileHandle();
+        handle->markLoaded(false);
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[ll_create] Error: " << e.what();
+        return -EIO;
+    }
+
+    struct stat st = {};
+    if (const int error = self.statPath(path, st)) {
+        delete handle;
+        return error;
+    }
+
+    fi->fh = reinterpret_cast<uint64_t>(handle);
+
+    const fuse_entry_param entry = self.makeEntry(path, st);
+    fuse_reply_create(req, &entry, fi);
+
+    return 0;
+}
+
+int fes::FuseLowlevelFilesystem::statPath(const std::string& path, struct stat& st) const {
+    st = {};
+
+    if (path == "/") {
+        st.st_mode = S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR | S_IXGRP | S_IRGRP | S_IROTH | S_IXOTH;
+        st.st_nlink = 2;
+        st.st_ino = FUSE_ROOT_ID;
+
+        return 0;
+    }
+
+    if (path == FuseFilesystem::kStatsPath) {
+        st.st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+        st.st_nlink = 1;
+        st.st_size = static_cast<off_t>(FuseFilesystem::renderStats(&state_).size());
+
+        return 0;
+    }
+
+    try {
+        std::filesystem::path storage_path = path;
+        st = state_.storage_interface->getAttr(storage_path);
+
+        return 0;
+    } catch ([[maybe_unused]] const std::exception& e) {
+        return -ENOENT;
+    }
+}
+
+fuse_entry_param fes::FuseLowlevelFilesystem::makeEntry(const std::string& path, const struct stat& st) {
+    fuse_entry_param entry = {};
+
+    entry.ino = inodes_.lookup(path, st);
+    entry.attr = st;
+    entry.attr.st_ino = entry.ino;
+    entry.attr_timeout = attrTimeout(path);
+    entry.entry_timeout = options_.entry_timeout;
+
+    return entry;
+}
+
+double fes::FuseLowlevelFilesystem::attrTimeout(const std::string_view path) const {
+    return path == FuseFilesystem::kStatsPath ? 0 : options_.attr_timeout;
+}
+
+int fes::FuseLowlevelFilesystem::readDirectory(fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset,
+                                               fuse_file_info* fi, const bool plus) {
+    const auto* directory = reinterpret_cast<DirectoryHandle*>(fi->fh);
+    if (!directory) {
+        return -EBADF;
+    }
+
+    FES_LOG(kTrace) << "[ll_readdir] " << directory->path << " from " << offset;
+
+    std::vector<char> buf(size);
+    size_t used = 0;
+
+    // Offsets 0 and 1 are . and .., the listing follows
+    for (auto index = static_cast<size_t>(offset); index < directory->entries.size() + 2; ++index) {
+        const char* name;
+        std::string child_name;
+        std::string child_path;
+        struct stat st = {};
+
+        if (index < 2) {
+            name = index == 0 ? "." : "..";
+            st.st_mode = S_IFDIR;
+            st.st_ino = index == 0 ? ino : kUnknownIno;
+        } else {
+            const auto& child = directory->entries[index - 2];
+
+            child_name = std::filesystem::path(child.path).filename().string();
+            child_path = InodeTable::childPath(directory->path, child_name);
+            name = child_name.c_str();
+
+            st.st_mode = child.is_dir ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+            st.st_nlink = child.is_dir ? 2 : 1;
+            st.st_size = static_cast<off_t>(child.size);
+            st.st_ctime = child.ctime;
+            st.st_mtime = child.mtime;
+            st.st_ino = inodes_.find(child_path).value_or(kUnknownIno);
+        }
+
+        const size_t remaining = size - used;
+        const auto next_offset = static_cast<off_t>(index + 1);
+        size_t entry_size;
+
+        if (!plus) {
+            entry_size = fuse_add_direntry(req, buf.data() + used, remaining, name, &st, next_offset);
+        } else if (index < 2) {
+            // No inode for the kernel to remember, ino 0 keeps them out of the dcache
+            fuse_entry_param entry = {};
+            entry.attr = st;
+            entry_size = fuse_add_direntry_plus(req, buf.data() + used, remaining, name, &entry, next_offset);
+        } else {
+            // The kernel only takes the reference if the entry fits
+            const fuse_entry_param entry = makeEntry(child_path, st);
+            entry_size = fuse_add_direntry_plus(req, buf.data() + used, remaining, name, &entry, next_offset);
+
+            if (entry_size > remaining) {
+                inodes_.forget(entry.ino, 1);
+            }
+        }
+
+        if (entry_size > remaining) {
+            break;
+        }
+        used += entry_size;
+    }
+
+    fuse_reply_buf(req, buf.data(), used);
+    return 0;
+}
+
+void fes::FuseLowlevelFilesystem::onRemoteChange() {
+    {
+        std::lock_guard lock(notify_mutex_);
+        remote_changed_ = true;
+    }
+    notify_cv_.notify_one();
+}
+
+void fes::FuseLowlevelFilesystem::notifierLoop(const std::stop_token& stop_token) {
+    while (true) {
+        {
+            std::unique_lock lock(notify_mutex_);
+            if (!notify_cv_.wait(lock, stop_token, [this] { return remote_changed_; })) {
+                return;
+            }
+            remote_changed_ = false;
+        }
+
+        revalidate();
+    }
+}
+
+void fes::FuseLowlevelFilesystem::revalidate() {
+    TraceSpan span("fuse", "revalidate");
+
+    size_t entries_dropped = 0;
+    size_t inodes_dropped = 0;
+
+    for (const auto& inode : inodes_.linked()) {
+        if (inode.path == FuseFilesystem::kStatsPath) {
+            continue;
+        }
+
+        struct stat st = {};
+        const bool exists = statPath(inode.path, st) == 0;
+
+        // Gone or replaced by something of another type: the name has to be looked up again
+        if (!exists || (st.st_mode & S_IFMT) != (inode.attributes.mode & S_IFMT)) {
+            const std::string name = inode.path.substr(inode.path.rfind('/') + 1);
+
+            if (const auto parent = inodes_.find(parentOf(inode.path))) {
+                fuse_lowlevel_notify_inval_entry(session_, *parent, name.c_str(), name.size());
+            }
+
+            inodes_.unlink(inode.path);
+            ++entries_dropped;
+            continue;
+        }
+
+        // Changed content: cached attributes and pages are stale
+        if (InodeTable::attributesOf(st) != inode.attributes) {
+            fuse_lowlevel_notify_inval_inode(session_, inode.ino, 0, 0);
+            inodes_.remember(inode.ino, st);
+            ++inodes_dropped;
+        }
+    }
+
+    FES_LOG(kDebug) << "[FuseLowlevelFilesystem] Remote metadata changed, invalidated " << entries_dropped
+                    << " entries and " << inodes_dropped << " inodes";
+}
@@ -0,0 +1,157 @@
+#ifndef FUSE_LOWLEVEL_FILESYSTEM_HPP
+#define FUSE_LOWLEVEL_FILESYSTEM_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse_lowlevel.h>
+
+#include "lib/fuse-filesystem/fuse-filesystem.hpp"
+#include "lib/fuse-filesystem/inode-table.hpp"
+
+namespace fuse_external_storage {
+
+struct LowlevelOptions {
+    // Seconds the kernel may answer lookups and stats from its own caches.
+    // Changes committed by other mounts invalidate them early
+    double entry_timeout = 1.0;
+    double attr_timeout = 1.0;
+};
+
+// Stats of the frontend serving the request
+OperationStats& requestStats(fuse_req_t req);
+
+// Low-level request handler recorded under Name and traced with the inode it
+// is about. Handlers reply themselves and return 0, or the bytes read or
+// written; a negative errno is replied here
+template <OperationName Name, auto Callback>
+struct MeasuredRequest;
+
+template <OperationName Name, typename... Args, int (*Callback)(fuse_req_t, Args...)>
+struct MeasuredRequest<Name, Callback> {
+    static void call(fuse_req_t req, Args... args) {
+        TraceSpan span("fuse", Name.value, static_cast<int64_t>(std::get<0>(std::forward_as_tuple(args...))));
+
+        auto& operation = requestStats(req).operation(Name.value);
+        OperationStats::Timer timer(operation);
+
+        const int result = Callback(req, args...);
+        if (result < 0) {
+            fuse_reply_err(req, -result);
+            return;
+        }
+        timer.succeed();
+
+        if (result > 0 && std::string_view(Name.value) == "read") {
+            operation.bytes_read.fetch_add(result, std::memory_order_relaxed);
+        } else if (result > 0 && std::string_view(Name.value) == "write") {
+            operation.bytes_written.fetch_add(result, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Frontend on the inode-based fuse_lowlevel API. Unlike FuseFilesystem it
+// hands the kernel stable inode numbers with entry and attribute timeouts,
+// so repeated lookups and stats of hot paths never leave the kernel
+class FuseLowlevelFilesystem {
+public:
+    FuseLowlevelFilesystem(FuseState& state, LowlevelOptions options);
+
+    FuseLowlevelFilesystem(const FuseLowlevelFilesystem&) = delete;
+    FuseLowlevelFilesystem& operator=(const FuseLowlevelFilesystem&) = delete;
+
+    // Mounts with the libfuse command line and serves requests until
+    // unmounted, returns the exit code like fuse_main
+    int run(int argc, char** argv);
+
+    [[nodiscard]] static FuseLowlevelFilesystem& fromRequest(fuse_req_t req) {
+        return *static_cast<FuseLowlevelFilesystem*>(fuse_req_userdata(req));
+    }
+
+    [[nodiscard]] FuseState& state() { return state_; }
+
+    static void ll_init(void*, fuse_conn_info*);
+    static int ll_lookup(fuse_req_t, fuse_ino_t, const char*);
+    static int ll_forget(fuse_req_t, fuse_ino_t, uint64_t);
+    static int ll_forget_multi(fuse_req_t, size_t, fuse_forget_data*);
+    static int ll_getattr(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_setattr(fuse_req_t, fuse_ino_t, struct stat*, int, fuse_file_info*);
+    static int ll_mkdir(fuse_req_t, fuse_ino_t, const char*, mode_t);
+    static int ll_unlink(fuse_req_t, fuse_ino_t, const char*);
+    static int ll_rmdir(fuse_req_t, fuse_ino_t, const char*);
+    static int ll_rename(fuse_req_t, fuse_ino_t, const char*, fuse_ino_t, const char*, unsigned int);
+    static int ll_open(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_read(fuse_req_t, fuse_ino_t, size_t, off_t, fuse_file_info*);
+    static int ll_write(fuse_req_t, fuse_ino_t, const char*, size_t, off_t, fuse_file_info*);
+    static int ll_flush(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_release(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_fsync(fuse_req_t, fuse_ino_t, int, fuse_file_info*);
+    static int ll_opendir(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_readdir(fuse_req_t, fuse_ino_t, size_t, off_t, fuse_file_info*);
+    static int ll_readdirplus(fuse_req_t, fuse_ino_t, size_t, off_t, fuse_file_info*);
+    static int ll_releasedir(fuse_req_t, fuse_ino_t, fuse_file_info*);
+    static int ll_fsyncdir(fuse_req_t, fuse_ino_t, int, fuse_file_info*);
+    static int ll_create(fuse_req_t, fuse_ino_t, const char*, mode_t, fuse_file_info*);
+
+private:
+    // Attributes of a path as the high-level getattr reports them, or -ENOENT
+    int statPath(const std::string& path, struct stat& st) const;
+
+    // Looks the path up and fills the reply, taking one kernel reference
+    fuse_entry_param makeEntry(const std::string& path, const struct stat& st);
+
+    [[nodiscard]] double attrTimeout(std::string_view path) const;
+
+    int readDirectory(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info* fi, bool plus);
+
+    // Storages call this from inside requests, so the invalidation itself
+    // runs on the notifier thread where it can't deadlock with the kernel
+    void onRemoteChange();
+    void notifierLoop(const std::stop_token& stop_token);
+    void revalidate();
+
+    FuseState& state_;
+    LowlevelOptions options_;
+    InodeTable inodes_;
+    fuse_session* session_ = nullptr;
+
+    std::mutex notify_mutex_;
+    std::condition_variable_any notify_cv_;
+    bool remote_changed_ = false;
+    std::jthread notifier_;
+
+    static constexpr fuse_lowlevel_ops operations_ = {
+        .init           = ll_init,
+        .lookup         = MeasuredRequest<"lookup", ll_lookup>::call,
+        .forget         = MeasuredRequest<"forget", ll_forget>::call,
+        .getattr        = MeasuredRequest<"getattr", ll_getattr>::call,
+        .setattr        = MeasuredRequest<"setattr", ll_setattr>::call,
+        .mkdir          = MeasuredRequest<"mkdir", ll_mkdir>::call,
+        .unlink         = MeasuredRequest<"unlink", ll_unlink>::call,
+        .rmdir          = MeasuredRequest<"rmdir", ll_rmdir>::call,
+        .rename         = MeasuredRequest<"rename", ll_rename>::call,
+        .open           = MeasuredRequest<"open", ll_open>::call,
+        .read           = MeasuredRequest<"read", ll_read>::call,
+        .write          = MeasuredRequest<"write", ll_write>::call,
+        .flush          = MeasuredRequest<"flush", ll_flush>::call,
+        .release        = MeasuredRequest<"release", ll_release>::call,
+        .fsync          = MeasuredRequest<"fsync", ll_fsync>::call,
+        .opendir        = MeasuredRequest<"opendir", ll_opendir>::call,
+        .readdir        = MeasuredRequest<"readdir", ll_readdir>::call,
+        .releasedir     = MeasuredRequest<"releasedir", ll_releasedir>::call,
+        .fsyncdir       = MeasuredRequest<"fsyncdir", ll_fsyncdir>::call,
+        .create         = MeasuredRequest<"create", ll_create>::call,
+        .forget_multi   = MeasuredRequest<"forget", ll_forget_multi>::call,
+        .readdirplus    = MeasuredRequest<"readdirplus", ll_readdirplus>::call,
+    };
+};
+
+} // fuse_external_storage
+
+#endif //FUSE_LOWLEVEL_FILESYSTEM_HPP
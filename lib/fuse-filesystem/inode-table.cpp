@@ -0,0 +1,157 @@
+#include "inode-table.hpp"
+
+#include <algorithm>
+
+namespace fes = fuse_external_storage;
+
+std::string fes::InodeTable::childPath(const std::string& parent_path, const std::string_view name) {
+    std::string path = parent_path == "/" ? std::string() : parent_path;
+    path += '/';
+    path += name;
+
+    return path;
+}
+
+fes::InodeTable::InodeTable() {
+    // The kernel gets the root without a lookup and never forgets it
+    nodes_.emplace(FUSE_ROOT_ID, Node{"/", 1, {}, true});
+    by_path_.emplace("/", FUSE_ROOT_ID);
+}
+
+std::optional<std::string> fes::InodeTable::path(const fuse_ino_t ino) const {
+    std::lock_guard lock(mutex_);
+
+    const auto it = nodes_.find(ino);
+    if (it == nodes_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second.path;
+}
+
+std::optional<fuse_ino_t> fes::InodeTable::find(const std::string& path) const {
+    std::lock_guard lock(mutex_);
+
+    const auto it = by_path_.find(path);
+    if (it == by_path_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+fuse_ino_t fes::InodeTable::lookup(const std::string& path, const struct stat& st) {
+    std::lock_guard lock(mutex_);
+
+    auto [it, inserted] = by_path_.try_emplace(path, next_ino_);
+    if (inserted) {
+        nodes_.emplace(next_ino_++, Node{path, 0, {}, true});
+    }
+
+    Node& node = nodes_.at(it->second);
+    ++node.lookups;
+    node.attributes = attributesOf(st);
+
+    return it->second;
+}
+
+bool fes::InodeTable::remember(const fuse_ino_t ino, const struct stat& st) {
+    std::lock_guard lock(mutex_);
+
+    const auto it = nodes_.find(ino);
+    if (it == nodes_.end()) {
+        return false;
+    }
+
+    const Attributes attributes = attributesOf(st);
+    const bool changed = it->second.attributes != attributes;
+    it->second.attributes = attributes;
+
+    return changed;
+}
+
+void fes::InodeTable::forget(const fuse_ino_t ino, const uint64_t nlookup) {
+    std::lock_guard lock(mutex_);
+
+    const auto it = nodes_.find(ino);
+    if (it == nodes_.end() || ino == FUSE_ROOT_ID) {
+        return;
+    }
+
+    Node& node = it->second;
+    node.lookups -= std::min(nlookup, node.lookups);
+    if (node.lookups > 0) {
+        return;
+    }
+
+    if (node.linked) {
+        by_path_.erase(node.path);
+    }
+    nodes_.erase(it);
+}
+
+void fes::InodeTable::unlink(const std::string& path) {
+    std::lock_guard lock(mutex_);
+    unlinkLocked(path);
+}
+
+void fes::InodeTable::rename(const std::string& from, const std::string& to) {
+    if (from == to) {
+        return;
+    }
+
+    std::lock_guard lock(mutex_);
+
+    // A replaced target keeps its inode until the kernel forgets it
+    unlinkLocked(to);
+
+    std::vector<std::pair<std::string, fuse_ino_t>> moved;
+
+    if (const auto it = by_path_.find(from); it != by_path_.end()) {
+        moved.emplace_back(to, it->second);
+        by_path_.erase(it);
+    }
+
+    // Everything below a directory is contiguous in the map
+    const std::string prefix = from + "/";
+    auto it = by_path_.lower_bound(prefix);
+    while (it != by_path_.end() && it->first.starts_with(prefix)) {
+        moved.emplace_back(to + it->first.substr(from.size()), it->second);
+        it = by_path_.erase(it);
+    }
+
+    for (auto& [path, ino] : moved) {
+        nodes_.at(ino).path = path;
+        by_path_.insert_or_assign(std::move(path), ino);
+    }
+}
+
+std::vector<fes::InodeTable::Inode> fes::InodeTable::linked() const {
+    std::lock_guard lock(mutex_);
+
+    std::vector<Inode> inodes;
+    inodes.reserve(by_path_.size());
+
+    for (const auto& [path, ino] : by_path_) {
+        if (ino != FUSE_ROOT_ID) {
+            inodes.push_back({ino, path, nodes_.at(ino).attributes});
+        }
+    }
+
+    return inodes;
+}
+
+size_t fes::InodeTable::size() const {
+    std::lock_guard lock(mutex_);
+    return nodes_.size();
+}
+
+void fes::InodeTable::unlinkLocked(const std::string& path) {
+    const auto it = by_path_.find(path);
+    if (it == by_path_.end() || it->second == FUSE_ROOT_ID) {
+        return;
+    }
+
+    nodes_.at(it->second).linked = false;
+    by_path_.erase(it);
+}
@@ -0,0 +1,96 @@
+#ifndef INODE_TABLE_HPP
+#define INODE_TABLE_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse_lowlevel.h>
+
+namespace fuse_external_storage {
+
+// Inode numbers of the paths the kernel holds references to. A number is
+// handed out on the first lookup of a path, stays with it across renames and
+// is dropped once the kernel forgets every lookup. Numbers are never reused,
+// so the generation is always 0
+class InodeTable {
+public:
+    // Attributes last sent to the kernel, compared against the storage when
+    // remote metadata changes
+    struct Attributes {
+        mode_t mode = 0;
+        off_t size = 0;
+        time_t mtime = 0;
+
+        bool operator==(const Attributes&) const = default;
+    };
+
+    struct Inode {
+        fuse_ino_t ino;
+        std::string path;
+        Attributes attributes;
+    };
+
+    static Attributes attributesOf(const struct stat& st) {
+        return {st.st_mode, st.st_size, st.st_mtime};
+    }
+
+    // "/" + name under the root, parent + "/" + name elsewhere
+    static std::string childPath(const std::string& parent_path, std::string_view name);
+
+    InodeTable();
+
+    // Path the inode currently has, nullopt once it is forgotten
+    [[nodiscard]] std::optional<std::string> path(fuse_ino_t ino) const;
+
+    // Inode of a linked path, without taking a reference
+    [[nodiscard]] std::optional<fuse_ino_t> find(const std::string& path) const;
+
+    // Inode of the path, created if needed, with one more kernel reference
+    fuse_ino_t lookup(const std::string& path, const struct stat& st);
+
+    // Records attributes sent to the kernel outside of a lookup, returns
+    // whether they differ from the ones sent before
+    bool remember(fuse_ino_t ino, const struct stat& st);
+
+    // Drops nlookup kernel references, the inode goes away with the last one
+    void forget(fuse_ino_t ino, uint64_t nlookup);
+
+    // Detaches the path from its inode, which lives on until it is forgotten
+    void unlink(const std::string& path);
+
+    // Moves the inode of from, and the inodes below it, to the new path
+    void rename(const std::string& from, const std::string& to);
+
+    // Linked inodes besides the root, for revalidation
+    [[nodiscard]] std::vector<Inode> linked() const;
+
+    [[nodiscard]] size_t size() const;
+
+private:
+    struct Node {
+        std::string path;
+        uint64_t lookups = 0;
+        Attributes attributes;
+        bool linked = true;
+    };
+
+    void unlinkLocked(const std::string& path);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<fuse_ino_t, Node> nodes_;
+
+    // Ordered, so everything below a renamed directory is one range
+    std::map<std::string, fuse_ino_t, std::less<>> by_path_;
+    fuse_ino_t next_ino_ = FUSE_ROOT_ID + 1;
+};
+
+} // fuse_external_storage
+
+#endif //INODE_TABLE_HPP
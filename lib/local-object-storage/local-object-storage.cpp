@@ -0,0 +1,385 @@
+#include "local-object-storage.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+#include "lib/metadata-codec/metadata-codec.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+using json = nlohmann::json;
+
+ftes::LocalObjectStorage::LocalObjectStorage(LocalStorageOptions options)
+    : options_(std::move(options)), random_(options_.seed) {
+    std::filesystem::create_directories(options_.root / "objects");
+    std::filesystem::create_directories(options_.root / "staging");
+
+    loadMetadata();
+}
+
+struct stat ftes::LocalObjectStorage::getAttr(std::filesystem::path& path) {
+    struct stat stbuf = {};
+
+    if (path == "/" || path == "." || path.empty()) {
+        stbuf.st_mode = S_IFDIR | 0755;
+        stbuf.st_nlink = 2;
+        return stbuf;
+    }
+
+    std::shared_lock lock(mutex_);
+    const auto info = index_.find(path);
+
+    if (!info) {
+        throw std::runtime_error("File not found");
+    }
+
+    stbuf.st_mode = info->is_dir ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+    stbuf.st_nlink = info->is_dir ? 2 : 1;
+    stbuf.st_size = static_cast<off_t>(info->size);
+    stbuf.st_ctime = info->ctime;
+    stbuf.st_mtime = info->mtime;
+
+    return stbuf;
+}
+
+std::vector<ftes::FileInfo> ftes::LocalObjectStorage::listDir(const std::filesystem::path& path) {
+    std::shared_lock lock(mutex_);
+    return index_.children(path);
+}
+
+int ftes::LocalObjectStorage::createFile(const std::filesystem::path& path, mode_t) {
+    std::unique_lock lock(mutex_);
+
+    // Replaces any existing file with the same path
+    const auto existing = index_.find(path);
+    if (existing && existing->is_dir) {
+        return -EISDIR;
+    }
+
+    const time_t now = time(nullptr);
+    index_.upsert({.path = MetadataIndex::normalizePath(path), .message_id = 0, .ctime = now, .mtime = now,
+                   .size = 0, .is_dir = false});
+
+    if (!writeMetadata()) {
+        return -EIO;
+    }
+
+    if (existing && existing->message_id > 0) {
+        deleteObject(existing->message_id);
+    }
+
+    return 0;
+}
+
+int ftes::LocalObjectStorage::readFile(const std::filesystem::path& path, char* buf, size_t size, off_t offset) {
+    fuse_external_storage::TraceSpan span("storage", "readFile", path.native());
+
+    std::shared_lock lock(mutex_);
+    const auto info = index_.find(path);
+
+    if (!info || info->is_dir) {
+        return -ENOENT;
+    }
+
+    if (offset >= static_cast<off_t>(info->size) || info->message_id == 0) {
+        return 0;
+    }
+
+    size = std::min(size, info->size - static_cast<size_t>(offset));
+
+    // A ranged GET of the object
+    if (!request(size)) {
+        return -EIO;
+    }
+
+    const int fd = open(objectPath(info->message_id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -EIO;
+    }
+
+    const ssize_t bytes_read = pread(fd, buf, size, offset);
+    close(fd);
+
+    return bytes_read < 0 ? -EIO : static_cast<int>(bytes_read);
+}
+
+int ftes::LocalObjectStorage::writeFile(const std::filesystem::path& path, const char* buf, size_t size, off_t offset) {
+    fuse_external_storage::TraceSpan span("storage", "writeFile", path.native());
+
+    // Objects are immutable like remote ones: fetch, patch and store a new version
+    static std::atomic<uint64_t> staging_counter{0};
+    const std::filesystem::path temp_file = options_.root / "staging" / ("write." + std::to_string(++staging_counter));
+
+    if (const int error = fetchFile(path, temp_file)) {
+        std::filesystem::remove(temp_file);
+        return error;
+    }
+
+    {
+        std::fstream fs(temp_file, std::ios::in | std::ios::out | std::ios::binary);
+        fs.seekp(0, std::ios::end);
+        const auto current_size = static_cast<off_t>(fs.tellp());
+
+        // Writing past the end leaves a zero-filled gap
+        if (offset > current_size) {
+            std::vector<char> padding(offset - current_size, 0);
+            fs.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        }
+
+        fs.seekp(offset);
+        fs.write(buf, static_cast<std::streamsize>(size));
+
+        if (!fs) {
+            std::filesystem::remove(temp_file);
+            return -EIO;
+        }
+    }
+
+    const int result = storeFile(path, temp_file, {{offset, size}});
+    std::filesystem::remove(temp_file);
+
+    return result == 0 ? static_cast<int>(size) : result;
+}
+
+int ftes::LocalObjectStorage::unlinkFile(const std::filesystem::path& path) {
+    std::unique_lock lock(mutex_);
+    const auto info = index_.find(path);
+
+    if (!info || info->is_dir) {
+        return -ENOENT;
+    }
+
+    index_.erase(path);
+
+    if (!writeMetadata()) {
+        return -EIO;
+    }
+
+    if (info->message_id > 0) {
+        deleteObject(info->message_id);
+    }
+
+    return 0;
+}
+
+int ftes::LocalObjectStorage::createDir(const std::filesystem::path& path, mode_t) {
+    std::unique_lock lock(mutex_);
+
+    if (index_.find(path)) {
+        return -EEXIST;
+    }
+
+    const time_t now = time(nullptr);
+    index_.upsert({.path = MetadataIndex::normalizePath(path), .message_id = 0, .ctime = now, .mtime = now,
+                   .size = 0, .is_dir = true});
+
+    return writeMetadata() ? 0 : -EIO;
+}
+
+int ftes::LocalObjectStorage::removeDir(const std::filesystem::path& path) {
+    std::unique_lock lock(mutex_);
+    const auto info = index_.find(path);
+
+    if (!info || !info->is_dir) {
+        return -ENOENT;
+    }
+
+    if (index_.hasChildren(path)) {
+        return -ENOTEMPTY;
+    }
+
+    index_.erase(path);
+
+    return writeMetadata() ? 0 : -EIO;
+}
+
+int ftes::LocalObjectStorage::rename(const std::filesystem::path& from, const std::filesystem::path& to) {
+    std::unique_lock lock(mutex_);
+
+    if (!index_.find(from)) {
+        return -ENOENT;
+    }
+
+    if (index_.find(to)) {
+        return -EEXIST;
+    }
+
+    index_.rename(from, to);
+
+    return writeMetadata() ? 0 : -EIO;
+}
+
+int ftes::LocalObjectStorage::fetchFile(const std::filesystem::path& path, const std::filesystem::path& local_path) {
+    fuse_external_storage::TraceSpan span("storage", "fetchFile", path.native());
+
+    std::shared_lock lock(mutex_);
+    const auto info = index_.find(path);
+
+    if (!info || info->is_dir) {
+        return -ENOENT;
+    }
+
+    // Nothing stored yet, the local copy is just an empty file
+    if (info->message_id == 0) {
+        std::ofstream ofs(local_path, std::ios::binary | std::ios::trunc);
+        return ofs ? 0 : -EIO;
+    }
+
+    if (!request(info->size)) {
+        return -EIO;
+    }
+
+    std::error_code error;
+    std::filesystem::copy_file(objectPath(info->message_id), local_path,
+                               std::filesystem::copy_options::overwrite_existing, error);
+
+    return error ? -EIO : 0;
+}
+
+int ftes::LocalObjectStorage::storeFile(const std::filesystem::path& path, const std::filesystem::path& local_path,
+                                        const std::vector<fuse_external_storage::ByteRange>&) {
+    fuse_external_storage::TraceSpan span("storage", "storeFile", path.native());
+
+    // Uploaded before taking the lock, like a remote PUT
+    const int64_t object_id = putObject(local_path);
+    if (object_id == 0) {
+        return -EIO;
+    }
+
+    std::unique_lock lock(mutex_);
+    auto info = index_.find(path);
+
+    if (!info || info->is_dir) {
+        deleteObject(object_id);
+        return -ENOENT;
+    }
+
+    const int64_t previous = info->message_id;
+
+    info->message_id = object_id;
+    info->size = std::filesystem::file_size(objectPath(object_id));
+    info->mtime = time(nullptr);
+    index_.upsert(std::move(*info));
+
+    if (!writeMetadata()) {
+        deleteObject(object_id);
+        return -EIO;
+    }
+
+    if (previous > 0) {
+        deleteObject(previous);
+    }
+
+    return 0;
+}
+
+int ftes::LocalObjectStorage::syncMetadata() {
+    // Every mutation is written through before it returns
+    return 0;
+}
+
+bool ftes::LocalObjectStorage::request(const uint64_t bytes) {
+    fuse_external_storage::TraceSpan span("api", "emulatedRequest");
+
+    auto delay = options_.latency;
+    if (options_.bandwidth_bytes_per_second > 0) {
+        delay += std::chrono::microseconds(bytes * 1'000'000 / options_.bandwidth_bytes_per_second);
+    }
+
+    if (delay.count() > 0) {
+        std::this_thread::sleep_for(delay);
+    }
+
+    if (options_.error_rate <= 0) {
+        return true;
+    }
+
+    std::lock_guard lock(random_mutex_);
+    return std::uniform_real_distribution<double>(0, 1)(random_) >= options_.error_rate;
+}
+
+std::filesystem::path ftes::LocalObjectStorage::objectPath(const int64_t object_id) const {
+    return options_.root / "objects" / std::to_string(object_id);
+}
+
+std::filesystem::path ftes::LocalObjectStorage::metadataPath() const {
+    return options_.root / "metadata.fesm";
+}
+
+void ftes::LocalObjectStorage::loadMetadata() {
+    std::ifstream ifs(metadataPath(), std::ios::binary);
+    if (!ifs) {
+        index_.load(json{{"files", json::array()}});
+        return;
+    }
+
+    const std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    const json metadata = MetadataCodec::decode(data);
+    index_.load(metadata);
+
+    // Object IDs are never reused
+    for (const auto& entry : metadata.value("files", json::array())) {
+        next_object_id_ = std::max(next_object_id_, entry.value("message_id", int64_t{0}) + 1);
+    }
+
+    FES_LOG(kInfo) << "[LocalObjectStorage] Loaded " << index_.size() << " entries from " << options_.root;
+}
+
+bool ftes::LocalObjectStorage::writeMetadata() {
+    index_.bumpVersion();
+    const std::string encoded = MetadataCodec::encode(index_.toJson());
+
+    const std::filesystem::path temp_file = options_.root / "staging" / "metadata.fesm";
+
+    bool written = request(encoded.size());
+    if (written) {
+        std::ofstream ofs(temp_file, std::ios::binary | std::ios::trunc);
+        ofs.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+        ofs.close();
+
+        std::error_code error;
+        written = ofs && (std::filesystem::rename(temp_file, metadataPath(), error), !error);
+    }
+
+    // The in-memory change is rolled back to what is stored
+    if (!written) {
+        FES_LOG(kError) << "[LocalObjectStorage] Failed to write metadata";
+        loadMetadata();
+    }
+
+    return written;
+}
+
+int64_t ftes::LocalObjectStorage::putObject(const std::filesystem::path& local_path) {
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(local_path, error);
+
+    if (error || !request(size)) {
+        return 0;
+    }
+
+    int64_t object_id;
+    {
+        std::unique_lock lock(mutex_);
+        object_id = next_object_id_++;
+    }
+
+    std::filesystem::copy_file(local_path, objectPath(object_id), std::filesystem::copy_options::overwrite_existing, error);
+    return error ? 0 : object_id;
+}
+
+void ftes::LocalObjectStorage::deleteObject(const int64_t object_id) {
+    // Deletes are fire and forget, a failed one only leaks the object
+    if (request(0)) {
+        std::filesystem::remove(objectPath(object_id));
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef LOCAL_OBJECT_STORAGE_HPP
+#define LOCAL_OBJECT_STORAGE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <vector>
+
+#include "lib/metadata-index/metadata-index.hpp"
+#include "lib/external-storage-interface.hpp"
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse.h>
+
+namespace fuse_telegram_external_storage {
+
+    struct LocalStorageOptions {
+        // Objects live in root/objects, the metadata in root/metadata.fesm
+        std::filesystem::path root;
+
+        // Emulated remote: every object or metadata request waits latency plus
+        // its size over the bandwidth (0 is unlimited) and fails with error_rate
+        std::chrono::microseconds latency{0};
+        uint64_t bandwidth_bytes_per_second = 0;
+        double error_rate = 0;
+
+        // Failures are drawn from a seeded generator so runs can be repeated
+        uint64_t seed = 1;
+    };
+
+    // Stores every file as one object in a local directory. It stands in for
+    // the Telegram backend, so the FUSE layer can be exercised and benchmarked
+    // offline, with the remote's latency and failures emulated reproducibly
+    class LocalObjectStorage final : public fuse_external_storage::ExternalStorageInterface {
+    public:
+        explicit LocalObjectStorage(LocalStorageOptions options);
+
+        struct stat getAttr(std::filesystem::path& path) override;
+        std::vector<FileInfo> listDir(const std::filesystem::path& path) override;
+        int createFile(const std::filesystem::path& path, mode_t mode) override;
+        int readFile(const std::filesystem::path& path, char* buf, size_t size, off_t offset) override;
+        int writeFile(const std::filesystem::path& path, const char* buf, size_t size, off_t offset) override;
+        int unlinkFile(const std::filesystem::path& path) override;
+        int createDir(const std::filesystem::path& path, mode_t mode) override;
+        int removeDir(const std::filesystem::path& path) override;
+        int rename(const std::filesystem::path& from, const std::filesystem::path& to) override;
+        int fetchFile(const std::filesystem::path& path, const std::filesystem::path& local_path) override;
+        int storeFile(const std::filesystem::path& path, const std::filesystem::path& local_path,
+                      const std::vector<fuse_external_storage::ByteRange>& dirty_ranges) override;
+        int syncMetadata() override;
+
+    private:
+        LocalStorageOptions options_;
+
+        // Mutations hold it exclusively, every change is written through before they return
+        MetadataIndex index_;
+        mutable std::shared_mutex mutex_;
+        int64_t next_object_id_ = 1;
+
+        std::mt19937_64 random_;
+        std::mutex random_mutex_;
+
+        // Pay for one emulated request moving this many bytes, false if it failed
+        bool request(uint64_t bytes);
+
+        std::filesystem::path objectPath(int64_t object_id) const;
+        std::filesystem::path metadataPath() const;
+
+        void loadMetadata();
+        bool writeMetadata();
+
+        // Copy a local file into a new object, 0 if the request failed
+        int64_t putObject(const std::filesystem::path& local_path);
+        void deleteObject(int64_t object_id);
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //LOCAL_OBJECT_STORAGE_HPP
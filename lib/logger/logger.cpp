@@ -0,0 +1,345 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fes = fuse_external_storage;
+
+namespace {
+
+    constexpr size_t kRingSlots = 1024;
+    constexpr size_t kSlotTextBytes = 480;
+
+    // How long the writer sleeps between drains when nobody asks for a flush
+    constexpr std::chrono::milliseconds kDrainInterval{5};
+
+    // How long warnings and errors wait for room in a full ring before they
+    // are dropped, and how long a flush waits for the writer
+    constexpr std::chrono::milliseconds kFullRingWait{50};
+    constexpr std::chrono::seconds kFlushTimeout{1};
+
+    struct Slot {
+        int64_t time_ns;
+        fes::LogLevel level;
+        uint16_t length;
+        char text[kSlotTextBytes];
+    };
+
+    // Single producer (the owning thread), single consumer (the writer)
+    struct Ring {
+        std::array<Slot, kRingSlots> slots;
+        alignas(64) std::atomic<uint64_t> head = 0; // next slot the producer fills
+        alignas(64) std::atomic<uint64_t> tail = 0; // next slot the consumer reads
+        std::atomic<bool> closed = false;           // the owning thread exited
+    };
+
+    class Writer {
+    public:
+        static Writer& instance() {
+            Writer* writer = current_.load(std::memory_order_acquire);
+            return writer != nullptr ? *writer : create();
+        }
+
+        Ring& ring() {
+            thread_local RingOwner owner(*this);
+            return *owner.ring;
+        }
+
+        void flush() {
+            std::unique_lock lock(mutex_);
+            const uint64_t wanted = ++flush_requested_;
+
+            wake_.notify_one();
+            flushed_.wait_for(lock, kFlushTimeout, [this, wanted] { return flush_done_ >= wanted; });
+        }
+
+        // Asks the writer for a drain before its interval is up, without taking its lock
+        void wake() {
+            wake_requested_.store(true, std::memory_order_relaxed);
+            wake_.notify_one();
+        }
+
+        std::atomic<uint64_t> dropped = 0;
+        std::atomic<uint64_t> dropped_total = 0;
+
+    private:
+        // Hands the ring to the writer for good when the thread exits, so
+        // its last lines still get written
+        struct RingOwner {
+            explicit RingOwner(Writer& writer) : ring(std::make_shared<Ring>()) {
+                std::lock_guard lock(writer.mutex_);
+                writer.rings_.push_back(ring);
+            }
+
+            ~RingOwner() { ring->closed = true; }
+
+            std::shared_ptr<Ring> ring;
+        };
+
+        struct Line {
+            int64_t time_ns;
+            fes::LogLevel level;
+            std::string text;
+        };
+
+        // Never destroyed, threads may still log while statics are torn down.
+        // The writer thread doesn't survive a fork, so a forked child (the
+        // daemon) gets a new writer on its first line, which takes over the
+        // rings and counters of the one left behind
+        static Writer& create() {
+            std::lock_guard lock(create_mutex_);
+
+            if (Writer* writer = current_.load(std::memory_order_relaxed)) {
+                return *writer;
+            }
+
+            if (orphan_ == nullptr) {
+                std::atexit([] { instance().flush(); });
+                pthread_atfork(beforeFork, afterForkInParent, afterForkInChild);
+            }
+
+            Writer* writer = new Writer(orphan_);
+            current_.store(writer, std::memory_order_release);
+            return *writer;
+        }
+
+        // Lines queued so far are written by the parent only, and nobody may
+        // hold the locks across the fork, the child couldn't release them
+        static void beforeFork() {
+            create_mutex_.lock();
+            if (Writer* writer = current_.load(std::memory_order_relaxed)) {
+                writer->flush();
+                writer->mutex_.lock();
+            }
+        }
+
+        static void afterForkInParent() {
+            if (Writer* writer = current_.load(std::memory_order_relaxed)) {
+                writer->mutex_.unlock();
+            }
+            create_mutex_.unlock();
+        }
+
+        static void afterForkInChild() {
+            if (Writer* writer = current_.load(std::memory_order_relaxed)) {
+                writer->mutex_.unlock();
+                orphan_ = writer;
+                current_.store(nullptr, std::memory_order_release);
+            }
+            create_mutex_.unlock();
+        }
+
+        explicit Writer(Writer* previous) {
+            if (previous != nullptr) {
+                std::lock_guard lock(previous->mutex_);
+                rings_ = previous->rings_;
+                dropped = previous->dropped.load();
+                dropped_total = previous->dropped_total.load();
+            }
+
+            thread_ = std::thread([this] { run(); });
+            thread_.detach();
+        }
+
+        void run() {
+            std::vector<Line> lines;
+            std::string out;
+
+            for (;;) {
+                uint64_t flush_target;
+                std::vector<std::shared_ptr<Ring>> rings;
+
+                {
+                    std::unique_lock lock(mutex_);
+                    wake_.wait_for(lock, kDrainInterval, [this] {
+                        return flush_requested_ > flush_done_ || wake_requested_.exchange(false, std::memory_order_relaxed);
+                    });
+
+                    flush_target = flush_requested_;
+
+                    // Rings of exited threads are dropped once they are empty
+                    std::erase_if(rings_, [](const std::shared_ptr<Ring>& ring) {
+                        return ring->closed && ring->tail == ring->head;
+                    });
+                    rings = rings_;
+                }
+
+                for (const auto& ring : rings) {
+                    const uint64_t head = ring->head.load(std::memory_order_acquire);
+                    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+                    for (; tail != head; ++tail) {
+                        const Slot& slot = ring->slots[tail % kRingSlots];
+                        lines.push_back({slot.time_ns, slot.level, std::string(slot.text, slot.length)});
+                    }
+
+                    ring->tail.store(tail, std::memory_order_release);
+                }
+
+                // Rings are drained one after another, the timestamps restore the order
+                std::ranges::stable_sort(lines, {}, &Line::time_ns);
+
+                for (const Line& line : lines) {
+                    format(out, line);
+                }
+
+                if (const uint64_t lost = dropped.exchange(0); lost > 0) {
+                    out += "[Logger] " + std::to_string(lost) + " lines dropped, a ring buffer was full\n";
+                }
+
+                if (!out.empty()) {
+                    std::fwrite(out.data(), 1, out.size(), stderr);
+                    std::fflush(stderr);
+                }
+
+                lines.clear();
+                out.clear();
+
+                if (flush_target > 0) {
+                    std::lock_guard lock(mutex_);
+                    flush_done_ = std::max(flush_done_, flush_target);
+                    flushed_.notify_all();
+                }
+            }
+        }
+
+        static void format(std::string& out, const Line& line) {
+            static constexpr std::array<char, 6> kLevelLetters = {'T', 'D', 'I', 'W', 'E', '-'};
+
+            const time_t seconds = line.time_ns / 1'000'000'000;
+            tm local = {};
+            localtime_r(&seconds, &local);
+
+            char prefix[32];
+            const int length = std::snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06d %c ",
+                                             local.tm_hour, local.tm_min, local.tm_sec,
+                                             static_cast<int>(line.time_ns / 1000 % 1'000'000),
+                                             kLevelLetters[static_cast<size_t>(line.level)]);
+
+            out.append(prefix, static_cast<size_t>(length));
+            out += line.text;
+            out += '\n';
+        }
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable flushed_;
+        uint64_t flush_requested_ = 0;
+        uint64_t flush_done_ = 0;
+        std::atomic<bool> wake_requested_ = false;
+        std::vector<std::shared_ptr<Ring>> rings_;
+        std::thread thread_;
+
+        inline static std::atomic<Writer*> current_ = nullptr;
+        inline static std::mutex create_mutex_;
+        inline static Writer* orphan_ = nullptr; // the writer before the last fork
+    };
+
+    // Reused by every statement of the thread, so formatting doesn't allocate once warm
+    std::ostringstream& threadStream() {
+        thread_local std::ostringstream stream;
+        return stream;
+    }
+
+} // namespace
+
+std::optional<fes::LogLevel> fes::parseLogLevel(const std::string_view name) {
+    static constexpr std::array<std::pair<std::string_view, LogLevel>, 6> kNames = {{
+        {"trace", LogLevel::kTrace},
+        {"debug", LogLevel::kDebug},
+        {"info", LogLevel::kInfo},
+        {"warning", LogLevel::kWarning},
+        {"error", LogLevel::kError},
+        {"off", LogLevel::kOff},
+    }};
+
+    const auto it = std::ranges::find(kNames, name, &std::pair<std::string_view, LogLevel>::first);
+    if (it == kNames.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+void fes::Logger::setLevel(const LogLevel level) {
+    runtime_level_.store(level, std::memory_order_relaxed);
+}
+
+fes::LogLevel fes::Logger::level() {
+    return runtime_level_.load(std::memory_order_relaxed);
+}
+
+void fes::Logger::flush() {
+    Writer::instance().flush();
+}
+
+uint64_t fes::Logger::dropped() {
+    return Writer::instance().dropped_total.load(std::memory_order_relaxed);
+}
+
+void fes::Logger::push(const LogLevel level, const std::string_view text) {
+    Writer& writer = Writer::instance();
+    Ring& ring = writer.ring();
+
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    // Chatty levels give way when the ring is full, warnings and errors wait
+    // for room a while and are dropped too if the writer doesn't catch up
+    std::optional<std::chrono::steady_clock::time_point> give_up;
+
+    while (head - ring.tail.load(std::memory_order_acquire) == kRingSlots) {
+        const auto now = std::chrono::steady_clock::now();
+        if (level >= LogLevel::kWarning && !give_up) {
+            give_up = now + kFullRingWait;
+        }
+
+        if (level < LogLevel::kWarning || now >= *give_up) {
+            writer.dropped.fetch_add(1, std::memory_order_relaxed);
+            writer.dropped_total.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        writer.wake();
+        std::this_thread::yield();
+    }
+
+    Slot& slot = ring.slots[head % kRingSlots];
+    slot.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    slot.level = level;
+
+    // Longer lines are cut, the slots have a fixed size
+    slot.length = static_cast<uint16_t>(std::min(text.size(), kSlotTextBytes));
+    std::memcpy(slot.text, text.data(), slot.length);
+
+    ring.head.store(head + 1, std::memory_order_release);
+
+    if (head - ring.tail.load(std::memory_order_relaxed) + 1 == kRingSlots / 2) {
+        writer.wake();
+    }
+}
+
+fes::LogLine::LogLine(const LogLevel level) : level_(level) {
+    threadStream().str({});
+}
+
+fes::LogLine::~LogLine() {
+    Logger::push(level_, threadStream().view());
+}
+
+std::ostream& fes::LogLine::stream() {
+    return threadStream();
+}
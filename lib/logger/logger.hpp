@@ -0,0 +1,88 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+
+// Statements below this level are compiled out, whatever the runtime level
+#ifndef FES_LOG_MIN_LEVEL
+#define FES_LOG_MIN_LEVEL 0
+#endif
+
+namespace fuse_external_storage {
+
+    enum class LogLevel : uint8_t {
+        kTrace = 0, // every callback and lookup
+        kDebug,     // per-request details
+        kInfo,      // mount lifecycle and stats
+        kWarning,   // recoverable failures
+        kError,
+        kOff,
+    };
+
+    // "trace", "debug", "info", "warning", "error" or "off"
+    std::optional<LogLevel> parseLogLevel(std::string_view name);
+
+    // Log lines are formatted by the thread that logs them and queued in a
+    // ring buffer of that thread, without locks. A background thread drains
+    // every ring, orders the lines by time and writes them to stderr in batches
+    class Logger {
+    public:
+        static void setLevel(LogLevel level);
+        [[nodiscard]] static LogLevel level();
+
+        [[nodiscard]] static bool enabled(const LogLevel level) {
+            return static_cast<int>(level) >= FES_LOG_MIN_LEVEL && level >= runtime_level_.load(std::memory_order_relaxed);
+        }
+
+        // Blocks until every line queued before the call has been written, or
+        // a second has passed
+        static void flush();
+
+        // Lines lost because a thread's ring was full, warnings and errors
+        // included once they waited too long for room
+        [[nodiscard]] static uint64_t dropped();
+
+    private:
+        friend class LogLine;
+
+        static void push(LogLevel level, std::string_view text);
+
+        // Written rarely and read on every statement, relaxed loads are enough
+        inline static std::atomic<LogLevel> runtime_level_ = LogLevel::kInfo;
+    };
+
+    // One statement, queued when it goes out of scope
+    class LogLine {
+    public:
+        explicit LogLine(LogLevel level);
+        ~LogLine();
+
+        LogLine(const LogLine&) = delete;
+        LogLine& operator=(const LogLine&) = delete;
+
+        std::ostream& stream();
+
+    private:
+        LogLevel level_;
+    };
+
+    // Turns the stream expression of FES_LOG into void, so it fits the conditional operator
+    struct LogVoidify {
+        void operator&(const std::ostream&) const {}
+    };
+
+} // namespace fuse_external_storage
+
+// FES_LOG(kDebug) << "[func] " << value; nothing after the << is evaluated
+// when the level is disabled
+#define FES_LOG(level)                                                                      \
+    !::fuse_external_storage::Logger::enabled(::fuse_external_storage::LogLevel::level)     \
+        ? (void)0                                                                           \
+        : ::fuse_external_storage::LogVoidify() &                                           \
+          ::fuse_external_storage::LogLine(::fuse_external_storage::LogLevel::level).stream()
+
+#endif // LOGGER_HPP
@@ -0,0 +1,375 @@
+#include "metadata-codec.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <zstd.h>
+
+#include "lib/content-hash/content-hash.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+using json = nlohmann::json;
+
+namespace {
+
+// Far beyond any real index, a header claiming more is corrupt
+constexpr uint64_t kMaxBodyBytes = 1ULL << 30;
+
+enum class Compression : uint8_t {
+    kNone = 0,
+    kZstd = 1,
+};
+
+enum EntryFlags : uint8_t {
+    kIsDir = 1 << 0,
+    kChunked = 1 << 1,
+    kRemoteFiles = 1 << 2, // Bot API file IDs follow the object IDs, format version 2
+    kChunkHashes = 1 << 3, // Raw SHA-256 digests of the chunks follow, format version 3
+    kCompression = 1 << 4, // Every chunk file carries its compression, format version 4
+};
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void putString(std::string& out, const std::string_view value) {
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+// Signed values (timestamps, deltas) are zigzag-encoded so small negatives stay short
+void putSigned(std::string& out, const int64_t value) {
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+class Reader {
+public:
+    explicit Reader(const std::string_view data) : data_(data) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            const auto byte = static_cast<uint8_t>(take(1).front());
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+
+        throw std::runtime_error("Malformed varint in metadata");
+    }
+
+    int64_t signedVarint() {
+        const uint64_t value = varint();
+        return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    std::string_view take(const size_t size) {
+        if (size > data_.size() - position_) {
+            throw std::runtime_error("Truncated metadata");
+        }
+
+        const auto result = data_.substr(position_, size);
+        position_ += size;
+        return result;
+    }
+
+    std::string string() {
+        return std::string(take(varint()));
+    }
+
+    [[nodiscard]] std::string_view rest() const {
+        return data_.substr(position_);
+    }
+
+private:
+    std::string_view data_;
+    size_t position_ = 0;
+};
+
+std::string encodeBody(const json& metadata) {
+    std::string body;
+
+    // Path looked up once per entry, the sort compares these
+    std::vector<std::pair<std::string_view, const json*>> entries;
+
+    if (metadata.contains("files") && metadata["files"].is_array()) {
+        const json& files = metadata["files"];
+        entries.reserve(files.size());
+
+        for (const auto& file_entry : files) {
+            const auto path = file_entry.find("path");
+
+            if (path != file_entry.end() && path->is_string()) {
+                entries.emplace_back(path->get_ref<const std::string&>(), &file_entry);
+            }
+        }
+    }
+
+    // Sorted paths share long prefixes with their predecessor
+    std::ranges::sort(entries, {}, &std::pair<std::string_view, const json*>::first);
+
+    putVarint(body, metadata.value("version", uint64_t{0}));
+    putVarint(body, entries.size());
+
+    std::string_view previous_path;
+
+    for (const auto& [path, entry] : entries) {
+        const size_t shared = std::ranges::mismatch(previous_path, path).in2 - path.begin();
+        putVarint(body, shared);
+        putVarint(body, path.size() - shared);
+        body.append(path.substr(shared));
+        previous_path = path;
+
+        const bool chunked = entry->contains("chunks") && (*entry)["chunks"].is_array();
+        const bool remote_files = entry->contains("file_id") || entry->contains("chunk_files");
+        const bool chunk_hashes = entry->contains("chunk_hashes") && (*entry)["chunk_hashes"].is_array();
+        const bool compression = remote_files && std::ranges::any_of(
+            entry->value("chunk_files", json::array()), [](const json& chunk_file) { return chunk_file.size() > 2; });
+
+        uint8_t flags = 0;
+        if (entry->value("is_dir", false)) {
+            flags |= kIsDir;
+        }
+        if (chunked) {
+            flags |= kChunked;
+        }
+        if (remote_files) {
+            flags |= kRemoteFiles;
+        }
+        if (chunk_hashes) {
+            flags |= kChunkHashes;
+        }
+        if (compression) {
+            flags |= kCompression;
+        }
+        body.push_back(static_cast<char>(flags));
+
+        const auto ctime = entry->value("ctime", int64_t{0});
+        putSigned(body, entry->value("message_id", int64_t{0}));
+        putVarint(body, entry->value("size", uint64_t{0}));
+        putSigned(body, ctime);
+        putSigned(body, entry->value("mtime", int64_t{0}) - ctime);
+
+        if (chunked) {
+            const auto& chunks = (*entry)["chunks"];
+
+            putVarint(body, entry->value("chunk_size", uint64_t{0}));
+            putVarint(body, chunks.size());
+
+            // Chunks of one file are usually uploaded back to back, so their IDs are close
+            int64_t previous_chunk = 0;
+            for (const auto& chunk : chunks) {
+                const auto chunk_id = chunk.get<int64_t>();
+                putSigned(body, chunk_id - previous_chunk);
+                previous_chunk = chunk_id;
+            }
+        }
+
+        if (remote_files) {
+            putString(body, entry->value("file_id", ""));
+            putString(body, entry->value("file_unique_id", ""));
+
+            const auto chunk_files = entry->value("chunk_files", json::array());
+            putVarint(body, chunk_files.size());
+
+            for (const auto& chunk_file : chunk_files) {
+                putString(body, chunk_file.at(0).get_ref<const std::string&>());
+                putString(body, chunk_file.at(1).get_ref<const std::string&>());
+
+                if (compression) {
+                    putVarint(body, chunk_file.size() > 2 ? chunk_file.at(2).get<uint64_t>() : 0);
+                }
+            }
+        }
+
+        // Stored as raw bytes, half the size of the hex form; unknown hashes are empty
+        if (chunk_hashes) {
+            const auto& hashes = (*entry)["chunk_hashes"];
+            putVarint(body, hashes.size());
+
+            for (const auto& hash : hashes) {
+                putString(body, ftes::ContentHash::fromHex(hash.get_ref<const std::string&>()));
+            }
+        }
+    }
+
+    // Slot table of the extra bots objects are stored with, format version 5
+    const auto bots = metadata.value("bots", json::array());
+    putVarint(body, bots.size());
+
+    for (const auto& bot : bots) {
+        putVarint(body, bot.value("slot", uint64_t{0}));
+        putSigned(body, bot.value("bot_id", int64_t{0}));
+    }
+
+    return body;
+}
+
+json decodeBody(Reader& reader, const uint8_t format_version) {
+    json metadata = {{"version", reader.varint()}, {"files", json::array()}};
+    auto& files = metadata["files"];
+
+    const uint64_t count = reader.varint();
+    std::string path;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t shared = reader.varint();
+        const uint64_t suffix = reader.varint();
+
+        if (shared > path.size()) {
+            throw std::runtime_error("Malformed path prefix in metadata");
+        }
+        path.resize(shared);
+        path.append(reader.take(suffix));
+
+        const auto flags = static_cast<uint8_t>(reader.take(1).front());
+
+        json file_entry = {{"path", path}};
+        file_entry["message_id"] = reader.signedVarint();
+        file_entry["size"] = reader.varint();
+        file_entry["is_dir"] = (flags & kIsDir) != 0;
+
+        const int64_t ctime = reader.signedVarint();
+        file_entry["ctime"] = ctime;
+        file_entry["mtime"] = ctime + reader.signedVarint();
+
+        if (flags & kChunked) {
+            file_entry["chunk_size"] = reader.varint();
+
+            const uint64_t chunk_count = reader.varint();
+            json chunks = json::array();
+
+            int64_t chunk_id = 0;
+            for (uint64_t c = 0; c < chunk_count; ++c) {
+                chunk_id += reader.signedVarint();
+                chunks.push_back(chunk_id);
+            }
+            file_entry["chunks"] = std::move(chunks);
+        }
+
+        if (flags & kRemoteFiles) {
+            file_entry["file_id"] = reader.string();
+            file_entry["file_unique_id"] = reader.string();
+
+            const uint64_t chunk_file_count = reader.varint();
+            json chunk_files = json::array();
+
+            for (uint64_t c = 0; c < chunk_file_count; ++c) {
+                std::string file_id = reader.string();
+                json chunk_file = {std::move(file_id), reader.string()};
+
+                // Raw chunks keep the two-element form
+                if (flags & kCompression) {
+                    if (const uint64_t chunk_compression = reader.varint(); chunk_compression != 0) {
+                        chunk_file.push_back(chunk_compression);
+                    }
+                }
+                chunk_files.push_back(std::move(chunk_file));
+            }
+            file_entry["chunk_files"] = std::move(chunk_files);
+        }
+
+        if (flags & kChunkHashes) {
+            const uint64_t hash_count = reader.varint();
+            json hashes = json::array();
+
+            for (uint64_t c = 0; c < hash_count; ++c) {
+                hashes.push_back(ftes::ContentHash::toHex(reader.string()));
+            }
+            file_entry["chunk_hashes"] = std::move(hashes);
+        }
+
+        files.push_back(std::move(file_entry));
+    }
+
+    if (format_version >= 5) {
+        const uint64_t bot_count = reader.varint();
+        json bots = json::array();
+
+        for (uint64_t i = 0; i < bot_count; ++i) {
+            const uint64_t slot = reader.varint();
+            bots.push_back({{"slot", slot}, {"bot_id", reader.signedVarint()}});
+        }
+
+        if (!bots.empty()) {
+            metadata["bots"] = std::move(bots);
+        }
+    }
+
+    return metadata;
+}
+
+} // namespace
+
+std::string ftes::MetadataCodec::encode(const json& metadata, const int compression_level) {
+    const std::string body = encodeBody(metadata);
+
+    std::string out(kMagic);
+    out.push_back(static_cast<char>(kFormatVersion));
+    out.push_back(static_cast<char>(Compression::kZstd));
+    putVarint(out, body.size());
+
+    const size_t header_size = out.size();
+    out.resize(header_size + ZSTD_compressBound(body.size()));
+
+    const size_t compressed_size = ZSTD_compress(out.data() + header_size, out.size() - header_size,
+                                                 body.data(), body.size(), compression_level);
+    if (ZSTD_isError(compressed_size)) {
+        throw std::runtime_error(std::string("Failed to compress metadata: ") + ZSTD_getErrorName(compressed_size));
+    }
+
+    out.resize(header_size + compressed_size);
+    return out;
+}
+
+json ftes::MetadataCodec::decode(const std::string_view data) {
+    if (!isBinary(data)) {
+        return json::parse(data);
+    }
+
+    Reader header(data.substr(kMagic.size()));
+
+    const auto format_version = static_cast<uint8_t>(header.take(1).front());
+    if (format_version > kFormatVersion) {
+        throw std::runtime_error("Metadata format version " + std::to_string(format_version) + " is newer than supported");
+    }
+
+    const auto compression = static_cast<Compression>(header.take(1).front());
+    const uint64_t body_size = header.varint();
+
+    if (compression == Compression::kNone) {
+        Reader body(header.take(body_size));
+        return decodeBody(body, format_version);
+    }
+
+    if (compression != Compression::kZstd) {
+        throw std::runtime_error("Unknown metadata compression");
+    }
+
+    const std::string_view compressed = header.rest();
+
+    // Both sizes come from the snapshot, so they are checked before anything is allocated
+    const unsigned long long frame_size = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+    if (frame_size == ZSTD_CONTENTSIZE_ERROR || frame_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        frame_size != body_size || body_size > kMaxBodyBytes) {
+        throw std::runtime_error("Corrupt metadata header");
+    }
+
+    std::string body(body_size, '\0');
+
+    const size_t decompressed_size = ZSTD_decompress(body.data(), body.size(), compressed.data(), compressed.size());
+    if (ZSTD_isError(decompressed_size) || decompressed_size != body_size) {
+        throw std::runtime_error("Failed to decompress metadata");
+    }
+
+    Reader body_reader(body);
+    return decodeBody(body_reader, format_version);
+}
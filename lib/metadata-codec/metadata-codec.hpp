@@ -0,0 +1,36 @@
+#ifndef METADATA_CODEC_HPP
+#define METADATA_CODEC_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <nlohmann/json.hpp>
+
+namespace fuse_telegram_external_storage {
+
+    // Compact binary encoding of the metadata document. Entries are sorted by
+    // path and stored with the prefix shared with the previous path elided,
+    // integers are varints and the whole body is zstd-compressed. Documents
+    // that don't start with the magic are the older JSON layout
+    class MetadataCodec {
+    public:
+        static constexpr std::string_view kMagic = "FESM";
+        // Version 2 adds the Bot API file IDs of stored objects, version 3 the
+        // chunk hashes, version 4 the compression of chunks, version 5 the
+        // slot table of extra bots
+        static constexpr uint8_t kFormatVersion = 5;
+
+        static std::string encode(const nlohmann::json& metadata, int compression_level = 3);
+
+        // Accepts both the binary format and plain JSON
+        static nlohmann::json decode(std::string_view data);
+
+        static bool isBinary(std::string_view data) {
+            return data.starts_with(kMagic);
+        }
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //METADATA_CODEC_HPP
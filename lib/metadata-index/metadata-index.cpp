@@ -0,0 +1,391 @@
+#include "metadata-index.hpp"
+
+#include "lib/logger/logger.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+using json = nlohmann::json;
+
+std::string ftes::MetadataIndex::normalizePath(const std::filesystem::path& path) {
+    std::string path_str = path.string();
+
+    if (path_str.empty() || path_str == ".") {
+        return "/";
+    }
+
+    if (path_str[0] != '/') {
+        path_str = "/" + path_str;
+    }
+
+    return path_str;
+}
+
+std::string ftes::MetadataIndex::parentPath(const std::string& normalized_path) {
+    const size_t slash = normalized_path.find_last_of('/');
+
+    if (slash == 0 || slash == std::string::npos) {
+        return "/";
+    }
+
+    return normalized_path.substr(0, slash);
+}
+
+void ftes::MetadataIndex::load(const json& metadata) {
+    entries_.clear();
+    children_.clear();
+    objects_.clear();
+    objects_by_hash_.clear();
+    bots_.clear();
+    version_ = 0;
+
+    if (metadata.is_object() && metadata.contains("version") && metadata["version"].is_number_unsigned()) {
+        version_ = metadata["version"].get<uint64_t>();
+    }
+
+    if (metadata.is_object() && metadata.contains("bots") && metadata["bots"].is_array()) {
+        for (const auto& bot : metadata["bots"]) {
+            bots_[bot.value("slot", uint32_t{0})] = bot.value("bot_id", int64_t{0});
+        }
+    }
+
+    if (!metadata.is_object() || !metadata.contains("files") || !metadata["files"].is_array()) {
+        return;
+    }
+
+    entries_.reserve(metadata["files"].size());
+
+    for (const auto& file_entry : metadata["files"]) {
+        auto info = entryFromJson(file_entry);
+        if (!info) {
+            FES_LOG(kWarning) << "[MetadataIndex] Invalid file entry in metadata";
+            continue;
+        }
+
+        // Older metadata may hold duplicates for one path; prefer the entry that has content
+        const auto it = entries_.find(info->path);
+        if (it != entries_.end() && (it->second.hasContent() || !info->hasContent())) {
+            continue;
+        }
+
+        entries_.insert_or_assign(info->path, std::move(*info));
+    }
+
+    for (const auto& [path, info] : entries_) {
+        linkChild(path);
+        addReferences(info);
+    }
+}
+
+json ftes::MetadataIndex::toJson() const {
+    json files = json::array();
+
+    for (const auto& [path, info] : entries_) {
+        files.push_back(entryToJson(info));
+    }
+
+    json metadata = {{"version", version_}, {"files", std::move(files)}};
+
+    if (!bots_.empty()) {
+        json bots = json::array();
+        for (const auto& [slot, bot_id] : bots_) {
+            bots.push_back({{"slot", slot}, {"bot_id", bot_id}});
+        }
+        metadata["bots"] = std::move(bots);
+    }
+
+    return metadata;
+}
+
+void ftes::MetadataIndex::apply(const json& record) {
+    for (const auto& op : record.value("ops", json::array())) {
+        const std::string type = op.value("op", "");
+
+        if (type == "put") {
+            if (auto info = entryFromJson(op["entry"])) {
+                upsert(std::move(*info));
+            }
+        } else if (type == "erase") {
+            erase(op.value("path", ""));
+        } else if (type == "rename") {
+            rename(op.value("from", ""), op.value("to", ""));
+        } else if (type == "bot") {
+            setBot(op.value("slot", uint32_t{0}), op.value("bot_id", int64_t{0}));
+        } else {
+            FES_LOG(kWarning) << "[MetadataIndex] Unknown journal operation: " << type;
+        }
+    }
+
+    version_ = record.value("version", version_);
+}
+
+json ftes::MetadataIndex::putRecord(const FileInfo& info) {
+    return json{{"op", "put"}, {"entry", entryToJson(info)}};
+}
+
+json ftes::MetadataIndex::eraseRecord(const std::filesystem::path& path) {
+    return json{{"op", "erase"}, {"path", normalizePath(path)}};
+}
+
+json ftes::MetadataIndex::renameRecord(const std::filesystem::path& from, const std::filesystem::path& to) {
+    return json{{"op", "rename"}, {"from", normalizePath(from)}, {"to", normalizePath(to)}};
+}
+
+json ftes::MetadataIndex::botRecord(const uint32_t slot, const int64_t bot_id) {
+    return json{{"op", "bot"}, {"slot", slot}, {"bot_id", bot_id}};
+}
+
+json ftes::MetadataIndex::entryToJson(const FileInfo& info) {
+    json file_entry = {
+        {"path", info.path},
+        {"message_id", info.message_id},
+        {"size", info.size},
+        {"is_dir", info.is_dir},
+        {"ctime", info.ctime},
+        {"mtime", info.mtime}
+    };
+
+    if (!info.chunks.empty()) {
+        file_entry["chunk_size"] = info.chunk_size;
+        file_entry["chunks"] = info.chunks;
+    }
+
+    if (!info.file.empty()) {
+        file_entry["file_id"] = info.file.file_id;
+        file_entry["file_unique_id"] = info.file.file_unique_id;
+    }
+
+    if (!info.chunk_files.empty()) {
+        json chunk_files = json::array();
+        for (const auto& chunk_file : info.chunk_files) {
+            json entry = {chunk_file.file_id, chunk_file.file_unique_id};
+
+            // Raw chunks keep the two-element form
+            if (chunk_file.compression != ChunkCompression::kNone) {
+                entry.push_back(static_cast<uint8_t>(chunk_file.compression));
+            }
+            chunk_files.push_back(std::move(entry));
+        }
+        file_entry["chunk_files"] = std::move(chunk_files);
+    }
+
+    if (!info.chunk_hashes.empty()) {
+        file_entry["chunk_hashes"] = info.chunk_hashes;
+    }
+
+    return file_entry;
+}
+
+std::optional<ftes::FileInfo> ftes::MetadataIndex::entryFromJson(const json& file_entry) {
+    if (!file_entry.is_object() || !file_entry.contains("path") || !file_entry["path"].is_string()) {
+        return std::nullopt;
+    }
+
+    FileInfo info;
+    info.path = normalizePath(file_entry["path"].get<std::string>());
+    info.message_id = file_entry.value("message_id", int64_t{0});
+    info.size = file_entry.value("size", size_t{0});
+    info.is_dir = file_entry.value("is_dir", false);
+    info.ctime = file_entry.value("ctime", time_t{0});
+    info.mtime = file_entry.value("mtime", time_t{0});
+
+    if (file_entry.contains("chunks") && file_entry["chunks"].is_array()) {
+        info.chunk_size = file_entry.value("chunk_size", size_t{0});
+        info.chunks = file_entry["chunks"].get<std::vector<int64_t>>();
+    }
+
+    info.file.file_id = file_entry.value("file_id", "");
+    info.file.file_unique_id = file_entry.value("file_unique_id", "");
+
+    // Only kept if there is one per chunk, otherwise the entry is migrated again
+    if (file_entry.contains("chunk_files") && file_entry["chunk_files"].is_array() &&
+        file_entry["chunk_files"].size() == info.chunks.size()) {
+        for (const auto& chunk_file : file_entry["chunk_files"]) {
+            RemoteFile file = {chunk_file.at(0).get<std::string>(), chunk_file.at(1).get<std::string>()};
+
+            if (chunk_file.size() > 2) {
+                file.compression = static_cast<ChunkCompression>(chunk_file.at(2).get<uint8_t>());
+            }
+            info.chunk_files.push_back(std::move(file));
+        }
+    }
+
+    if (file_entry.contains("chunk_hashes") && file_entry["chunk_hashes"].is_array() &&
+        file_entry["chunk_hashes"].size() == info.chunks.size()) {
+        info.chunk_hashes = file_entry["chunk_hashes"].get<std::vector<std::string>>();
+    }
+
+    return info;
+}
+
+std::optional<ftes::FileInfo> ftes::MetadataIndex::find(const std::filesystem::path& path) const {
+    const auto it = entries_.find(normalizePath(path));
+
+    if (it == entries_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+std::vector<ftes::FileInfo> ftes::MetadataIndex::children(const std::filesystem::path& dir_path) const {
+    std::vector<FileInfo> entries;
+
+    const auto dir = children_.find(normalizePath(dir_path));
+    if (dir == children_.end()) {
+        return entries;
+    }
+
+    entries.reserve(dir->second.size());
+    for (const auto& child_path : dir->second) {
+        entries.push_back(entries_.at(child_path));
+    }
+
+    return entries;
+}
+
+bool ftes::MetadataIndex::hasChildren(const std::filesystem::path& dir_path) const {
+    const auto dir = children_.find(normalizePath(dir_path));
+
+    return dir != children_.end() && !dir->second.empty();
+}
+
+void ftes::MetadataIndex::upsert(FileInfo info) {
+    info.path = normalizePath(info.path);
+    std::string key = info.path;
+
+    addReferences(info);
+
+    const auto existing = entries_.find(key);
+    if (existing != entries_.end()) {
+        dropReferences(existing->second);
+        existing->second = std::move(info);
+        return;
+    }
+
+    entries_.emplace(key, std::move(info));
+    linkChild(key);
+}
+
+bool ftes::MetadataIndex::erase(const std::filesystem::path& path) {
+    const std::string key = normalizePath(path);
+
+    const auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        return false;
+    }
+
+    dropReferences(it->second);
+    entries_.erase(it);
+
+    unlinkChild(key);
+    return true;
+}
+
+std::optional<std::pair<int64_t, ftes::RemoteFile>> ftes::MetadataIndex::findObject(const std::string& hash) const {
+    const auto by_hash = objects_by_hash_.find(hash);
+    if (hash.empty() || by_hash == objects_by_hash_.end()) {
+        return std::nullopt;
+    }
+
+    const auto object = objects_.find(by_hash->second);
+    if (object == objects_.end() || object->second.file.empty()) {
+        return std::nullopt;
+    }
+
+    return std::make_pair(object->first, object->second.file);
+}
+
+size_t ftes::MetadataIndex::references(const int64_t message_id) const {
+    const auto it = objects_.find(message_id);
+    return it == objects_.end() ? 0 : it->second.references;
+}
+
+bool ftes::MetadataIndex::rename(const std::filesystem::path& from, const std::filesystem::path& to) {
+    const std::string from_key = normalizePath(from);
+    const std::string to_key = normalizePath(to);
+
+    auto node = entries_.extract(from_key);
+    if (node.empty()) {
+        return false;
+    }
+    unlinkChild(from_key);
+
+    // Re-key the children before the entry itself so the walk stays inside the old subtree
+    if (auto dir = children_.extract(from_key); !dir.empty()) {
+        for (const auto& child_path : dir.mapped()) {
+            rename(child_path, to_key + child_path.substr(from_key.size()));
+        }
+    }
+
+    node.key() = to_key;
+    node.mapped().path = to_key;
+    entries_.insert(std::move(node));
+    linkChild(to_key);
+
+    return true;
+}
+
+void ftes::MetadataIndex::addReferences(const FileInfo& info) {
+    if (info.message_id > 0) {
+        auto& object = objects_[info.message_id];
+        ++object.references;
+
+        if (object.file.empty()) {
+            object.file = info.file;
+        }
+    }
+
+    for (size_t i = 0; i < info.chunks.size(); ++i) {
+        auto& object = objects_[info.chunks[i]];
+        ++object.references;
+
+        if (object.file.empty() && i < info.chunk_files.size()) {
+            object.file = info.chunk_files[i];
+        }
+
+        if (object.hash.empty() && i < info.chunk_hashes.size() && !info.chunk_hashes[i].empty()) {
+            object.hash = info.chunk_hashes[i];
+            objects_by_hash_.try_emplace(object.hash, info.chunks[i]);
+        }
+    }
+}
+
+void ftes::MetadataIndex::dropReferences(const FileInfo& info) {
+    std::vector<int64_t> message_ids = info.chunks;
+    if (info.message_id > 0) {
+        message_ids.push_back(info.message_id);
+    }
+
+    for (const int64_t message_id : message_ids) {
+        const auto it = objects_.find(message_id);
+        if (it == objects_.end() || --it->second.references > 0) {
+            continue;
+        }
+
+        if (const auto by_hash = objects_by_hash_.find(it->second.hash);
+            by_hash != objects_by_hash_.end() && by_hash->second == message_id) {
+            objects_by_hash_.erase(by_hash);
+        }
+
+        objects_.erase(it);
+    }
+}
+
+void ftes::MetadataIndex::linkChild(const std::string& path) {
+    if (path == "/") {
+        return;
+    }
+
+    children_[parentPath(path)].insert(path);
+}
+
+void ftes::MetadataIndex::unlinkChild(const std::string& path) {
+    const auto dir = children_.find(parentPath(path));
+    if (dir == children_.end()) {
+        return;
+    }
+
+    dir->second.erase(path);
+    if (dir->second.empty()) {
+        children_.erase(dir);
+    }
+}
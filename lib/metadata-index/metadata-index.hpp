@@ -0,0 +1,105 @@
+#ifndef METADATA_INDEX_HPP
+#define METADATA_INDEX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "lib/telegram-api/telegram-api.hpp"
+
+namespace fuse_telegram_external_storage {
+
+    // Resident copy of metadata.json keyed by normalized path, so lookups
+    // don't have to go through the Telegram API. Every directory also keeps
+    // the set of its children, so listing and emptiness checks cost
+    // O(children) instead of O(total files)
+    class MetadataIndex {
+    public:
+        // Turn "", "." and relative paths into the absolute form used as the key
+        static std::string normalizePath(const std::filesystem::path& path);
+
+        // Parent of a normalized path, "/" for top-level entries
+        static std::string parentPath(const std::string& normalized_path);
+
+        // Replace the whole index with the contents of a metadata document
+        void load(const nlohmann::json& metadata);
+
+        // Serialize the index back into the metadata document layout
+        [[nodiscard]] nlohmann::json toJson() const;
+
+        // Replay one journal record ({"version", "ops": [...]}) on top of the index
+        void apply(const nlohmann::json& record);
+
+        // Journal operations describing single mutations
+        static nlohmann::json putRecord(const FileInfo& info);
+        static nlohmann::json eraseRecord(const std::filesystem::path& path);
+        static nlohmann::json renameRecord(const std::filesystem::path& from, const std::filesystem::path& to);
+        static nlohmann::json botRecord(uint32_t slot, int64_t bot_id);
+
+        [[nodiscard]] std::optional<FileInfo> find(const std::filesystem::path& path) const;
+        [[nodiscard]] std::vector<FileInfo> children(const std::filesystem::path& dir_path) const;
+        [[nodiscard]] bool hasChildren(const std::filesystem::path& dir_path) const;
+
+        // Insert or overwrite the entry stored under info.path
+        void upsert(FileInfo info);
+
+        // Returns false if there was no entry for the path
+        bool erase(const std::filesystem::path& path);
+
+        // Move an entry and, for directories, everything below it.
+        // Returns false if the source doesn't exist
+        bool rename(const std::filesystem::path& from, const std::filesystem::path& to);
+
+        [[nodiscard]] size_t size() const { return entries_.size(); }
+
+        // A message already holding content with this hash, if any entry still refers to it
+        [[nodiscard]] std::optional<std::pair<int64_t, RemoteFile>> findObject(const std::string& hash) const;
+
+        // Number of chunks, across all entries, stored in the message
+        [[nodiscard]] size_t references(int64_t message_id) const;
+
+        // Bots besides the one holding the metadata that objects were stored
+        // with, by the slot their objects are tagged with. Slots are never reused
+        [[nodiscard]] const std::map<uint32_t, int64_t>& bots() const { return bots_; }
+        void setBot(uint32_t slot, int64_t bot_id) { bots_[slot] = bot_id; }
+
+        // Monotonic counter stored in the metadata document, bumped on every commit
+        [[nodiscard]] uint64_t version() const { return version_; }
+        void bumpVersion() { ++version_; }
+
+    private:
+        static nlohmann::json entryToJson(const FileInfo& info);
+        static std::optional<FileInfo> entryFromJson(const nlohmann::json& file_entry);
+
+        void linkChild(const std::string& path);
+        void unlinkChild(const std::string& path);
+
+        void addReferences(const FileInfo& info);
+        void dropReferences(const FileInfo& info);
+
+        // A stored message and the number of references to it, rebuilt from the entries on load
+        struct StoredObject {
+            RemoteFile file;
+            std::string hash;
+            size_t references = 0;
+        };
+
+        std::unordered_map<std::string, FileInfo> entries_;
+        std::unordered_map<std::string, std::unordered_set<std::string>> children_;
+        std::unordered_map<int64_t, StoredObject> objects_;
+        std::unordered_map<std::string, int64_t> objects_by_hash_;
+        std::map<uint32_t, int64_t> bots_;
+        uint64_t version_ = 0;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //METADATA_INDEX_HPP
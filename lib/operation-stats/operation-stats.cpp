@@ -0,0 +1,217 @@
+#include "operation-stats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+namespace fes = fuse_external_storage;
+
+namespace {
+
+    constexpr std::array<double, 3> kQuantiles = {0.5, 0.9, 0.99};
+
+    double seconds(const uint64_t micros) {
+        return static_cast<double>(micros) / 1e6;
+    }
+
+} // namespace
+
+void fes::LatencyHistogram::record(const std::chrono::nanoseconds latency) {
+    const uint64_t nanos = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+
+    Shard& shard = shards_[shardIndex()];
+    shard.counts[bucketOf(nanos / 1000)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum_ns.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+fes::LatencyHistogram::Snapshot fes::LatencyHistogram::snapshot() const {
+    Snapshot snapshot;
+    uint64_t sum_ns = 0;
+
+    for (const Shard& shard : shards_) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            const uint64_t count = shard.counts[i].load(std::memory_order_relaxed);
+            snapshot.counts[i] += count;
+            snapshot.count += count;
+        }
+
+        sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+    }
+
+    snapshot.sum = std::chrono::nanoseconds(sum_ns);
+    return snapshot;
+}
+
+size_t fes::LatencyHistogram::bucketOf(const uint64_t micros) {
+    if (micros < kSubBuckets) {
+        return micros;
+    }
+
+    // The top kSubBucketBits + 1 bits pick the group and the bucket inside it
+    const size_t exponent = std::bit_width(micros) - 1;
+    const size_t group = exponent - kSubBucketBits + 1;
+    if (group >= kGroups) {
+        return kBuckets - 1;
+    }
+
+    const size_t sub_bucket = (micros >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return group * kSubBuckets + sub_bucket;
+}
+
+uint64_t fes::LatencyHistogram::upperBound(const size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket + 1;
+    }
+
+    if (bucket >= kBuckets - 1) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    const size_t shift = bucket / kSubBuckets - 1;
+    return ((kSubBuckets + bucket % kSubBuckets) << shift) + (uint64_t{1} << shift);
+}
+
+std::chrono::microseconds fes::LatencyHistogram::Snapshot::quantile(const double q) const {
+    if (count == 0) {
+        return std::chrono::microseconds(0);
+    }
+
+    const auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i + 1 < kBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::chrono::microseconds(upperBound(i));
+        }
+    }
+
+    // Slower than the last bounded bucket, the mean of the tail is unknown
+    return std::chrono::microseconds(upperBound(kBuckets - 2));
+}
+
+size_t fes::LatencyHistogram::shardIndex() {
+    static std::atomic<size_t> next_thread = 0;
+    static thread_local const size_t index = next_thread.fetch_add(1, std::memory_order_relaxed) % kShards;
+
+    return index;
+}
+
+void fes::OperationStats::Operation::record(const std::chrono::nanoseconds elapsed, const bool failed) {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    if (failed) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    latency.record(elapsed);
+}
+
+fes::OperationStats::Operation& fes::OperationStats::operation(const std::string_view name) {
+    {
+        std::shared_lock lock(mutex_);
+        if (const auto it = operations_.find(name); it != operations_.end()) {
+            return *it->second;
+        }
+    }
+
+    std::unique_lock lock(mutex_);
+    auto& operation = operations_[std::string(name)];
+    if (!operation) {
+        operation = std::make_unique<Operation>();
+    }
+
+    return *operation;
+}
+
+fes::OperationStats::Timer::Timer(Operation& operation)
+    : operation_(operation), start_(std::chrono::steady_clock::now()) {}
+
+fes::OperationStats::Timer::~Timer() {
+    operation_.record(std::chrono::steady_clock::now() - start_, failed_);
+}
+
+void fes::OperationStats::writePrometheus(std::string& out, const std::string_view prefix, const std::string_view label) const {
+    writePrometheus(out, prefix, label, {{"", this}});
+}
+
+void fes::OperationStats::writePrometheus(std::string& out, const std::string_view prefix, const std::string_view label,
+                                          const std::vector<LabelledSource>& sources) {
+    struct Row {
+        std::string labels;
+        const Operation* operation;
+        LatencyHistogram::Snapshot latency;
+    };
+
+    // Snapshot once, so the families of one scrape agree with each other
+    std::vector<Row> rows;
+    for (const auto& [extra_labels, stats] : sources) {
+        std::shared_lock lock(stats->mutex_);
+
+        for (const auto& [name, operation] : stats->operations_) {
+            std::string labels = std::string(label) + "=\"" + name + "\"";
+            if (!extra_labels.empty()) {
+                labels = extra_labels + "," + labels;
+            }
+
+            rows.push_back({std::move(labels), operation.get(), operation->latency.snapshot()});
+        }
+    }
+
+    std::ostringstream os;
+    os << std::setprecision(9);
+
+    const auto header = [&os, prefix](const std::string_view family, const std::string_view type, const std::string_view help) {
+        os << "# HELP " << prefix << "_" << family << " " << help << "\n"
+           << "# TYPE " << prefix << "_" << family << " " << type << "\n";
+    };
+
+    const auto counter = [&](const std::string_view family, const std::string_view help,
+                             const std::atomic<uint64_t> Operation::* field) {
+        header(family, "counter", help);
+
+        for (const Row& row : rows) {
+            os << prefix << "_" << family << "{" << row.labels << "} "
+               << (row.operation->*field).load(std::memory_order_relaxed) << "\n";
+        }
+    };
+
+    counter("calls_total", "Completed operations", &Operation::calls);
+    counter("errors_total", "Operations that failed", &Operation::errors);
+    counter("read_bytes_total", "Bytes read by the operations", &Operation::bytes_read);
+    counter("written_bytes_total", "Bytes written by the operations", &Operation::bytes_written);
+
+    header("latency_seconds", "histogram", "Operation latency");
+
+    for (const Row& row : rows) {
+        uint64_t cumulative = 0;
+
+        // Only the power of two boundaries, the linear buckets between them feed the quantiles
+        for (size_t i = 0; i + 1 < LatencyHistogram::kBuckets; ++i) {
+            cumulative += row.latency.counts[i];
+
+            if (i % LatencyHistogram::kSubBuckets == LatencyHistogram::kSubBuckets - 1) {
+                os << prefix << "_latency_seconds_bucket{" << row.labels << ",le=\""
+                   << seconds(LatencyHistogram::upperBound(i)) << "\"} " << cumulative << "\n";
+            }
+        }
+
+        os << prefix << "_latency_seconds_bucket{" << row.labels << ",le=\"+Inf\"} " << row.latency.count << "\n"
+           << prefix << "_latency_seconds_sum{" << row.labels << "} "
+           << std::chrono::duration<double>(row.latency.sum).count() << "\n"
+           << prefix << "_latency_seconds_count{" << row.labels << "} " << row.latency.count << "\n";
+    }
+
+    header("latency_quantile_seconds", "gauge", "Upper bound of the latency quantile");
+
+    for (const Row& row : rows) {
+        for (const double q : kQuantiles) {
+            os << prefix << "_latency_quantile_seconds{" << row.labels << ",quantile=\"" << q << "\"} "
+               << seconds(row.latency.quantile(q).count()) << "\n";
+        }
+    }
+
+    out += os.str();
+}
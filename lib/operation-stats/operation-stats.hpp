@@ -0,0 +1,128 @@
+#ifndef OPERATION_STATS_HPP
+#define OPERATION_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fuse_external_storage {
+
+    // Log-linear latency histogram in the HDR style: every power of two of
+    // microseconds is split into kSubBuckets linear buckets, so a bucket is
+    // never wider than a quarter of the values in it. Recording is a relaxed
+    // increment in the calling thread's shard, readers sum the shards
+    class LatencyHistogram {
+    public:
+        static constexpr size_t kSubBucketBits = 2;
+        static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+
+        // Groups of kSubBuckets, the last one ends at 2^27 us (about two
+        // minutes); one more bucket catches everything slower
+        static constexpr size_t kGroups = 26;
+        static constexpr size_t kBuckets = kGroups * kSubBuckets + 1;
+
+        struct Snapshot {
+            std::array<uint64_t, kBuckets> counts = {};
+            uint64_t count = 0;
+            std::chrono::nanoseconds sum{0};
+
+            // Upper bound of the bucket holding the quantile, 0 if nothing was recorded
+            [[nodiscard]] std::chrono::microseconds quantile(double q) const;
+        };
+
+        LatencyHistogram() = default;
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void record(std::chrono::nanoseconds latency);
+
+        [[nodiscard]] Snapshot snapshot() const;
+
+        static size_t bucketOf(uint64_t micros);
+
+        // Values below this many microseconds land in the bucket or an earlier one
+        static uint64_t upperBound(size_t bucket);
+
+    private:
+        static constexpr size_t kShards = 8;
+
+        // A cache line of its own per shard, so threads don't fight over counters
+        struct alignas(64) Shard {
+            std::array<std::atomic<uint64_t>, kBuckets> counts = {};
+            std::atomic<uint64_t> sum_ns = 0;
+        };
+
+        static size_t shardIndex();
+
+        std::array<Shard, kShards> shards_;
+    };
+
+    // Calls, failures, bytes moved and latency of named operations, such as
+    // FUSE callbacks or Bot API methods. Operations are created on first use
+    // and never removed, so references to them stay valid
+    class OperationStats {
+    public:
+        struct Operation {
+            std::atomic<uint64_t> calls = 0;
+            std::atomic<uint64_t> errors = 0;
+            std::atomic<uint64_t> bytes_read = 0;
+            std::atomic<uint64_t> bytes_written = 0;
+            LatencyHistogram latency;
+
+            void record(std::chrono::nanoseconds elapsed, bool failed);
+        };
+
+        OperationStats() = default;
+
+        OperationStats(const OperationStats&) = delete;
+        OperationStats& operator=(const OperationStats&) = delete;
+
+        Operation& operation(std::string_view name);
+
+        // Times a call from construction to destruction, failed unless told otherwise
+        class Timer {
+        public:
+            explicit Timer(Operation& operation);
+            ~Timer();
+
+            Timer(const Timer&) = delete;
+            Timer& operator=(const Timer&) = delete;
+
+            void succeed() { failed_ = false; }
+
+        private:
+            Operation& operation_;
+            std::chrono::steady_clock::time_point start_;
+            bool failed_ = true;
+        };
+
+        // Appends the operations in the Prometheus text format, as the
+        // families <prefix>_calls_total, _errors_total, _read_bytes_total,
+        // _written_bytes_total, _latency_seconds (a histogram with a bucket per
+        // power of two) and _latency_quantile_seconds, labelled <label>="<name>"
+        void writePrometheus(std::string& out, std::string_view prefix, std::string_view label) const;
+
+        // Same for several sources in one set of families, each source adding
+        // its own labels, e.g. bot="1"
+        using LabelledSource = std::pair<std::string, const OperationStats*>;
+        static void writePrometheus(std::string& out, std::string_view prefix, std::string_view label,
+                                    const std::vector<LabelledSource>& sources);
+
+    private:
+        mutable std::shared_mutex mutex_;
+        std::map<std::string, std::unique_ptr<Operation>, std::less<>> operations_;
+    };
+
+} // namespace fuse_external_storage
+
+#endif // OPERATION_STATS_HPP
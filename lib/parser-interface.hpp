@@ -1,13 +1,87 @@
 #ifndef PARSER_INTERFACE_HPP
 #define PARSER_INTERFACE_HPP
 
-#include <tuple>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/logger/logger.hpp"
 
 namespace fuse_external_storage {
 
+struct ParsedArgs {
+    // Arguments left for libfuse
+    int fuse_argc;
+    char** fuse_argv;
+
+    std::string mount_point;
+
+    // Serve the mount through the inode-based low-level API, with kernel
+    // caching of names and attributes for the given number of seconds
+    bool inode_frontend;
+    double entry_timeout;
+    double attr_timeout;
+
+    // How the kernel caches and batches file I/O of the mount
+    bool page_cache;
+    bool writeback_cache;
+    uint32_t max_write_bytes;
+    uint32_t max_readahead_bytes;
+    bool async_read;
+    bool splice;
+
+    // Log statements below this level are skipped without being formatted
+    LogLevel log_level;
+
+    // Chrome Trace Event file spans are dumped to on SIGUSR2 and unmount, empty
+    // disables tracing, and the spans kept in memory
+    std::filesystem::path trace_file;
+    uint64_t trace_max_spans;
+
+    // Local read cache
+    std::filesystem::path cache_dir;
+    uint64_t cache_size_bytes;
+
+    // Size of the parts files are stored in
+    uint64_t chunk_size_bytes;
+
+    // zstd level for stored chunks, 0 stores them raw
+    int compression_level;
+
+    // Read-ahead in chunks (0 disables) and the cap on bytes being prefetched
+    uint64_t prefetch_window;
+    uint64_t prefetch_budget_bytes;
+
+    // Metadata journal records before the snapshot is compacted, 0 disables journaling
+    uint64_t journal_max_records;
+
+    // Window in milliseconds metadata changes are batched over (0 commits each one) and the batch cap
+    uint64_t commit_delay_ms;
+    uint64_t commit_max_batch;
+
+    // Threads uploading stored files in the background
+    uint64_t upload_workers;
+
+    // Keep-alive connections to the Bot API and the server it is reached at
+    uint64_t http_connections;
+    std::string api_url;
+
+    // Bot tokens and chat IDs chunks are striped to besides the main bot
+    std::vector<std::pair<std::string, int64_t>> extra_bots;
+
+    // Local directory replacing Telegram when set, with the emulated remote's
+    // per-request latency, bandwidth (0 is unlimited) and failure rate
+    std::filesystem::path local_storage_dir;
+    double emulated_latency_ms;
+    uint64_t emulated_bandwidth_bytes;
+    double emulated_error_rate;
+};
+
 class ParserInterface {
 public:
-    virtual std::tuple<int, char**, std::string> Parse(int, char**) = 0; // TODO: add result type instead of tuple
+    virtual ParsedArgs Parse(int, char**) = 0;
 
     virtual ~ParserInterface() = default;
 };
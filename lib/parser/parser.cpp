@@ -1,5 +1,6 @@
 #include "parser.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <filesystem>
 
@@ -26,10 +27,255 @@ fes::FuseArgsParser::FuseArgsParser(std::string parser_name)
         "libfuse option"
     );
 
+    app_.add_option(
+        "--frontend",
+        frontend_,
+        "FUSE API the mount is served through: path (high-level) or inode (low-level, with kernel caching)"
+    )
+    ->check(CLI::IsMember({"path", "inode"}))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--entry-timeout",
+        entry_timeout_,
+        "Seconds the kernel caches names with the inode frontend"
+    )
+    ->check(CLI::NonNegativeNumber)
+    ->capture_default_str();
+
+    app_.add_option(
+        "--attr-timeout",
+        attr_timeout_,
+        "Seconds the kernel caches attributes with the inode frontend"
+    )
+    ->check(CLI::NonNegativeNumber)
+    ->capture_default_str();
+
+    app_.add_option(
+        "--page-cache",
+        page_cache_,
+        "Keep file pages in the kernel page cache across opens until the file's mtime or size change"
+    )
+    ->group("Kernel caching")
+    ->capture_default_str();
+
+    app_.add_option(
+        "--writeback-cache",
+        writeback_cache_,
+        "Buffer writes in the kernel page cache and send them in large batches"
+    )
+    ->group("Kernel caching")
+    ->capture_default_str();
+
+    app_.add_option(
+        "--max-write",
+        max_write_kib_,
+        "Largest write request in KiB, 0 keeps the default"
+    )
+    ->group("Kernel caching")
+    ->check(CLI::Range(0, 16384))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--max-readahead",
+        max_readahead_kib_,
+        "Kernel read-ahead window in KiB, 0 keeps the default"
+    )
+    ->group("Kernel caching")
+    ->check(CLI::Range(0, 16384))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--async-read",
+        async_read_,
+        "Let the kernel have several reads of a file in flight at once"
+    )
+    ->group("Kernel caching")
+    ->capture_default_str();
+
+    app_.add_option(
+        "--splice",
+        splice_,
+        "Move request data through pipes instead of copying it"
+    )
+    ->group("Kernel caching")
+    ->capture_default_str();
+
+    app_.add_option(
+        "--log-level",
+        log_level_,
+        "Least severe messages logged: trace, debug, info, warning, error or off"
+    )
+    ->check(CLI::Validator([](const std::string& value) -> std::string {
+        return parseLogLevel(value) ? std::string() : "Unknown log level " + value;
+    }, "LEVEL"))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--trace-file",
+        trace_file_,
+        "Record spans of every operation and dump them here as Chrome Trace Event JSON on SIGUSR2 and unmount"
+    )
+    ->group("Tracing");
+
+    app_.add_option(
+        "--trace-spans",
+        trace_max_spans_,
+        "Most recent spans kept in memory for the dump"
+    )
+    ->group("Tracing")
+    ->check(CLI::PositiveNumber)
+    ->capture_default_str();
+
+    app_.add_option(
+        "--cache-dir",
+        cache_dir_,
+        "Directory for the local read cache, with a subdirectory per bot and chat"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--cache-size",
+        cache_size_mib_,
+        "Read cache budget in MiB"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--chunk-size",
+        chunk_size_mib_,
+        "Size of the parts files are stored in, in MiB"
+    )
+    ->check(CLI::Range(1, 20))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--compress-level",
+        compression_level_,
+        "zstd level chunks are compressed with before upload, 0 disables compression"
+    )
+    ->check(CLI::Range(0, 19))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--prefetch-window",
+        prefetch_window_,
+        "Chunks fetched ahead of sequential reads, 0 disables read-ahead"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--prefetch-budget",
+        prefetch_budget_mib_,
+        "Maximum MiB being prefetched at once"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--journal-records",
+        journal_max_records_,
+        "Metadata journal records kept before the snapshot is rewritten, 0 rewrites it on every change"
+    )
+    ->check(CLI::Range(0, 64))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--commit-delay",
+        commit_delay_ms_,
+        "Milliseconds metadata changes are batched for before being committed, 0 commits every change"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--commit-batch",
+        commit_max_batch_,
+        "Metadata changes that trigger a commit before the delay runs out"
+    )
+    ->check(CLI::PositiveNumber)
+    ->capture_default_str();
+
+    app_.add_option(
+        "--upload-workers",
+        upload_workers_,
+        "Files uploaded in parallel in the background"
+    )
+    ->check(CLI::Range(1, 32))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--connections",
+        http_connections_,
+        "Keep-alive connections to the Bot API, one is held by long polling"
+    )
+    ->check(CLI::Range(2, 64))
+    ->capture_default_str();
+
+    app_.add_option(
+        "--api-url",
+        api_url_,
+        "Bot API server, e.g. a local telegram-bot-api or a fake one for load tests"
+    )
+    ->capture_default_str();
+
+    app_.add_option(
+        "--extra-bot",
+        extra_bots_,
+        "Further bot as TOKEN@CHAT_ID, chunks are striped across all bots. Repeatable"
+    )
+    ->envname("EXTRA_BOTS")
+    ->delimiter(',')
+    ->check(CLI::Validator([](const std::string& value) -> std::string {
+        const size_t separator = value.rfind('@');
+        if (separator == std::string::npos || value.find(':') > separator) {
+            return "Expected TOKEN@CHAT_ID";
+        }
+
+        try {
+            std::stoll(value.substr(separator + 1));
+        } catch (const std::exception&) {
+            return "Chat ID must be a number";
+        }
+
+        return {};
+    }, "TOKEN@CHAT_ID"));
+
+    app_.add_option(
+        "--local-storage",
+        local_storage_dir_,
+        "Keep files in this local directory instead of Telegram, for offline benchmarks"
+    )
+    ->group("Local storage");
+
+    app_.add_option(
+        "--emulated-latency",
+        emulated_latency_ms_,
+        "Milliseconds every local storage request is delayed by"
+    )
+    ->group("Local storage")
+    ->check(CLI::NonNegativeNumber)
+    ->capture_default_str();
+
+    app_.add_option(
+        "--emulated-bandwidth",
+        emulated_bandwidth_mib_,
+        "MiB/s local storage transfers are limited to, 0 is unlimited"
+    )
+    ->group("Local storage")
+    ->capture_default_str();
+
+    app_.add_option(
+        "--emulated-error-rate",
+        emulated_error_rate_,
+        "Fraction of local storage requests that fail"
+    )
+    ->group("Local storage")
+    ->check(CLI::Range(0.0, 1.0))
+    ->capture_default_str();
+
     app_.allow_extras();
 }
 
-std::tuple<int, char**, std::string> fes::FuseArgsParser::Parse(int argc, char **argv) {
+fes::ParsedArgs fes::FuseArgsParser::Parse(int argc, char **argv) {
     try {
         app_.parse(argc, argv);
     } catch(const CLI::ParseError &e) {
@@ -39,20 +285,72 @@ std::tuple<int, char**, std::string> fes::FuseArgsParser::Parse(int argc, char *
 
     int new_argc;
     char** new_argv;
-    filter_mount_point_args(argc, argv, new_argc, new_argv);
+    filter_own_args(argc, argv, new_argc, new_argv);
 
     mount_point_ = std::filesystem::canonical(mount_point_);
 
-    return std::make_tuple(new_argc, new_argv, mount_point_);
+    std::vector<std::pair<std::string, int64_t>> extra_bots;
+    for (const auto& bot : extra_bots_) {
+        const size_t separator = bot.rfind('@');
+        extra_bots.emplace_back(bot.substr(0, separator), std::stoll(bot.substr(separator + 1)));
+    }
+
+    return ParsedArgs{
+        .fuse_argc = new_argc,
+        .fuse_argv = new_argv,
+        .mount_point = mount_point_,
+        .inode_frontend = frontend_ == "inode",
+        .entry_timeout = entry_timeout_,
+        .attr_timeout = attr_timeout_,
+        .page_cache = page_cache_,
+        .writeback_cache = writeback_cache_,
+        .max_write_bytes = max_write_kib_ * 1024,
+        .max_readahead_bytes = max_readahead_kib_ * 1024,
+        .async_read = async_read_,
+        .splice = splice_,
+        .log_level = *parseLogLevel(log_level_),
+        .trace_file = trace_file_,
+        .trace_max_spans = trace_max_spans_,
+        .cache_dir = cache_dir_,
+        .cache_size_bytes = cache_size_mib_ * 1024 * 1024,
+        .chunk_size_bytes = chunk_size_mib_ * 1024 * 1024,
+        .compression_level = compression_level_,
+        .prefetch_window = prefetch_window_,
+        .prefetch_budget_bytes = prefetch_budget_mib_ * 1024 * 1024,
+        .journal_max_records = journal_max_records_,
+        .commit_delay_ms = commit_delay_ms_,
+        .commit_max_batch = commit_max_batch_,
+        .upload_workers = upload_workers_,
+        .http_connections = http_connections_,
+        .api_url = api_url_,
+        .extra_bots = std::move(extra_bots),
+        .local_storage_dir = local_storage_dir_,
+        .emulated_latency_ms = emulated_latency_ms_,
+        .emulated_bandwidth_bytes = emulated_bandwidth_mib_ * 1024 * 1024,
+        .emulated_error_rate = emulated_error_rate_,
+    };
 }
 
-void fes::FuseArgsParser::filter_mount_point_args(int argc, char** argv, int& new_argc, char**& new_argv) {
+void fes::FuseArgsParser::filter_own_args(int argc, char** argv, int& new_argc, char**& new_argv) {
     std::vector<char*> filtered_args;
 
     for (int i = 0; i < argc; ++i) {
         if (std::strcmp(argv[i], "-m") == 0 || std::strcmp(argv[i], "--mount-point") == 0) {
-            continue; // Skip only the current argument
+            continue; // Skip only the current argument, libfuse takes the mount point as positional
+        }
+
+        const std::string_view arg = argv[i];
+        const bool is_own_option = std::ranges::any_of(own_value_options_, [&arg](const std::string& option) {
+            return arg == option || arg.starts_with(option + "=");
+        });
+
+        if (is_own_option) {
+            if (arg.find('=') == std::string_view::npos) {
+                ++i; // Skip the value too
+            }
+            continue;
         }
+
         filtered_args.push_back(argv[i]);
     }
 
@@ -1,8 +1,9 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <cstdint>
 #include <string>
-#include <tuple>
+#include <vector>
 
 #include <CLI/CLI.hpp>
 
@@ -14,13 +15,77 @@ class FuseArgsParser final : public ParserInterface {
 public:
     explicit FuseArgsParser(std::string parser_name);
 
-    std::tuple<int, char**, std::string> Parse(int argc, char** argv) override;
+    ParsedArgs Parse(int argc, char** argv) override;
 
 private:
-    static void filter_mount_point_args(int, char**, int&, char**&);
+    static void filter_own_args(int, char**, int&, char**&);
+
+    // Options consumed here together with their value, libfuse never sees them
+    inline static const std::vector<std::string> own_value_options_ = {
+        "--frontend",
+        "--entry-timeout",
+        "--attr-timeout",
+        "--page-cache",
+        "--writeback-cache",
+        "--max-write",
+        "--max-readahead",
+        "--async-read",
+        "--splice",
+        "--log-level",
+        "--trace-file",
+        "--trace-spans",
+        "--cache-dir",
+        "--cache-size",
+        "--chunk-size",
+        "--compress-level",
+        "--prefetch-window",
+        "--prefetch-budget",
+        "--journal-records",
+        "--commit-delay",
+        "--commit-batch",
+        "--upload-workers",
+        "--connections",
+        "--api-url",
+        "--extra-bot",
+        "--local-storage",
+        "--emulated-latency",
+        "--emulated-bandwidth",
+        "--emulated-error-rate",
+    };
 
     CLI::App app_;
     std::string mount_point_;
+    std::string frontend_ = "path";
+    double entry_timeout_ = 1.0;
+    double attr_timeout_ = 1.0;
+    bool page_cache_ = true;
+    bool writeback_cache_ = false;
+    uint32_t max_write_kib_ = 1024;
+    uint32_t max_readahead_kib_ = 1024;
+    bool async_read_ = true;
+    bool splice_ = false;
+    std::string log_level_ = "info";
+    std::string trace_file_;
+    uint64_t trace_max_spans_ = 262144;
+
+    std::string cache_dir_ = std::string(getenv("HOME")) + "/.cache/fuse-external-storage";
+    uint64_t cache_size_mib_ = 1024;
+    uint64_t chunk_size_mib_ = 8;
+    int compression_level_ = 0;
+    uint64_t prefetch_window_ = 2;
+    uint64_t prefetch_budget_mib_ = 64;
+    uint64_t journal_max_records_ = 64;
+    uint64_t commit_delay_ms_ = 1000;
+    uint64_t commit_max_batch_ = 512;
+    uint64_t upload_workers_ = 4;
+    uint64_t http_connections_ = 8;
+    std::string api_url_ = "https://api.telegram.org";
+    std::vector<std::string> extra_bots_;
+
+    std::string local_storage_dir_;
+    double emulated_latency_ms_ = 0;
+    uint64_t emulated_bandwidth_mib_ = 0;
+    double emulated_error_rate_ = 0;
 };
 
 } // fuse_external_storage
@@ -0,0 +1,174 @@
+#include "prefetcher.hpp"
+
+#include <algorithm>
+
+#include "lib/logger/logger.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+ftes::Prefetcher::Prefetcher(PrefetchOptions options,
+                             std::function<bool(int64_t, const RemoteFile&)> fetch,
+                             std::function<bool(int64_t)> is_cached)
+    : options_(options), fetch_(std::move(fetch)), is_cached_(std::move(is_cached))
+{
+}
+
+ftes::Prefetcher::~Prefetcher() {
+    for (auto& worker : workers_) {
+        worker.request_stop();
+    }
+    queue_cv_.notify_all();
+    workers_.clear();
+}
+
+void ftes::Prefetcher::start() {
+    std::lock_guard lock(mutex_);
+
+    if (!workers_.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < options_.workers; ++i) {
+        workers_.emplace_back([this](const std::stop_token& stop_token) { workerLoop(stop_token); });
+    }
+}
+
+void ftes::Prefetcher::onRead(const FileInfo& info, const off_t offset, const size_t size) {
+    // Single-object files are fetched whole by the read itself. Entries
+    // still waiting for their file IDs would need chat writes to resolve
+    if (options_.sequential_window == 0 || info.chunks.empty() || !info.hasRemoteFiles()) {
+        return;
+    }
+
+    const auto end = static_cast<size_t>(offset) + size;
+    size_t run;
+
+    {
+        std::lock_guard lock(mutex_);
+
+        if (streams_.size() >= kMaxStreams && !streams_.contains(info.path)) {
+            streams_.clear();
+        }
+
+        auto& stream = streams_[info.path];
+        stream.run = stream.next_offset == static_cast<size_t>(offset) ? stream.run + 1 : 1;
+        stream.next_offset = end;
+        run = stream.run;
+    }
+
+    if (run < options_.sequential_trigger) {
+        return;
+    }
+
+    // Fetch the chunks following the one the read ended in
+    const size_t current_chunk = (end == 0 ? 0 : end - 1) / info.chunk_size;
+    const size_t last_chunk = std::min(current_chunk + options_.sequential_window, info.chunks.size() - 1);
+
+    for (size_t i = current_chunk + 1; i <= last_chunk; ++i) {
+        enqueue(info.chunks[i], info.chunk_files[i], std::min<uint64_t>(info.chunk_size, info.size - i * info.chunk_size));
+    }
+}
+
+void ftes::Prefetcher::onListDir(const std::vector<FileInfo>& entries) {
+    if (options_.max_directory_files == 0) {
+        return;
+    }
+
+    size_t warmed = 0;
+
+    // A listing is often followed by reading every small file in it
+    for (const auto& entry : entries) {
+        if (entry.is_dir || !entry.hasContent() || !entry.hasRemoteFiles() || entry.size > options_.small_file_bytes) {
+            continue;
+        }
+
+        if (entry.chunks.empty()) {
+            enqueue(entry.message_id, entry.file, entry.size);
+        } else {
+            enqueue(entry.chunks.front(), entry.chunk_files.front(), entry.size);
+        }
+
+        if (++warmed == options_.max_directory_files) {
+            break;
+        }
+    }
+}
+
+void ftes::Prefetcher::onObjectAccess(const int64_t message_id) {
+    std::lock_guard lock(mutex_);
+
+    if (prefetched_.erase(message_id) > 0) {
+        ++stats_.useful;
+    }
+}
+
+ftes::Prefetcher::Stats ftes::Prefetcher::stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+void ftes::Prefetcher::enqueue(const int64_t message_id, const RemoteFile& file, const uint64_t size) {
+    if (is_cached_(message_id)) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+
+        if (in_flight_.contains(message_id)) {
+            return;
+        }
+
+        if (in_flight_.size() >= options_.max_in_flight || in_flight_bytes_ + size > options_.max_in_flight_bytes) {
+            ++stats_.dropped;
+            return;
+        }
+
+        in_flight_.insert(message_id);
+        in_flight_bytes_ += size;
+        queue_.push_back({message_id, file, size});
+        ++stats_.issued;
+    }
+
+    queue_cv_.notify_one();
+}
+
+void ftes::Prefetcher::workerLoop(const std::stop_token& stop_token) {
+    while (true) {
+        Task task;
+
+        {
+            std::unique_lock lock(mutex_);
+
+            if (!queue_cv_.wait(lock, stop_token, [this] { return !queue_.empty(); })) {
+                return;
+            }
+
+            task = queue_.front();
+            queue_.pop_front();
+        }
+
+        bool fetched = false;
+        try {
+            fetched = fetch_(task.message_id, task.file);
+        } catch (const std::exception& e) {
+            FES_LOG(kError) << "[Prefetcher] Error fetching " << task.message_id << ": " << e.what();
+        }
+
+        std::lock_guard lock(mutex_);
+
+        in_flight_.erase(task.message_id);
+        in_flight_bytes_ -= task.size;
+
+        if (fetched) {
+            ++stats_.completed;
+
+            if (prefetched_.size() >= kMaxStreams) {
+                prefetched_.clear();
+            }
+            prefetched_.insert(task.message_id);
+        } else {
+            ++stats_.failed;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef PREFETCHER_HPP
+#define PREFETCHER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "lib/telegram-api/telegram-api.hpp"
+
+namespace fuse_telegram_external_storage {
+
+    struct PrefetchOptions {
+        // Chunks fetched ahead of a sequential reader, 0 disables prefetching
+        size_t sequential_window = 2;
+
+        // Consecutive reads needed before a stream counts as sequential
+        size_t sequential_trigger = 2;
+
+        // Files up to this size are warmed when their directory is listed
+        uint64_t small_file_bytes = 256ULL << 10;
+        size_t max_directory_files = 16;
+
+        // Limits on queued plus running prefetches
+        size_t max_in_flight = 8;
+        uint64_t max_in_flight_bytes = 64ULL << 20;
+
+        size_t workers = 2;
+    };
+
+    // Watches the read and readdir stream and fetches objects into the local
+    // cache in the background before they are asked for
+    class Prefetcher {
+    public:
+        struct Stats {
+            uint64_t issued = 0;
+            uint64_t completed = 0;
+            uint64_t failed = 0;
+            uint64_t dropped = 0; // over the in-flight limits
+            uint64_t useful = 0;  // prefetched and later read
+        };
+
+        // fetch downloads one object into the cache, is_cached skips objects that are already there
+        Prefetcher(PrefetchOptions options,
+                   std::function<bool(int64_t, const RemoteFile&)> fetch,
+                   std::function<bool(int64_t)> is_cached);
+        ~Prefetcher();
+
+        Prefetcher(const Prefetcher&) = delete;
+        Prefetcher& operator=(const Prefetcher&) = delete;
+
+        // Starts the workers, once the process won't fork anymore. Prefetches
+        // requested before wait in the queue
+        void start();
+
+        // Feed a foreground read of [offset, offset + size)
+        void onRead(const FileInfo& info, off_t offset, size_t size);
+
+        // Feed the entries of a just listed directory
+        void onListDir(const std::vector<FileInfo>& entries);
+
+        // Feed every object a foreground read touches, used for the accuracy counters
+        void onObjectAccess(int64_t message_id);
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct Task {
+            int64_t message_id;
+            RemoteFile file;
+            uint64_t size;
+        };
+
+        struct Stream {
+            size_t next_offset = 0;
+            size_t run = 0;
+        };
+
+        // Number of tracked files before the stream table is reset
+        static constexpr size_t kMaxStreams = 1024;
+
+        void enqueue(int64_t message_id, const RemoteFile& file, uint64_t size);
+        void workerLoop(const std::stop_token& stop_token);
+
+        PrefetchOptions options_;
+        std::function<bool(int64_t, const RemoteFile&)> fetch_;
+        std::function<bool(int64_t)> is_cached_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable_any queue_cv_;
+        std::deque<Task> queue_;
+        std::unordered_set<int64_t> in_flight_;
+        uint64_t in_flight_bytes_ = 0;
+
+        std::unordered_map<std::string, Stream> streams_;
+        std::unordered_set<int64_t> prefetched_;
+
+        Stats stats_;
+
+        std::vector<std::jthread> workers_;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //PREFETCHER_HPP
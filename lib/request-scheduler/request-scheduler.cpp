@@ -0,0 +1,142 @@
+#include "request-scheduler.hpp"
+
+#include <algorithm>
+
+namespace ftes = fuse_telegram_external_storage;
+
+thread_local ftes::RequestPriority ftes::RequestScheduler::current_priority_ = RequestPriority::kForeground;
+
+ftes::RequestScheduler::RequestScheduler(const RequestSchedulerOptions options) : options_(options) {
+    const auto now = Clock::now();
+
+    requests_ = {options_.requests_per_second, std::max(options_.request_burst, 1.0),
+                 std::max(options_.request_burst, 1.0), now, now};
+    chat_messages_ = {options_.chat_messages_per_second, std::max(options_.chat_message_burst, 1.0),
+                      std::max(options_.chat_message_burst, 1.0), now, now};
+
+    // Background requests would never get a token otherwise
+    options_.foreground_reserve = std::clamp(options_.foreground_reserve, 0.0, requests_.capacity - 1);
+}
+
+void ftes::RequestScheduler::acquire(const RequestPriority priority, const bool chat_message) {
+    const auto index = static_cast<size_t>(priority);
+    const double wanted = 1 + (priority == RequestPriority::kForeground ? 0 : options_.foreground_reserve);
+    const auto started = Clock::now();
+    bool delayed = false;
+
+    std::unique_lock lock(mutex_);
+
+    auto& waiting = chat_message ? waiting_chat_ : waiting_;
+    ++waiting[index];
+
+    while (true) {
+        const auto now = Clock::now();
+        requests_.refill(now);
+        chat_messages_.refill(now);
+
+        if (higherPriorityWaiting(index, chat_message)) {
+            // Woken when one of them got its token
+            delayed = true;
+            cv_.wait(lock);
+            continue;
+        }
+
+        auto ready = requests_.readyAt(wanted, now);
+        if (chat_message) {
+            ready = std::max(ready, chat_messages_.readyAt(1, now));
+        }
+
+        if (ready <= now) {
+            break;
+        }
+
+        delayed = true;
+        cv_.wait_until(lock, ready);
+    }
+
+    requests_.tokens -= 1;
+    if (chat_message) {
+        chat_messages_.tokens -= 1;
+    }
+
+    --waiting[index];
+
+    ++stats_.requests[index];
+    stats_.delayed[index] += delayed ? 1 : 0;
+    stats_.waited[index] += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+
+    lock.unlock();
+    cv_.notify_all();
+}
+
+void ftes::RequestScheduler::backoff(const std::chrono::milliseconds delay, const bool chat_message) {
+    {
+        std::lock_guard lock(mutex_);
+
+        const auto now = Clock::now();
+        Bucket& bucket = chat_message ? chat_messages_ : requests_;
+
+        // Nothing accrues while blocked, afterwards the bucket starts nearly empty
+        // instead of bursting into the limit again
+        bucket.refill(now);
+        bucket.blocked_until = std::max(bucket.blocked_until, now + delay);
+        bucket.tokens = std::min(bucket.tokens, 1.0);
+        bucket.refilled = bucket.blocked_until;
+
+        ++stats_.backoffs;
+    }
+
+    cv_.notify_all();
+}
+
+ftes::RequestScheduler::Stats ftes::RequestScheduler::stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+ftes::RequestScheduler::PriorityScope::PriorityScope(const RequestPriority priority) : previous_(current_priority_) {
+    current_priority_ = priority;
+}
+
+ftes::RequestScheduler::PriorityScope::~PriorityScope() {
+    current_priority_ = previous_;
+}
+
+ftes::RequestPriority ftes::RequestScheduler::currentPriority() {
+    return current_priority_;
+}
+
+void ftes::RequestScheduler::Bucket::refill(const Clock::time_point now) {
+    if (now <= refilled) {
+        return;
+    }
+
+    tokens = std::min(capacity, tokens + rate * std::chrono::duration<double>(now - refilled).count());
+    refilled = now;
+}
+
+ftes::RequestScheduler::Clock::time_point ftes::RequestScheduler::Bucket::readyAt(const double wanted,
+                                                                                   const Clock::time_point now) const {
+    if (tokens >= wanted) {
+        return std::max(now, blocked_until);
+    }
+
+    // A zero rate disables the limit rather than blocking forever
+    if (rate <= 0) {
+        return std::max(now, blocked_until);
+    }
+
+    const auto missing = std::chrono::duration<double>((wanted - tokens) / rate);
+    return std::max(now, refilled) + std::chrono::duration_cast<Clock::duration>(missing);
+}
+
+bool ftes::RequestScheduler::higherPriorityWaiting(const size_t priority, const bool chat_message) const {
+    for (size_t higher = 0; higher < priority; ++higher) {
+        // Everyone needs a request token, only chat messages compete for the chat bucket
+        if (waiting_[higher] > 0 || (chat_message && waiting_chat_[higher] > 0)) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,116 @@
+#ifndef REQUEST_SCHEDULER_HPP
+#define REQUEST_SCHEDULER_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace fuse_telegram_external_storage {
+
+    // Who a request is made for, most urgent first
+    enum class RequestPriority : uint8_t {
+        kForeground = 0, // FUSE operations a process is blocked on
+        kMetadata,       // batched metadata commits
+        kUpload,         // background uploads of stored files
+        kBackground,     // prefetching
+    };
+
+    inline constexpr size_t kRequestPriorities = 4;
+
+    struct RequestSchedulerOptions {
+        // Bot API calls of any kind
+        double requests_per_second = 30;
+        double request_burst = 30;
+
+        // Messages sent to or edited in the storage chat, the Bot API allows
+        // about one per second per chat with short bursts
+        double chat_messages_per_second = 1;
+        double chat_message_burst = 20;
+
+        // Request tokens only foreground requests may take, so bulk traffic
+        // can't leave an interactive ls or cat waiting for the bucket to refill
+        double foreground_reserve = 5;
+    };
+
+    // Token buckets shared by every thread talking to the Bot API. Waiting
+    // requests are let through highest priority first, and a rate limit
+    // response pauses everyone for the time the server asked for
+    class RequestScheduler {
+    public:
+        struct Stats {
+            std::array<uint64_t, kRequestPriorities> requests = {};
+            std::array<uint64_t, kRequestPriorities> delayed = {}; // requests that had to wait for a token
+            std::array<std::chrono::microseconds, kRequestPriorities> waited = {};
+            uint64_t backoffs = 0;
+        };
+
+        explicit RequestScheduler(RequestSchedulerOptions options = {});
+
+        RequestScheduler(const RequestScheduler&) = delete;
+        RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+        // Blocks until a request of this priority may be sent. Chat messages
+        // take a token from both buckets
+        void acquire(RequestPriority priority, bool chat_message);
+
+        // The server answered 429, nothing (or no chat message) goes out for delay
+        void backoff(std::chrono::milliseconds delay, bool chat_message);
+
+        [[nodiscard]] Stats stats() const;
+
+        // Priority of the requests the current thread makes while it lives,
+        // threads without one make foreground requests
+        class PriorityScope {
+        public:
+            explicit PriorityScope(RequestPriority priority);
+            ~PriorityScope();
+
+            PriorityScope(const PriorityScope&) = delete;
+            PriorityScope& operator=(const PriorityScope&) = delete;
+
+        private:
+            RequestPriority previous_;
+        };
+
+        static RequestPriority currentPriority();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Bucket {
+            double rate;
+            double capacity;
+            double tokens;
+            Clock::time_point refilled;
+            Clock::time_point blocked_until;
+
+            void refill(Clock::time_point now);
+
+            // When the bucket will hold this many tokens
+            [[nodiscard]] Clock::time_point readyAt(double wanted, Clock::time_point now) const;
+        };
+
+        [[nodiscard]] bool higherPriorityWaiting(size_t priority, bool chat_message) const;
+
+        RequestSchedulerOptions options_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+
+        Bucket requests_;
+        Bucket chat_messages_;
+
+        // Requests waiting for a token, by priority and by the bucket they need
+        std::array<size_t, kRequestPriorities> waiting_ = {};
+        std::array<size_t, kRequestPriorities> waiting_chat_ = {};
+
+        Stats stats_;
+
+        static thread_local RequestPriority current_priority_;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //REQUEST_SCHEDULER_HPP
@@ -0,0 +1,325 @@
+#include "span-tracer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lib/logger/logger.hpp"
+
+namespace fes = fuse_external_storage;
+
+namespace {
+
+    struct Span {
+        const char* category;
+        int64_t start_us;
+        int64_t duration_us;
+        uint32_t thread_id;
+        uint8_t name_length;
+        uint8_t detail_length;
+        char name[fes::TraceSpan::kMaxName];
+        char detail[fes::TraceSpan::kMaxDetail];
+    };
+
+    // The sequence is odd while a span is being written into the slot and
+    // 2 * (index + 1) once span number index is complete, so a dump running
+    // next to the writers can tell torn and overwritten slots apart
+    struct Slot {
+        std::atomic<uint64_t> sequence = 0;
+        Span span;
+    };
+
+    struct Ring {
+        explicit Ring(const size_t capacity) : capacity(capacity), slots(new Slot[capacity]) {}
+
+        const size_t capacity;
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<uint64_t> next = 0;
+    };
+
+    // Never destroyed, spans may still end while statics are torn down
+    Ring* ring = nullptr;
+    fes::TraceOptions trace_options;
+    std::mutex dump_mutex;
+
+    // Written to by the signal handler, read by the dump thread
+    int signal_pipe[2] = {-1, -1};
+    std::once_flag dump_thread_started;
+
+    uint32_t currentThreadId() {
+        thread_local const auto thread_id = static_cast<uint32_t>(syscall(SYS_gettid));
+        return thread_id;
+    }
+
+    // Copies up to capacity bytes without splitting a UTF-8 sequence, the dump must stay valid JSON
+    uint8_t copyTruncated(char* dest, const size_t capacity, std::string_view source) {
+        if (source.size() > capacity) {
+            size_t length = capacity;
+            while (length > 0 && (static_cast<unsigned char>(source[length]) & 0xC0) == 0x80) {
+                --length;
+            }
+            source = source.substr(0, length);
+        }
+
+        std::memcpy(dest, source.data(), source.size());
+        return static_cast<uint8_t>(source.size());
+    }
+
+    void writeJsonString(std::ostream& out, const std::string_view text) {
+        out << '"';
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                out << escaped;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    // Name the kernel has for a thread, empty once it has exited
+    std::string threadName(const uint32_t thread_id) {
+        std::ifstream comm("/proc/self/task/" + std::to_string(thread_id) + "/comm");
+        std::string name;
+        std::getline(comm, name);
+        return name;
+    }
+
+    std::vector<Span> collectSpans() {
+        std::vector<Span> spans;
+        const uint64_t end = ring->next.load(std::memory_order_acquire);
+        const uint64_t begin = end > ring->capacity ? end - ring->capacity : 0;
+        spans.reserve(end - begin);
+
+        for (uint64_t index = begin; index < end; ++index) {
+            const Slot& slot = ring->slots[index % ring->capacity];
+
+            const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before != 2 * (index + 1)) {
+                continue; // Still being written or already overwritten
+            }
+
+            Span span = slot.span;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != before) {
+                continue;
+            }
+
+            spans.push_back(span);
+        }
+
+        // Parents before their children when they start in the same microsecond
+        std::ranges::sort(spans, [](const Span& lhs, const Span& rhs) {
+            if (lhs.start_us != rhs.start_us) {
+                return lhs.start_us < rhs.start_us;
+            }
+            return lhs.duration_us > rhs.duration_us;
+        });
+
+        return spans;
+    }
+
+    void onDumpSignal(int) {
+        const int saved_errno = errno;
+        const char byte = 0;
+        [[maybe_unused]] const ssize_t written = write(signal_pipe[1], &byte, 1);
+        errno = saved_errno;
+    }
+
+    void dumpOnSignal() {
+        char byte;
+        while (true) {
+            const ssize_t received = read(signal_pipe[0], &byte, 1);
+            if (received == 1) {
+                fes::SpanTracer::dump();
+            } else if (received < 0 && errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+} // namespace
+
+void fes::SpanTracer::start(const TraceOptions& options) {
+    if (enabled() || options.output.empty() || options.max_spans == 0) {
+        return;
+    }
+
+    trace_options = options;
+    ring = new Ring(options.max_spans);
+
+    if (pipe(signal_pipe) == 0) {
+        struct sigaction action{};
+        action.sa_handler = onDumpSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR2, &action, nullptr);
+    } else {
+        FES_LOG(kWarning) << "[SpanTracer::start] No signal pipe, spans are only dumped on unmount: "
+                          << std::strerror(errno);
+    }
+
+    enabled_.store(true, std::memory_order_release);
+
+    FES_LOG(kInfo) << "[SpanTracer::start] Recording up to " << options.max_spans << " spans into "
+                   << options.output << ", send SIGUSR2 to dump them";
+}
+
+void fes::SpanTracer::startDumpThread() {
+    if (!enabled() || signal_pipe[0] < 0) {
+        return;
+    }
+
+    // Signals that arrived before wait in the pipe and are dumped right away
+    std::call_once(dump_thread_started, [] { std::thread(dumpOnSignal).detach(); });
+}
+
+bool fes::SpanTracer::dump() {
+    return dump(trace_options.output);
+}
+
+bool fes::SpanTracer::dump(const std::filesystem::path& path) {
+    if (!enabled()) {
+        return false;
+    }
+
+    std::lock_guard lock(dump_mutex);
+
+    const std::vector<Span> spans = collectSpans();
+    const pid_t process_id = getpid();
+
+    // Written next to the target and renamed over it, so a viewer never sees half a dump
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+
+    std::ofstream out(temp_path, std::ios::trunc);
+    if (!out) {
+        FES_LOG(kError) << "[SpanTracer::dump] Failed to open " << temp_path;
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << R"({"ph":"M","name":"process_name","pid":)" << process_id
+        << R"(,"tid":0,"args":{"name":"libfuse-external-storage"}})";
+
+    std::unordered_set<uint32_t> named_threads;
+    for (const Span& span : spans) {
+        if (!named_threads.insert(span.thread_id).second) {
+            continue;
+        }
+
+        const std::string name = threadName(span.thread_id);
+        if (name.empty()) {
+            continue;
+        }
+
+        out << ",\n" << R"({"ph":"M","name":"thread_name","pid":)" << process_id
+            << ",\"tid\":" << span.thread_id << ",\"args\":{\"name\":";
+        writeJsonString(out, name);
+        out << "}}";
+    }
+
+    for (const Span& span : spans) {
+        out << ",\n" << R"({"ph":"X","cat":")" << span.category << "\",\"name\":";
+        writeJsonString(out, {span.name, span.name_length});
+        out << ",\"ts\":" << span.start_us << ",\"dur\":" << span.duration_us
+            << ",\"pid\":" << process_id << ",\"tid\":" << span.thread_id;
+
+        if (span.detail_length > 0) {
+            out << ",\"args\":{\"detail\":";
+            writeJsonString(out, {span.detail, span.detail_length});
+            out << '}';
+        }
+
+        out << '}';
+    }
+
+    out << "\n]}\n";
+    out.close();
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (!out || error) {
+        FES_LOG(kError) << "[SpanTracer::dump] Failed to write " << path;
+        return false;
+    }
+
+    FES_LOG(kInfo) << "[SpanTracer::dump] Wrote " << spans.size() << " spans to " << path;
+    return true;
+}
+
+int64_t fes::SpanTracer::nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+void fes::SpanTracer::record(const char* category, const std::string_view name, const std::string_view detail,
+                             const int64_t start_us, const int64_t end_us) {
+    const uint64_t index = ring->next.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring->slots[index % ring->capacity];
+
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Span& span = slot.span;
+    span.category = category;
+    span.start_us = start_us;
+    span.duration_us = end_us - start_us;
+    span.thread_id = currentThreadId();
+    span.name_length = copyTruncated(span.name, sizeof(span.name), name);
+    span.detail_length = copyTruncated(span.detail, sizeof(span.detail), detail);
+
+    slot.sequence.store(2 * (index + 1), std::memory_order_release);
+}
+
+fes::TraceSpan::TraceSpan(const char* category, const std::string_view name, const std::string_view detail)
+    : category_(category)
+{
+    if (!SpanTracer::enabled()) {
+        return;
+    }
+
+    name_length_ = copyTruncated(name_, sizeof(name_), name);
+    detail_length_ = copyTruncated(detail_, sizeof(detail_), detail);
+    start_us_ = SpanTracer::nowMicros();
+}
+
+fes::TraceSpan::TraceSpan(const char* category, const std::string_view name, const int64_t id)
+    : category_(category)
+{
+    if (!SpanTracer::enabled()) {
+        return;
+    }
+
+    name_length_ = copyTruncated(name_, sizeof(name_), name);
+    detail_length_ = static_cast<uint8_t>(std::to_chars(detail_, detail_ + sizeof(detail_), id).ptr - detail_);
+    start_us_ = SpanTracer::nowMicros();
+}
+
+fes::TraceSpan::~TraceSpan() {
+    if (start_us_ < 0) {
+        return;
+    }
+
+    SpanTracer::record(category_, {name_, name_length_}, {detail_, detail_length_}, start_us_, SpanTracer::nowMicros());
+}
@@ -0,0 +1,80 @@
+#ifndef SPAN_TRACER_HPP
+#define SPAN_TRACER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+namespace fuse_external_storage {
+
+    struct TraceOptions {
+        // Where the Chrome Trace Event JSON is written on SIGUSR2 and on unmount
+        std::filesystem::path output;
+
+        // Spans kept in memory, the oldest are overwritten once it is full
+        size_t max_spans = 262144;
+    };
+
+    // Records finished spans with the thread and time they ran on into one
+    // bounded ring shared by all threads. Spans of a thread that overlap in
+    // time show up nested when the dump is opened in Perfetto or chrome://tracing
+    class SpanTracer {
+    public:
+        // Starts recording and catching SIGUSR2. Dumps to options.output
+        // happen once startDumpThread() has run
+        static void start(const TraceOptions& options);
+
+        // Starts the thread that dumps on SIGUSR2, once the process won't
+        // fork anymore. Does nothing when tracing is off or already started
+        static void startDumpThread();
+
+        [[nodiscard]] static bool enabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        // Writes the spans currently in the ring to the output given to start().
+        // Returns false when tracing is off or the file can't be written
+        static bool dump();
+        static bool dump(const std::filesystem::path& path);
+
+    private:
+        friend class TraceSpan;
+
+        static int64_t nowMicros();
+        static void record(const char* category, std::string_view name, std::string_view detail,
+                           int64_t start_us, int64_t end_us);
+
+        // Set once by start(), read on every span
+        inline static std::atomic<bool> enabled_ = false;
+    };
+
+    // One span, recorded when it goes out of scope. Does nothing but a relaxed
+    // load when tracing is off. Name and detail are copied, so temporaries are fine
+    class TraceSpan {
+    public:
+        static constexpr size_t kMaxName = 40;
+        static constexpr size_t kMaxDetail = 112;
+
+        TraceSpan(const char* category, std::string_view name, std::string_view detail = {});
+
+        // Detail is a message or object ID, only formatted when tracing is on
+        TraceSpan(const char* category, std::string_view name, int64_t id);
+        ~TraceSpan();
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        const char* category_;
+        int64_t start_us_ = -1;
+        uint8_t name_length_ = 0;
+        uint8_t detail_length_ = 0;
+        char name_[kMaxName];
+        char detail_[kMaxDetail];
+    };
+
+} // namespace fuse_external_storage
+
+#endif // SPAN_TRACER_HPP
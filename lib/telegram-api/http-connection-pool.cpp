@@ -0,0 +1,277 @@
+#include "http-connection-pool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+ftes::HttpConnectionPool::HttpConnectionPool(const size_t size, RequestScheduler* scheduler,
+                                             fuse_external_storage::OperationStats* stats)
+    : scheduler_(scheduler), stats_(stats) {
+    static std::once_flag curl_initialized;
+    std::call_once(curl_initialized, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+    share_ = curl_share_init();
+    if (!share_) {
+        throw std::runtime_error("Failed to create curl share handle");
+    }
+
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockCallback);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockCallback);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    connections_.resize(std::max<size_t>(size, 1));
+
+    for (size_t i = 0; i < connections_.size(); ++i) {
+        connections_[i].handle = curl_easy_init();
+        if (!connections_[i].handle) {
+            throw std::runtime_error("Failed to create curl handle");
+        }
+
+        free_.push_back(i);
+    }
+}
+
+ftes::HttpConnectionPool::~HttpConnectionPool() {
+    for (auto& connection : connections_) {
+        curl_easy_cleanup(connection.handle);
+    }
+
+    curl_share_cleanup(share_);
+}
+
+std::string ftes::HttpConnectionPool::makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const {
+    std::string address = url.protocol + "://" + url.host + url.path;
+    if (args.empty() && !url.query.empty()) {
+        address += "?" + url.query;
+    }
+
+    const std::string_view method = std::string_view(url.path).substr(url.path.rfind('/') + 1);
+
+    // Long polling waits on the server side and isn't counted against the limits
+    const bool scheduled = scheduler_ != nullptr && method != "getUpdates";
+    const bool chat_message = isChatMessage(method);
+
+    // The call span covers the retries, each attempt gets a span of its own
+    fuse_external_storage::TraceSpan call_span("api", method);
+
+    // Retries are part of the call, its latency includes the waits
+    std::optional<fuse_external_storage::OperationStats::Timer> timer;
+    if (stats_) {
+        auto& operation = stats_->operation(method);
+        timer.emplace(operation);
+
+        uint64_t sent = 0;
+        for (const auto& arg : args) {
+            sent += arg.value.size();
+        }
+        operation.bytes_written.fetch_add(sent, std::memory_order_relaxed);
+    }
+
+    // sendDocument with a chunk can take far longer than an API call on a slow link
+    const bool transfer = std::ranges::any_of(args, &TgBot::HttpReqArg::isFile);
+
+    for (size_t attempt = 0;; ++attempt) {
+        if (scheduled) {
+            fuse_external_storage::TraceSpan wait_span("api", "schedulerWait", method);
+            scheduler_->acquire(RequestScheduler::currentPriority(), chat_message);
+        }
+
+        // Bot API errors come with a JSON body TgBot turns into an exception
+        std::string response;
+        {
+            fuse_external_storage::TraceSpan attempt_span("http", method);
+            perform(address, args, [&response](const char* data, const size_t size) {
+                response.append(data, size);
+                return true;
+            }, false, transfer);
+        }
+
+        const auto retry_after = scheduled && attempt < kMaxRateLimitRetries ? retryAfter(response) : std::nullopt;
+        if (!retry_after) {
+            if (stats_) {
+                stats_->operation(method).bytes_read.fetch_add(response.size(), std::memory_order_relaxed);
+                if (!isErrorResponse(response)) {
+                    timer->succeed();
+                }
+            }
+
+            return response;
+        }
+
+        FES_LOG(kWarning) << "[HttpConnectionPool] " << method << " rate limited, retrying in "
+                          << retry_after->count() << "s";
+        scheduler_->backoff(*retry_after, chat_message);
+    }
+}
+
+void ftes::HttpConnectionPool::download(const std::string& url, const Sink& sink) const {
+    // The URL carries the bot token, it stays out of the trace
+    fuse_external_storage::TraceSpan span("http", "download");
+
+    if (!stats_) {
+        perform(url, {}, sink, true, true);
+        return;
+    }
+
+    auto& operation = stats_->operation("download");
+    fuse_external_storage::OperationStats::Timer timer(operation);
+
+    perform(url, {}, [&operation, &sink](const char* data, const size_t size) {
+        operation.bytes_read.fetch_add(size, std::memory_order_relaxed);
+        return sink(data, size);
+    }, true, true);
+
+    timer.succeed();
+}
+
+void ftes::HttpConnectionPool::perform(const std::string& address, const std::vector<TgBot::HttpReqArg>& args,
+                                       const Sink& sink, const bool fail_on_error, const bool transfer) const {
+    size_t index;
+    {
+        fuse_external_storage::TraceSpan wait_span("http", "connectionWait");
+        index = acquire();
+    }
+    CURL* curl = connections_[index].handle;
+
+    // Options are cleared, the connection and the caches survive
+    curl_easy_reset(curl);
+
+    curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+    curl_easy_setopt(curl, CURLOPT_URL, address.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, fail_on_error ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20L);
+
+    if (transfer) {
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, kLowSpeedBytes);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(kLowSpeedTime.count()));
+    } else {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(_timeout));
+    }
+
+    curl_mime* mime = nullptr;
+
+    if (!args.empty()) {
+        mime = curl_mime_init(curl);
+
+        for (const auto& arg : args) {
+            curl_mimepart* part = curl_mime_addpart(mime);
+
+            curl_mime_name(part, arg.name.c_str());
+            curl_mime_data(part, arg.value.data(), arg.value.size());
+            curl_mime_type(part, arg.mimeType.c_str());
+
+            if (arg.isFile) {
+                curl_mime_filename(part, arg.fileName.c_str());
+            }
+        }
+
+        curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const CURLcode result = curl_easy_perform(curl);
+    const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+    curl_mime_free(mime);
+    release(index, result != CURLE_OK, connects == 0, latency);
+
+    if (result != CURLE_OK) {
+        throw TgBot::TgException(std::string("curl error: ") + curl_easy_strerror(result),
+                                 TgBot::TgException::ErrorCode::Internal);
+    }
+}
+
+bool ftes::HttpConnectionPool::isChatMessage(const std::string_view method) {
+    return method.starts_with("send") || method.starts_with("edit") || method == "forwardMessage" ||
+           method == "copyMessage" || method == "pinChatMessage" || method == "unpinChatMessage";
+}
+
+bool ftes::HttpConnectionPool::isErrorResponse(const std::string& response) {
+    // Error bodies are short, successful ones can be long and contain anything
+    return response.size() < 4096 && response.find("\"ok\":false") != std::string::npos;
+}
+
+std::optional<std::chrono::seconds> ftes::HttpConnectionPool::retryAfter(const std::string& response) {
+    // Skips parsing every successful response
+    if (response.find("\"error_code\":429") == std::string::npos) {
+        return std::nullopt;
+    }
+
+    const auto body = nlohmann::json::parse(response, nullptr, false);
+    if (body.is_discarded() || !body.contains("parameters") || !body["parameters"].is_object()) {
+        return std::chrono::seconds(1);
+    }
+
+    return std::chrono::seconds(std::max<int64_t>(body["parameters"].value("retry_after", int64_t{1}), 1));
+}
+
+std::vector<ftes::HttpConnectionPool::ConnectionStats> ftes::HttpConnectionPool::stats() const {
+    std::lock_guard lock(mutex_);
+
+    std::vector<ConnectionStats> result;
+    result.reserve(connections_.size());
+
+    for (const auto& connection : connections_) {
+        result.push_back(connection.stats);
+    }
+
+    return result;
+}
+
+size_t ftes::HttpConnectionPool::acquire() const {
+    std::unique_lock lock(mutex_);
+    free_cv_.wait(lock, [this] { return !free_.empty(); });
+
+    // The most recently used handle is the most likely to still have a live connection
+    const size_t index = free_.back();
+    free_.pop_back();
+
+    return index;
+}
+
+void ftes::HttpConnectionPool::release(const size_t index, const bool failed, const bool reused,
+                                       const std::chrono::microseconds latency) const {
+    {
+        std::lock_guard lock(mutex_);
+
+        auto& stats = connections_[index].stats;
+        ++stats.requests;
+        stats.failures += failed ? 1 : 0;
+        stats.new_connections += reused ? 0 : 1;
+        stats.total_latency += latency;
+        stats.max_latency = std::max(stats.max_latency, latency);
+
+        free_.push_back(index);
+    }
+
+    free_cv_.notify_one();
+}
+
+size_t ftes::HttpConnectionPool::writeCallback(const char* data, const size_t size, const size_t count, void* user_data) {
+    // Anything short of the full size makes curl abort with CURLE_WRITE_ERROR
+    return (*static_cast<const Sink*>(user_data))(data, size * count) ? size * count : 0;
+}
+
+void ftes::HttpConnectionPool::lockCallback(CURL*, const curl_lock_data data, curl_lock_access, void* user_data) {
+    static_cast<HttpConnectionPool*>(user_data)->share_mutexes_[data].lock();
+}
+
+void ftes::HttpConnectionPool::unlockCallback(CURL*, const curl_lock_data data, void* user_data) {
+    static_cast<HttpConnectionPool*>(user_data)->share_mutexes_[data].unlock();
+}
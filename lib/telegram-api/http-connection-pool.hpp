@@ -0,0 +1,106 @@
+#ifndef HTTP_CONNECTION_POOL_HPP
+#define HTTP_CONNECTION_POOL_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <curl/curl.h>
+#include <tgbot/tgbot.h>
+
+#include "lib/operation-stats/operation-stats.hpp"
+#include "lib/request-scheduler/request-scheduler.hpp"
+
+namespace fuse_telegram_external_storage {
+
+    // HTTP client for TgBot that keeps a fixed set of libcurl easy handles
+    // alive between requests. Connections, DNS results and TLS sessions are
+    // shared between the handles, so requests from any thread reuse them
+    // instead of paying for a new TCP and TLS handshake every time. With a
+    // scheduler, Bot API calls wait for it and rate limited ones are retried.
+    // With stats, calls are recorded by Bot API method, file downloads as "download"
+    class HttpConnectionPool final : public TgBot::HttpClient {
+    public:
+        struct ConnectionStats {
+            uint64_t requests = 0;
+            uint64_t failures = 0;
+            uint64_t new_connections = 0; // requests that couldn't reuse an open connection
+            std::chrono::microseconds total_latency{0};
+            std::chrono::microseconds max_latency{0};
+        };
+
+        // Receives a response body piece by piece, returning false aborts the
+        // transfer. Called from inside libcurl, so it must not throw
+        using Sink = std::function<bool(const char* data, size_t size)>;
+
+        explicit HttpConnectionPool(size_t size, RequestScheduler* scheduler = nullptr,
+                                    fuse_external_storage::OperationStats* stats = nullptr);
+        ~HttpConnectionPool() override;
+
+        HttpConnectionPool(const HttpConnectionPool&) = delete;
+        HttpConnectionPool& operator=(const HttpConnectionPool&) = delete;
+
+        // Blocks until the scheduler lets the call through and one of the handles is free
+        std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override;
+
+        // GET url and hand the body to sink as it arrives, without buffering
+        // it. Error statuses throw before anything reaches the sink
+        void download(const std::string& url, const Sink& sink) const;
+
+        // One entry per handle
+        [[nodiscard]] std::vector<ConnectionStats> stats() const;
+
+    private:
+        struct Connection {
+            CURL* handle = nullptr;
+            ConnectionStats stats;
+        };
+
+        // Transfers of file content have no total timeout, they only fail once
+        // they move less than kLowSpeedBytes a second for kLowSpeedTime
+        void perform(const std::string& address, const std::vector<TgBot::HttpReqArg>& args,
+                     const Sink& sink, bool fail_on_error, bool transfer) const;
+
+        static constexpr long kLowSpeedBytes = 1024;
+        static constexpr std::chrono::seconds kLowSpeedTime{60};
+
+        // Bot API methods that post to or edit the chat, they have a rate limit of their own
+        static bool isChatMessage(std::string_view method);
+
+        // retry_after of a 429 response, nothing for any other response
+        static std::optional<std::chrono::seconds> retryAfter(const std::string& response);
+
+        static constexpr size_t kMaxRateLimitRetries = 5;
+
+        // Bot API answers with "ok": false, TgBot only turns them into exceptions later
+        static bool isErrorResponse(const std::string& response);
+
+        size_t acquire() const;
+        void release(size_t index, bool failed, bool reused, std::chrono::microseconds latency) const;
+
+        static size_t writeCallback(const char* data, size_t size, size_t count, void* user_data);
+        static void lockCallback(CURL*, curl_lock_data data, curl_lock_access, void* user_data);
+        static void unlockCallback(CURL*, curl_lock_data data, void* user_data);
+
+        RequestScheduler* scheduler_;
+        fuse_external_storage::OperationStats* stats_;
+
+        CURLSH* share_ = nullptr;
+        std::array<std::mutex, CURL_LOCK_DATA_LAST> share_mutexes_;
+
+        mutable std::mutex mutex_;
+        mutable std::condition_variable free_cv_;
+        mutable std::vector<Connection> connections_;
+        mutable std::vector<size_t> free_;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //HTTP_CONNECTION_POOL_HPP
@@ -1,12 +1,24 @@
 #include "telegram-api.hpp"
 
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include <utility>
 
+#include "lib/logger/logger.hpp"
+#include "lib/metadata-codec/metadata-codec.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
 namespace ftes = fuse_telegram_external_storage;
 using json = nlohmann::json;
 
-ftes::TelegramApiFacade::TelegramApiFacade(std::string api_token)
-    : api_token_(std::move(api_token)), bot_(api_token_)
+ftes::TelegramApiFacade::TelegramApiFacade(std::string api_token, const TelegramApiOptions& options)
+    : api_token_(std::move(api_token)),
+      api_url_(options.api_url),
+      scheduler_(options.scheduling),
+      http_client_(options.connections, &scheduler_, &request_stats_),
+      bot_(api_token_, http_client_, api_url_),
+      chat_id_(options.chat_id)
 {
     // Set up the bot with the provided API token and add start command handler
     bot_.getEvents().onCommand("start", [this](const TgBot::Message::Ptr& message) { // TODO: Add authentication
@@ -29,15 +41,18 @@ ftes::TelegramApiFacade::TelegramApiFacade(std::string api_token)
         }
     });
 
-    // Initialize metadata message ID
+    // Initialize metadata message ID without downloading the document itself,
+    // the storage layer loads its index once right after construction
     try {
-        auto metadata = getMetadata();
+        metadata_message_id_ = getPinnedRevision().message_id;
 
-        if (!metadata.is_null()) {
+        if (metadata_message_id_ == 0) {
             std::ifstream metadata_file(metadata_message_file_, std::ios::in);
 
             if (metadata_file) {
-                metadata_file >> metadata_message_id_;
+                int64_t saved_message_id = 0;
+                metadata_file >> saved_message_id;
+                metadata_message_id_ = saved_message_id;
                 metadata_file.close();
             }
         }
@@ -46,72 +61,147 @@ ftes::TelegramApiFacade::TelegramApiFacade(std::string api_token)
     }
 }
 
-int64_t ftes::TelegramApiFacade::sendFile(const std::filesystem::path& path, const std::string& file_name) const {
+std::pair<int64_t, ftes::RemoteFile> ftes::TelegramApiFacade::sendFile(const std::filesystem::path& path, const std::string& file_name) const {
+    fuse_external_storage::TraceSpan span("api", "sendFile", file_name);
+
     int64_t chat_id = getChatId();
     if (chat_id == 0) {
         throw std::runtime_error("Chat ID not set");
     }
 
     TgBot::InputFile::Ptr input_file = TgBot::InputFile::fromFile(path.string(), "application/octet-stream");
-    const auto message = bot_.getApi().sendDocument(chat_id, input_file, file_name);
+    input_file->fileName = file_name;
+
+    // The third parameter is the thumbnail, the name goes with the file
+    const auto message = bot_.getApi().sendDocument(chat_id, input_file);
+
+    if (!message->document) {
+        return {message->messageId, {}};
+    }
 
-    return message->messageId;
+    return {message->messageId, {message->document->fileId, message->document->fileUniqueId}};
 }
 
-bool ftes::TelegramApiFacade::downloadFile(int64_t message_id, const std::filesystem::path& dest_path) const {
-    int64_t chat_id = getChatId();
-    if (chat_id == 0) {
+bool ftes::TelegramApiFacade::downloadFile(const RemoteFile& file, const DownloadSink& sink) const {
+    fuse_external_storage::TraceSpan span("api", "downloadFile", file.file_unique_id);
+
+    if (file.empty()) {
         return false;
     }
 
     try {
-        // Try to get the message directly by ID
-        TgBot::Message::Ptr message;
-        try {
-            message = bot_.getApi().forwardMessage(chat_id, chat_id, static_cast<int>(message_id), false);
-            // Delete the forwarded message as we don't need it
-            bot_.getApi().deleteMessage(chat_id, message->messageId);
-        } catch (const TgBot::TgException& e) {
-            std::cerr << "Could not forward message: " << e.what() << std::endl;
-            // Fall back to searching in updates
-            auto updates = bot_.getApi().getUpdates(0, 100);
-            for (const auto& update : updates) {
-                if (update->message && update->message->messageId == message_id && update->message->document) {
-                    message = update->message;
-                    break;
+        downloadFileId(file.file_id, sink);
+        return true;
+    } catch (const TgBot::TgException& e) {
+        FES_LOG(kError) << "Error downloading file: " << e.what();
+        return false;
+    }
+}
+
+bool ftes::TelegramApiFacade::downloadFile(const RemoteFile& file, const std::filesystem::path& dest_path) const {
+    const int fd = open(dest_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        FES_LOG(kError) << "Failed to open destination file: " << dest_path.c_str();
+        return false;
+    }
+
+    // Bytes go from the socket to the file without being collected in memory first
+    const bool downloaded = downloadFile(file, [fd](const char* data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
                 }
+                return false;
             }
+
+            data += written;
+            size -= written;
         }
 
-        if (!message || !message->document) {
-            // If we still don't have the message or it has no document, try to get message history
-            std::cerr << "File not found for message ID: " << message_id << std::endl;
-            return false;
+        return true;
+    });
+
+    return close(fd) == 0 && downloaded;
+}
+
+std::optional<ftes::RemoteFile> ftes::TelegramApiFacade::resolveMessage(const int64_t message_id) const {
+    fuse_external_storage::TraceSpan span("api", "resolveMessage", message_id);
+
+    int64_t chat_id = getChatId();
+    if (chat_id == 0) {
+        return std::nullopt;
+    }
+
+    try {
+        const auto message = bot_.getApi().forwardMessage(chat_id, chat_id, static_cast<int>(message_id), true);
+        bot_.getApi().deleteMessage(chat_id, message->messageId);
+
+        if (!message->document) {
+            FES_LOG(kWarning) << "File not found for message ID: " << message_id;
+            return std::nullopt;
         }
 
-        // Get file path from Telegram
-        std::string file_id = message->document->fileId;
-        auto file = bot_.getApi().getFile(file_id);
+        return RemoteFile{message->document->fileId, message->document->fileUniqueId};
+    } catch (const TgBot::TgException& e) {
+        FES_LOG(kWarning) << "Could not resolve message " << message_id << ": " << e.what();
+        return std::nullopt;
+    }
+}
 
-        // Download file content as string
-        std::string file_content = bot_.getApi().downloadFile(file->filePath);
+void ftes::TelegramApiFacade::downloadFileId(const std::string& file_id, const DownloadSink& sink) const {
+    size_t delivered = 0;
+    const auto counting_sink = [&sink, &delivered](const char* data, const size_t size) {
+        delivered += size;
+        return sink(data, size);
+    };
 
-        // Write content to destination file
-        std::ofstream ofs(dest_path, std::ios::binary);
+    try {
+        http_client_.download(api_url_ + "/file/bot" + api_token_ + "/" + resolveFilePath(file_id), counting_sink);
+    } catch (const TgBot::TgException&) {
+        // A cached path may have expired early, retry once with a fresh one
+        // unless part of the body already reached the sink
+        forgetFilePath(file_id);
+        if (delivered > 0) {
+            throw;
+        }
 
-        if (!ofs) {
-            std::cerr << "Failed to open destination file: " << dest_path.c_str() << std::endl;
-            return false;
+        http_client_.download(api_url_ + "/file/bot" + api_token_ + "/" + resolveFilePath(file_id), counting_sink);
+    }
+}
+
+std::string ftes::TelegramApiFacade::resolveFilePath(const std::string& file_id) const {
+    const auto now = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard lock(file_paths_mutex_);
+
+        if (const auto it = file_paths_.find(file_id); it != file_paths_.end() && it->second.expires > now) {
+            return it->second.file_path;
         }
+    }
 
-        ofs.write(file_content.data(), static_cast<std::streamsize>(file_content.size()));
-        ofs.close();
+    std::string file_path = bot_.getApi().getFile(file_id)->filePath;
 
-        return true;
-    } catch (const TgBot::TgException& e) {
-        std::cerr << "Error downloading file: " << e.what() << std::endl;
-        return false;
+    std::lock_guard lock(file_paths_mutex_);
+
+    if (file_paths_.size() >= kMaxCachedFilePaths) {
+        std::erase_if(file_paths_, [now](const auto& entry) { return entry.second.expires <= now; });
+
+        if (file_paths_.size() >= kMaxCachedFilePaths) {
+            file_paths_.clear();
+        }
     }
+
+    file_paths_.insert_or_assign(file_id, CachedFilePath{file_path, now + kFilePathTtl});
+    return file_path;
+}
+
+void ftes::TelegramApiFacade::forgetFilePath(const std::string& file_id) const {
+    std::lock_guard lock(file_paths_mutex_);
+    file_paths_.erase(file_id);
 }
 
 bool ftes::TelegramApiFacade::deleteMessage(const int64_t message_id) const {
@@ -123,40 +213,35 @@ bool ftes::TelegramApiFacade::deleteMessage(const int64_t message_id) const {
     try {
         return bot_.getApi().deleteMessage(chat_id, static_cast<int>(message_id));
     } catch (const TgBot::TgException& e) {
-        printf("Error deleting message: %s\n", e.what());
+        FES_LOG(kError) << "Error deleting message: " << e.what();
         return false;
     }
 }
 
 // In telegram-api.cpp, rewrite the updateMetadata method:
 int64_t ftes::TelegramApiFacade::updateMetadata(const nlohmann::json& metadata) const {
+    fuse_external_storage::TraceSpan span("metadata", "updateMetadata");
+
     int64_t chat_id = getChatId();
     if (chat_id == 0) {
         throw std::runtime_error("Chat ID not set");
     }
 
-    const std::string metadata_str = metadata.dump();
-
-    // Create a temporary file for the metadata
-    std::string temp_file = "/tmp/fuse_telegram_metadata_" + std::to_string(time(nullptr));
-    std::ofstream ofs(temp_file);
-    if (!ofs) {
-        throw std::runtime_error("Failed to create temporary metadata file");
-    }
-    ofs << metadata_str;
-    ofs.close();
+    // Sent straight from memory, with a fixed name for easy identification
+    auto input_file = std::make_shared<TgBot::InputFile>();
+    input_file->data = MetadataCodec::encode(metadata);
+    input_file->mimeType = "application/octet-stream";
+    input_file->fileName = "metadata.fesm";
 
     try {
-        // Send metadata as a document with fixed name for easy identification
-        TgBot::InputFile::Ptr input_file = TgBot::InputFile::fromFile(temp_file, "application/json");
-        const auto message = bot_.getApi().sendDocument(chat_id, input_file, "metadata.json");
+        const auto message = bot_.getApi().sendDocument(chat_id, input_file);
         const int64_t new_message_id = message->messageId;
 
         // Try to pin the new metadata message and handle errors
         try {
             bot_.getApi().pinChatMessage(chat_id, static_cast<int>(new_message_id), true);
         } catch (const TgBot::TgException& e) {
-            printf("Warning: could not pin metadata message: %s\n", e.what());
+            FES_LOG(kWarning) << "Could not pin metadata message: " << e.what();
             // Continue despite pin error
         }
 
@@ -172,33 +257,43 @@ int64_t ftes::TelegramApiFacade::updateMetadata(const nlohmann::json& metadata)
             try {
                 bot_.getApi().unpinChatMessage(chat_id, static_cast<int>(metadata_message_id_));
             } catch (const TgBot::TgException& e) {
-                printf("Warning: could not unpin old metadata message: %s\n", e.what());
+                FES_LOG(kWarning) << "Could not unpin old metadata message: " << e.what();
                 // Continue despite unpin error
             }
 
             try {
                 bot_.getApi().deleteMessage(chat_id, static_cast<int>(metadata_message_id_));
             } catch (const TgBot::TgException& e) {
-                printf("Warning: could not delete old metadata message: %s\n", e.what());
+                FES_LOG(kWarning) << "Could not delete old metadata message: " << e.what();
                 // Continue despite delete error
             }
         }
 
-        // Update the metadata message ID
-        metadata_message_id_ = new_message_id;
+        // Update the metadata message ID and drop the journal the new snapshot already contains
+        std::vector<int64_t> old_journal;
+        {
+            std::lock_guard lock(journal_mutex_);
+            metadata_message_id_ = new_message_id;
+            old_journal.swap(journal_message_ids_);
+            journal_file_id_.clear();
+            journal_records_.clear();
+        }
+
+        for (const int64_t journal_message_id : old_journal) {
+            deleteMessage(journal_message_id);
+        }
 
-        // Clean up temp file
-        std::filesystem::remove(temp_file);
         return new_message_id;
     } catch (const TgBot::TgException& e) {
-        std::filesystem::remove(temp_file);
-        printf("Error updating metadata: %s\n", e.what());
+        FES_LOG(kError) << "Error updating metadata: " << e.what();
         throw;
     }
 }
 
 // In telegram-api.cpp, update the getMetadata method:
 nlohmann::json ftes::TelegramApiFacade::getMetadata() const {
+    fuse_external_storage::TraceSpan span("metadata", "getMetadata");
+
     int64_t chat_id = getChatId();
     if (chat_id == 0) {
         return json{};
@@ -208,26 +303,24 @@ nlohmann::json ftes::TelegramApiFacade::getMetadata() const {
         const auto chat = bot_.getApi().getChat(chat_id);
 
         if (chat->pinnedMessage && chat->pinnedMessage->document) {
-            metadata_message_id_ = chat->pinnedMessage->messageId;
-
-            // Download metadata file
-            std::string temp_file = "/tmp/fuse_telegram_metadata_" + std::to_string(time(nullptr));
-            std::string file_id = chat->pinnedMessage->document->fileId;
-            auto file = bot_.getApi().getFile(file_id);
-            std::string file_content = bot_.getApi().downloadFile(file->filePath);
-
-            std::ofstream ofs(temp_file);
-            ofs << file_content;
-            ofs.close();
-
-            // Parse the metadata
-            std::ifstream ifs(temp_file);
-            std::string metadata_str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-            ifs.close();
+            {
+                std::lock_guard lock(journal_mutex_);
+                metadata_message_id_ = chat->pinnedMessage->messageId;
+
+                auto [message_ids, file_id] = parseJournalCaption(chat->pinnedMessage->caption);
+                journal_message_ids_ = std::move(message_ids);
+                journal_file_id_ = std::move(file_id);
+                journal_records_.clear();
+            }
 
-            std::filesystem::remove(temp_file);
+            // Decoded straight from memory, snapshots written before the binary format are JSON
+            std::string metadata_str;
+            downloadFileId(chat->pinnedMessage->document->fileId, [&metadata_str](const char* data, const size_t size) {
+                metadata_str.append(data, size);
+                return true;
+            });
 
-            return json::parse(metadata_str);
+            return MetadataCodec::decode(metadata_str);
         }
 
         if (chat->pinnedMessage && !chat->pinnedMessage->text.empty()) {
@@ -238,12 +331,140 @@ nlohmann::json ftes::TelegramApiFacade::getMetadata() const {
 
         return json{{"files", json::array()}};
     } catch (const TgBot::TgException& e) {
-        printf("Error retrieving metadata: %s\n", e.what());
+        FES_LOG(kError) << "Error retrieving metadata: " << e.what();
         return json{{"files", json::array()}};
     }
 }
 
+bool ftes::TelegramApiFacade::appendJournal(const json& record) const {
+    fuse_external_storage::TraceSpan span("metadata", "appendJournal");
+
+    int64_t chat_id = getChatId();
+    if (chat_id == 0 || metadata_message_id_ == 0) {
+        return false;
+    }
+
+    std::lock_guard lock(journal_mutex_);
+
+    // The new document repeats the records before it, which must have been read
+    if (journal_records_.size() != journal_message_ids_.size()) {
+        return false;
+    }
+
+    std::vector<json> records = journal_records_;
+    records.push_back(record);
+
+    auto input_file = std::make_shared<TgBot::InputFile>();
+    input_file->data = json(records).dump();
+    input_file->mimeType = "application/json";
+    input_file->fileName = "journal.json";
+
+    if (input_file->data.size() > kMaxJournalBytes) {
+        return false;
+    }
+
+    std::vector<int64_t> journal = journal_message_ids_;
+    std::string file_id;
+
+    try {
+        const auto message = bot_.getApi().sendDocument(chat_id, input_file);
+        journal.push_back(message->messageId);
+        file_id = message->document->fileId;
+
+        const std::string caption = json{{"ids", journal}, {"file", file_id}}.dump();
+        if (caption.size() > kMaxJournalCaptionBytes) {
+            bot_.getApi().deleteMessage(chat_id, message->messageId);
+            return false;
+        }
+
+        // The caption is what other mounts use to find the journal
+        bot_.getApi().editMessageCaption(chat_id, static_cast<int>(metadata_message_id_), caption);
+    } catch (const TgBot::TgException& e) {
+        FES_LOG(kWarning) << "Could not append metadata journal record: " << e.what();
+
+        if (journal.size() > journal_message_ids_.size()) {
+            deleteMessage(journal.back());
+        }
+        return false;
+    }
+
+    journal_message_ids_ = std::move(journal);
+    journal_file_id_ = std::move(file_id);
+    journal_records_ = std::move(records);
+    return true;
+}
+
+std::vector<json> ftes::TelegramApiFacade::getJournal() const {
+    fuse_external_storage::TraceSpan span("metadata", "getJournal");
+
+    std::lock_guard lock(journal_mutex_);
+
+    journal_records_.clear();
+    if (journal_file_id_.empty()) {
+        return {};
+    }
+
+    try {
+        std::string journal_str;
+        downloadFileId(journal_file_id_, [&journal_str](const char* data, const size_t size) {
+            journal_str.append(data, size);
+            return true;
+        });
+
+        journal_records_ = json::parse(journal_str).get<std::vector<json>>();
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "Error reading metadata journal " << journal_file_id_ << ": " << e.what();
+    }
+
+    return journal_records_;
+}
+
+ftes::MetadataRevision ftes::TelegramApiFacade::getPinnedRevision() const {
+    fuse_external_storage::TraceSpan span("metadata", "getPinnedRevision");
+
+    int64_t chat_id = getChatId();
+    if (chat_id == 0) {
+        return {};
+    }
+
+    try {
+        const auto chat = bot_.getApi().getChat(chat_id);
+
+        if (!chat->pinnedMessage) {
+            return {};
+        }
+
+        return {chat->pinnedMessage->messageId, parseJournalCaption(chat->pinnedMessage->caption).message_ids.size()};
+    } catch (const TgBot::TgException& e) {
+        FES_LOG(kError) << "Error retrieving pinned message: " << e.what();
+        return {};
+    }
+}
+
+ftes::MetadataRevision ftes::TelegramApiFacade::getMetadataRevision() const {
+    std::lock_guard lock(journal_mutex_);
+    return {metadata_message_id_, journal_message_ids_.size()};
+}
+
+ftes::TelegramApiFacade::JournalCaption ftes::TelegramApiFacade::parseJournalCaption(const std::string& caption) {
+    if (caption.empty()) {
+        return {};
+    }
+
+    try {
+        const json parsed = json::parse(caption);
+        return {parsed.at("ids").get<std::vector<int64_t>>(), parsed.at("file").get<std::string>()};
+    } catch (const json::exception& e) {
+        FES_LOG(kWarning) << "Ignoring malformed metadata journal caption: " << e.what();
+        return {};
+    }
+}
+
 int64_t ftes::TelegramApiFacade::getChatId() const {
+    if (chat_id_ != 0) {
+        return chat_id_;
+    }
+
     std::ifstream chat_id_file(chat_id_file_);
     if (!chat_id_file) {
         return 0;
@@ -256,17 +477,37 @@ int64_t ftes::TelegramApiFacade::getChatId() const {
     return chat_id;
 }
 
+int64_t ftes::TelegramApiFacade::botId() const {
+    try {
+        return std::stoll(api_token_.substr(0, api_token_.find(':')));
+    } catch (const std::exception&) {
+        throw std::invalid_argument("Malformed bot token");
+    }
+}
+
+std::vector<ftes::HttpConnectionPool::ConnectionStats> ftes::TelegramApiFacade::connectionStats() const {
+    return http_client_.stats();
+}
+
+ftes::RequestScheduler::Stats ftes::TelegramApiFacade::schedulerStats() const {
+    return scheduler_.stats();
+}
+
 void ftes::TelegramApiFacade::longPollThread() const {
     // TODO: Chat ID -4940199065
 
     try {
         // printf("Bot username: %s\n", bot_.getApi().getMe()->username.c_str());
         TgBot::TgLongPoll longPoll(bot_);
-        while (true) {
+        while (!stop_long_poll_) {
             // printf("Long poll started\n");
             longPoll.start();
         }
     } catch (TgBot::TgException& e) {
-        printf("error: %s\n", e.what());
+        FES_LOG(kError) << "Long poll error: " << e.what();
     }
 }
+
+void ftes::TelegramApiFacade::stopLongPoll() const {
+    stop_long_poll_ = true;
+}
@@ -1,14 +1,40 @@
 #ifndef TELEGRAM_API_HPP
 #define TELEGRAM_API_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <filesystem>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <tgbot/tgbot.h>
 #include <nlohmann/json.hpp>
 
+#include "lib/telegram-api/http-connection-pool.hpp"
+
 namespace fuse_telegram_external_storage {
 
+    // How a stored document's bytes are encoded
+    enum class ChunkCompression : uint8_t {
+        kNone = 0,
+        kZstd = 1,
+    };
+
+    // Bot API handles of a stored document. file_id is all getFile needs, so
+    // reads don't have to look the message up first
+    struct RemoteFile {
+        std::string file_id;
+        std::string file_unique_id;
+        ChunkCompression compression = ChunkCompression::kNone;
+
+        [[nodiscard]] bool empty() const { return file_id.empty(); }
+    };
+
     struct FileInfo {
         std::string path;
         int64_t message_id;
@@ -16,41 +42,179 @@ namespace fuse_telegram_external_storage {
         time_t mtime;
         size_t size;
         bool is_dir;
+
+        // Chunked layout: the content is split into chunk_size parts, one message each.
+        // Files written before chunking keep chunk_size = 0 and their content in message_id
+        size_t chunk_size = 0;
+        std::vector<int64_t> chunks = {};
+
+        // Handles of message_id and of every chunk. Entries written before
+        // they were recorded have them empty until they are first read
+        RemoteFile file = {};
+        std::vector<RemoteFile> chunk_files = {};
+
+        // SHA-256 of every chunk in hex, empty where it isn't known. Chunks with
+        // the same hash share one message
+        std::vector<std::string> chunk_hashes = {};
+
+        [[nodiscard]] bool hasContent() const { return message_id > 0 || !chunks.empty(); }
+
+        [[nodiscard]] bool hasRemoteFiles() const {
+            if (chunks.empty()) {
+                return message_id <= 0 || !file.empty();
+            }
+
+            return chunk_files.size() == chunks.size() &&
+                   std::ranges::none_of(chunk_files, [](const RemoteFile& chunk_file) { return chunk_file.empty(); });
+        }
+    };
+
+    // Identifies a published metadata state: the pinned snapshot message
+    // plus the number of journal records attached to it
+    struct MetadataRevision {
+        int64_t message_id = 0;
+        size_t journal_length = 0;
+
+        bool operator==(const MetadataRevision&) const = default;
+    };
+
+    struct TelegramApiOptions {
+        // Keep-alive connections requests from all threads share
+        size_t connections = 8;
+
+        // Rate limits requests are paced to, with the priority of the calling thread
+        RequestSchedulerOptions scheduling;
+
+        // Chat objects are stored in, 0 uses the one saved by /start
+        int64_t chat_id = 0;
+
+        // Bot API server, a local one or a fake for load tests
+        std::string api_url = "https://api.telegram.org";
     };
 
     class TelegramApiFacade {
     public:
-        explicit TelegramApiFacade(std::string api_token);
+        explicit TelegramApiFacade(std::string api_token, const TelegramApiOptions& options = {});
 
-        // Initialize bot and start long polling
+        // Initialize bot and long poll until stopLongPoll
         void longPollThread() const;
 
-        // Send a file to the chat and return the message ID
-        int64_t sendFile(const std::filesystem::path& path, const std::string& file_name) const;
+        // The poll in flight still runs to its timeout
+        void stopLongPoll() const;
+
+        // Send a file to the chat and return the message ID and the handles of the document
+        std::pair<int64_t, RemoteFile> sendFile(const std::filesystem::path& path, const std::string& file_name) const;
 
-        // Download a file from a message ID to a local path
-        bool downloadFile(int64_t message_id, const std::filesystem::path& dest_path) const;
+        // Download a stored document, streamed to sink as it arrives. Costs one
+        // getFile call unless the download path is still cached, then none
+        using DownloadSink = HttpConnectionPool::Sink;
+        bool downloadFile(const RemoteFile& file, const DownloadSink& sink) const;
+
+        // Download a stored document straight into a local path
+        bool downloadFile(const RemoteFile& file, const std::filesystem::path& dest_path) const;
+
+        // Look up the handles of a message sent before they were recorded in
+        // the metadata. Bots can't read messages by ID, so this forwards the
+        // message and deletes the copy; only used to migrate old entries
+        std::optional<RemoteFile> resolveMessage(int64_t message_id) const;
 
         // Delete a message by ID
         bool deleteMessage(int64_t message_id) const;
 
-        // Send or update the special metadata message
+        // Send or update the special metadata message. A new snapshot starts
+        // with an empty journal, the previous journal messages are deleted
         int64_t updateMetadata(const nlohmann::json& metadata) const;
 
         // Get the current metadata message content
         nlohmann::json getMetadata() const;
 
-        // Get chat ID from local file
+        // Append a delta record to the journal of the current snapshot: one
+        // document holding every record so far plus a caption edit pointing the
+        // snapshot at it. Each append uploads the whole journal again, so its
+        // cost grows with the journal, up to kMaxJournalBytes. Returns false if
+        // the record couldn't be attached and a snapshot is needed
+        bool appendJournal(const nlohmann::json& record) const;
+
+        // Records attached to the snapshot returned by the last getMetadata
+        // call, in order. One download of the latest journal document, nothing
+        // is posted to the chat
+        std::vector<nlohmann::json> getJournal() const;
+
+        // State of the pinned metadata (one getChat call, no download)
+        MetadataRevision getPinnedRevision() const;
+
+        // State this facade last read or wrote
+        MetadataRevision getMetadataRevision() const;
+
+        // Size of a single snapshot's journal document and caption. Past the
+        // document size rewriting the snapshot is the cheaper commit
+        static constexpr size_t kMaxJournalBytes = 1 << 20;
+        static constexpr size_t kMaxJournalCaptionBytes = 1000;
+
+        // Chat ID given at construction, or the one saved to the local file by /start
         int64_t getChatId() const;
 
+        // User ID of the bot, the part of the token before the colon
+        int64_t botId() const;
+
+        // Request counters of every pooled connection
+        std::vector<HttpConnectionPool::ConnectionStats> connectionStats() const;
+
+        // Requests and time spent waiting for the rate limits, by priority
+        RequestScheduler::Stats schedulerStats() const;
+
+        // Calls, errors, bytes and latency by Bot API method
+        const fuse_external_storage::OperationStats& requestStats() const { return request_stats_; }
+
     private:
         std::string api_token_;
+        std::string api_url_;
+
+        // Must outlive bot_, which only keeps a reference
+        RequestScheduler scheduler_;
+        fuse_external_storage::OperationStats request_stats_;
+        HttpConnectionPool http_client_;
         TgBot::Bot bot_;
 
+        int64_t chat_id_;
+        mutable std::atomic<bool> stop_long_poll_{false};
         std::string chat_id_file_ = std::string(getenv("HOME")) + "/chat_id.txt";
         std::string metadata_message_file_ = std::string(getenv("HOME")) + "/metadata_message_id.txt";
 
-        mutable int64_t metadata_message_id_ = 0;
+        mutable std::atomic<int64_t> metadata_message_id_ = 0;
+
+        // Journal of the current snapshot: the messages of its documents,
+        // deleted with the next snapshot, and the records of the latest one
+        mutable std::mutex journal_mutex_;
+        mutable std::vector<int64_t> journal_message_ids_;
+        mutable std::string journal_file_id_;
+        mutable std::vector<nlohmann::json> journal_records_;
+
+        // The snapshot's caption: {"ids": [journal messages], "file": latest journal file ID}
+        struct JournalCaption {
+            std::vector<int64_t> message_ids;
+            std::string file_id;
+        };
+
+        static JournalCaption parseJournalCaption(const std::string& caption);
+
+        // Stream the file behind a Bot API file ID
+        void downloadFileId(const std::string& file_id, const DownloadSink& sink) const;
+
+        // Download paths from getFile, valid for at least an hour on the Bot API side
+        struct CachedFilePath {
+            std::string file_path;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        static constexpr std::chrono::minutes kFilePathTtl{50};
+        static constexpr size_t kMaxCachedFilePaths = 16384;
+
+        std::string resolveFilePath(const std::string& file_id) const;
+        void forgetFilePath(const std::string& file_id) const;
+
+        mutable std::mutex file_paths_mutex_;
+        mutable std::unordered_map<std::string, CachedFilePath> file_paths_;
     };
 
 } // fuse_telegram_external_storage
@@ -1,16 +1,196 @@
 #include "telegram-external-storage.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <ranges>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 #include <stdexcept>
+#include <utility>
+
+#include "lib/content-hash/content-hash.hpp"
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
 
 namespace ftes = fuse_telegram_external_storage;
 using json = nlohmann::json;
 
-ftes::TelegramExternalStorage::TelegramExternalStorage(const std::string& api_token)
-    : api_(api_token), bot_thread_([this] { api_.longPollThread(); }) {
+ftes::TelegramExternalStorage::TelegramExternalStorage(const std::string& api_token, const TelegramStorageOptions& options)
+    : options_(options),
+      api_(api_token, options.api),
+      // Message IDs only mean something within one chat, so every bot and chat caches apart
+      cache_(options.cache_dir / ("bot" + std::to_string(api_.botId()) + "-chat" + std::to_string(api_.getChatId())),
+             options.cache_size_bytes),
+      prefetcher_(options.prefetch,
+                  [this](const int64_t message_id, const RemoteFile& file) { return prefetchObject(message_id, file); },
+                  [this](const int64_t message_id) { return cache_.contains(message_id); }),
+      uploads_(options.upload) {
+    bots_by_slot_[0] = &api_;
+    placement_slots_.push_back(0);
+
+    for (const auto& [api_token, chat_id] : options_.extra_bots) {
+        TelegramApiOptions bot_options = options_.api;
+        bot_options.chat_id = chat_id;
+
+        auto bot = std::make_unique<TelegramApiFacade>(api_token, bot_options);
+
+        const bool duplicate = bot->botId() == api_.botId() || std::ranges::any_of(extra_bots_, [&bot](const auto& other) {
+            return other->botId() == bot->botId();
+        });
+        if (duplicate) {
+            throw std::invalid_argument("Bot " + std::to_string(bot->botId()) + " is configured twice");
+        }
+
+        extra_bots_.push_back(std::move(bot));
+    }
+
+    loadMetadata();
+    registerBots();
+
+    for (const auto& bot : extra_bots_) {
+        const auto slot = std::ranges::find(bots_by_slot_, bot.get(), [](const auto& entry) { return entry.second; });
+        placement_slots_.push_back(slot->first);
+    }
+
+    // Every upload worker may be sending a file to each bot
+    if (placement_slots_.size() > 1) {
+        for (const uint32_t slot : placement_slots_) {
+            upload_lanes_.emplace(slot, std::make_unique<UploadExecutor>(UploadExecutorOptions{.workers = options_.upload.workers}));
+        }
+    }
+}
+
+void ftes::TelegramExternalStorage::start() {
+    std::lock_guard mutation_lock(mutation_mutex_);
+
+    if (bot_thread_.joinable()) {
+        return;
+    }
+
+    bot_thread_ = std::thread([this] { api_.longPollThread(); });
+    for (const auto& lane : upload_lanes_ | std::views::values) {
+        lane->start();
+    }
+    uploads_.start();
+    prefetcher_.start();
+
+    if (options_.commit_delay.count() > 0) {
+        commit_thread_ = std::jthread([this] { commitLoop(); });
+    }
 }
 
 ftes::TelegramExternalStorage::~TelegramExternalStorage() {
+    // Background uploads commit through the metadata batch, so they finish first
+    uploads_.waitAll();
+
+    // Failed ones get a last try, their staged chunks don't outlive the mount
+    std::vector<std::string> failed;
+    {
+        std::unique_lock lock(index_mutex_);
+        for (const auto& [key, upload] : failed_uploads_) {
+            upload->failed_at = {};
+            failed.push_back(key);
+        }
+    }
+
+    for (const std::string& key : failed) {
+        if (waitForUpload(key) != 0) {
+            FES_LOG(kError) << "[TelegramExternalStorage] Giving up on the upload of " << key
+                            << ", it keeps its previous content";
+            dropFailedUpload(key);
+        }
+    }
+
+    {
+        std::lock_guard mutation_lock(mutation_mutex_);
+        stopping_ = true;
+    }
+    commit_cv_.notify_all();
+
+    if (commit_thread_.joinable()) {
+        commit_thread_.join();
+    }
+
+    // Commit whatever is still batched and leave a compacted snapshot behind
+    // so the next mount doesn't have to replay the journal
+    try {
+        std::lock_guard mutation_lock(mutation_mutex_);
+        commitPending();
+
+        if (api_.getMetadataRevision().journal_length > 0) {
+            writeSnapshot();
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[TelegramExternalStorage] Failed to compact metadata: " << e.what();
+    }
+
+    const auto cache_stats = cache_.stats();
+    FES_LOG(kInfo) << "[TelegramExternalStorage] Read cache: " << cache_stats.hits << " hits, "
+                   << cache_stats.misses << " misses, " << cache_stats.evictions << " evictions";
+
+    const auto prefetch_stats = prefetcher_.stats();
+    FES_LOG(kInfo) << "[TelegramExternalStorage] Prefetch: " << prefetch_stats.issued << " issued, "
+                   << prefetch_stats.completed << " completed, " << prefetch_stats.useful << " useful, "
+                   << prefetch_stats.dropped << " dropped";
+
+    const auto upload_stats = uploads_.stats();
+    FES_LOG(kInfo) << "[TelegramExternalStorage] Uploads: " << upload_stats.submitted << " submitted, "
+                   << upload_stats.completed << " completed, " << upload_stats.throttled << " throttled";
+
+    if (options_.compression.level > 0) {
+        FES_LOG(kInfo) << "[TelegramExternalStorage] Compression: " << chunks_compressed_ << " of " << chunks_uploaded_
+                       << " chunks compressed, " << compressed_input_bytes_ << " -> " << compressed_output_bytes_
+                       << " bytes";
+    }
+
+    static constexpr const char* kPriorityNames[] = {"foreground", "metadata", "upload", "background"};
+
+    const auto scheduler_stats = api_.schedulerStats();
+    for (size_t i = 0; i < kRequestPriorities; ++i) {
+        if (scheduler_stats.requests[i] == 0) {
+            continue;
+        }
+
+        FES_LOG(kInfo) << "[TelegramExternalStorage] Requests (" << kPriorityNames[i] << "): " << scheduler_stats.requests[i]
+                       << " sent, " << scheduler_stats.delayed[i] << " delayed, "
+                       << scheduler_stats.waited[i].count() / scheduler_stats.requests[i] << "us avg wait";
+    }
+    if (scheduler_stats.backoffs > 0) {
+        FES_LOG(kInfo) << "[TelegramExternalStorage] Rate limited " << scheduler_stats.backoffs << " times";
+    }
+
+    for (const auto& bot : extra_bots_) {
+        const auto bot_stats = bot->schedulerStats();
+
+        uint64_t requests = 0;
+        for (const uint64_t count : bot_stats.requests) {
+            requests += count;
+        }
+
+        FES_LOG(kInfo) << "[TelegramExternalStorage] Bot " << bot->botId() << ": " << requests << " requests, rate limited "
+                       << bot_stats.backoffs << " times";
+    }
+
+    const auto connection_stats = api_.connectionStats();
+    for (size_t i = 0; i < connection_stats.size(); ++i) {
+        const auto& stats = connection_stats[i];
+        if (stats.requests == 0) {
+            continue;
+        }
+
+        FES_LOG(kInfo) << "[TelegramExternalStorage] Connection " << i << ": " << stats.requests << " requests, "
+                       << stats.failures << " failed, " << stats.new_connections << " new connections, "
+                       << stats.total_latency.count() / stats.requests << "us avg, "
+                       << stats.max_latency.count() << "us max";
+    }
+
+    // Returns once the poll in flight times out
+    api_.stopLongPoll();
+
     if (bot_thread_.joinable()) {
         bot_thread_.join();
     }
@@ -18,8 +198,10 @@ ftes::TelegramExternalStorage::~TelegramExternalStorage() {
 
 // Debug the getAttr method to ensure it properly handles paths:
 struct stat ftes::TelegramExternalStorage::getAttr(std::filesystem::path& path) {
+    fuse_external_storage::TraceSpan span("storage", "getAttr", path.native());
+
     struct stat stbuf = {};
-    json metadata = getMetadata();
+    refreshMetadata();
 
     // Handle root directory
     if (path == "/" || path == "." || path.empty()) {
@@ -28,18 +210,20 @@ struct stat ftes::TelegramExternalStorage::getAttr(std::filesystem::path& path)
         return stbuf;
     }
 
-    // Normalize path for lookup
-    std::string normalized_path = path.string();
-    if (normalized_path[0] != '/') {
-        normalized_path = "/" + normalized_path;
-    }
-
-    const FileInfo* info = findFileInfo(normalized_path, metadata);
+    auto info = findFileInfo(path);
 
     if (!info) {
         throw std::runtime_error("File not found");
     }
 
+    // A stored version still uploading already has its new size
+    {
+        std::shared_lock lock(index_mutex_);
+        if (const auto staged = staged_files_.find(info->path); staged != staged_files_.end()) {
+            info = staged->second;
+        }
+    }
+
     stbuf.st_mode = info->is_dir ? (S_IFDIR | 0755) : (S_IFREG | 0644);
     stbuf.st_nlink = info->is_dir ? 2 : 1;
 
@@ -51,466 +235,1349 @@ struct stat ftes::TelegramExternalStorage::getAttr(std::filesystem::path& path)
 }
 
 std::vector<ftes::FileInfo> ftes::TelegramExternalStorage::listDir(const std::filesystem::path& path) {
-    json metadata = getMetadata();
-    std::vector<FileInfo> entries;
+    fuse_external_storage::TraceSpan span("storage", "listDir", path.native());
 
-    // Debug output
-    std::cerr << "[listDir] Listing directory: " << path << std::endl;
-    std::cerr << "[listDir] Metadata contains " << metadata["files"].size() << " files" << std::endl;
-
-    // Normalize the path for comparison
-    std::string target_path = path.string();
-    if (target_path.empty() || target_path == ".") {
-        target_path = "/";
-    } else if (target_path[0] != '/') {
-        target_path = "/" + target_path;
-    }
-
-    // If not ending with '/', add it for directory comparison
-    std::string dir_path = target_path;
-    if (dir_path != "/" && dir_path.back() != '/') {
-        dir_path += '/';
-    }
+    refreshMetadata();
 
-    // Process files array
-    if (metadata.contains("files") && metadata["files"].is_array()) {
-        for (const auto& file_entry : metadata["files"]) {
-            if (!file_entry.contains("path") || !file_entry["path"].is_string()) {
-                std::cerr << "[listDir] Invalid file entry in metadata" << std::endl;
-                continue;
-            }
+    std::shared_lock lock(index_mutex_);
 
-            std::string file_path = file_entry["path"].get<std::string>();
-            std::cerr << "[listDir] Checking file: " << file_path << std::endl;
+    // Debug output
+    FES_LOG(kDebug) << "[listDir] Listing directory: " << path;
+    FES_LOG(kDebug) << "[listDir] Metadata contains " << index_.size() << " files";
 
-            // Skip entry if path is malformed
-            if (file_path.empty() || file_path[0] != '/') {
-                continue;
-            }
+    std::vector<FileInfo> entries = index_.children(path);
 
-            // Extract filename and parent directory
-            std::filesystem::path p(file_path);
-            std::string parent_dir = p.parent_path().string();
-            if (parent_dir.empty()) parent_dir = "/";
-
-            // Check if this file belongs in the requested directory
-            if (parent_dir == target_path) {
-                FileInfo info;
-                info.path = file_path;
-                info.message_id = file_entry["message_id"].get<int64_t>();
-                info.size = file_entry["size"].get<size_t>();
-                info.is_dir = file_entry["is_dir"].get<bool>();
-                info.ctime = file_entry["ctime"].get<time_t>();
-                info.mtime = file_entry["mtime"].get<time_t>();
-                entries.push_back(info);
-                std::cerr << "[listDir] Added file: " << file_path << " (parent: " << parent_dir << ")" << std::endl;
-            }
+    for (auto& entry : entries) {
+        if (const auto staged = staged_files_.find(entry.path); staged != staged_files_.end()) {
+            entry = staged->second;
         }
     }
+    lock.unlock();
+
+    prefetcher_.onListDir(entries);
 
-    std::cerr << "[listDir] Returning " << entries.size() << " entries" << std::endl;
+    FES_LOG(kDebug) << "[listDir] Returning " << entries.size() << " entries";
     return entries;
 }
 
 int ftes::TelegramExternalStorage::createFile(const std::filesystem::path& path, mode_t mode) {
+    fuse_external_storage::TraceSpan span("storage", "createFile", path.native());
+
     try {
-        json metadata = getMetadata();
-
-        // First remove any existing file with the same path
-        removeFileInfo(path, metadata);
-
-        // Now add the new file info
-        time_t now = time(nullptr);
-        json file_info = {
-            {"path", path.string().empty() || path.string()[0] != '/' ? "/" + path.string() : path.string()},
-            {"message_id", 0},
-            {"size", 0},
-            {"is_dir", false},
-            {"ctime", now},
-            {"mtime", now}
-        };
-
-        // Add to metadata and update
-        metadata["files"].push_back(file_info);
-        updateMetadata(metadata);
+        // An upload landing later would overwrite the new empty file
+        uploads_.wait(MetadataIndex::normalizePath(path));
+        dropFailedUpload(MetadataIndex::normalizePath(path));
+
+        refreshMetadata();
+        std::lock_guard mutation_lock(mutation_mutex_);
+
+        // Replaces any existing file with the same path
+        const auto existing = findFileInfo(path);
+
+        addFileInfo(path, 0, 0, false);
+        updateMetadata();
+
+        if (existing && !existing->is_dir) {
+            deleteContent(*existing);
+        }
 
         return 0;
     } catch (const std::exception& e) {
-        std::cerr << "[createFile] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[createFile] Error: " << e.what();
         return -EIO;
     }
 }
 
 int ftes::TelegramExternalStorage::readFile(const std::filesystem::path& path, char* buf, size_t size, off_t offset) {
-    json metadata = getMetadata();
-    FileInfo* info = findFileInfo(path, metadata);
+    fuse_external_storage::TraceSpan span("storage", "readFile", path.native());
+
+    // The staged content only becomes readable here once it is uploaded
+    if (const int error = waitForUpload(MetadataIndex::normalizePath(path))) {
+        return error;
+    }
+
+    refreshMetadata();
+    auto info = findFileInfo(path);
 
     if (!info) {
         return -ENOENT;
     }
 
-    // Empty files (with message_id = 0) have no content to read
-    if (info->message_id == 0) {
+    // Files that were never written have no content to read
+    if (!info->hasContent()) {
         return 0;  // EOF for empty files
     }
 
+    if (!info->hasRemoteFiles() && !(info = migrateRemoteFiles(*info))) {
+        return -EIO;
+    }
+
     // Check if offset is beyond file size
     if (offset >= static_cast<off_t>(info->size)) {
         return 0;  // EOF when offset is beyond file size
     }
 
-    std::string temp_file = "/tmp/fuse_telegram_" + std::to_string(time(nullptr));
+    prefetcher_.onRead(*info, offset, size);
 
-    if (!api_.downloadFile(info->message_id, temp_file)) {
-        std::cerr << "[readFile] Failed to download file: " << path << std::endl;
-        return -EIO;
-    }
-
-    // Verify the file exists and get its actual size
-    struct stat st;
-    if (stat(temp_file.c_str(), &st) != 0) {
-        std::cerr << "[readFile] Failed to stat temp file" << std::endl;
-        std::filesystem::remove(temp_file);
-        return -EIO;
+    // Files stored before chunking are a single object
+    if (info->chunks.empty()) {
+        return readObject(info->message_id, info->file, buf, size, offset);
     }
 
-    // Update size in metadata if it doesn't match actual file size
-    if (static_cast<size_t>(st.st_size) != info->size) {
-        json updated_metadata = metadata;
-        removeFileInfo(path, updated_metadata);
-        addFileInfo(path, info->message_id, st.st_size, false, updated_metadata);
-        updateMetadata(updated_metadata);
-    }
+    // Only the chunks covering [offset, offset + size) are fetched
+    const size_t end = std::min(static_cast<size_t>(offset) + size, info->size);
+    size_t position = offset;
 
-    std::ifstream ifs(temp_file, std::ios::binary);
-    if (!ifs) {
-        std::cerr << "[readFile] Failed to open temp file" << std::endl;
-        std::filesystem::remove(temp_file);
-        return -EIO;
-    }
+    while (position < end) {
+        const size_t chunk_index = position / info->chunk_size;
+        const size_t chunk_offset = position % info->chunk_size;
+        const size_t bytes_wanted = std::min(end - position, info->chunk_size - chunk_offset);
 
-    // Calculate how many bytes we can actually read
-    size_t bytes_available = st.st_size - offset;
-    size_t bytes_to_read = std::min(size, bytes_available);
+        const int bytes_read = readObject(info->chunks[chunk_index], info->chunk_files[chunk_index],
+                                          buf + (position - offset), bytes_wanted, static_cast<off_t>(chunk_offset));
+        if (bytes_read < 0) {
+            return bytes_read;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
 
-    ifs.seekg(offset);
-    ifs.read(buf, bytes_to_read);
-    size_t bytes_read = ifs.gcount();
-    ifs.close();
+        position += bytes_read;
+    }
 
-    std::filesystem::remove(temp_file);
-    return static_cast<int>(bytes_read);
+    return static_cast<int>(position - offset);
 }
 
 int ftes::TelegramExternalStorage::writeFile(const std::filesystem::path& path, const char* buf, size_t size, off_t offset) {
-    try {
-        json metadata = getMetadata();
-        FileInfo* info = findFileInfo(path, metadata);
-
-        if (!info) {
-            return -ENOENT;
-        }
+    fuse_external_storage::TraceSpan span("storage", "writeFile", path.native());
 
-        // Create a temp file for content
-        std::string temp_file = "/tmp/fuse_telegram_" + std::to_string(time(nullptr));
+    // Without an open handle a single write is staged, patched and stored on its own
+    const std::filesystem::path temp_file = cache_.downloadPath(0);
 
-        // Check if this is an existing file with content
-        if (info->message_id != 0) {
-            // Download existing content
-            if (!api_.downloadFile(info->message_id, temp_file)) {
-                std::cerr << "[writeFile] Failed to download file: " << path << std::endl;
-                return -EIO;
-            }
-        } else {
-            // Create an empty file for new writes
-            std::ofstream ofs(temp_file, std::ios::binary);
-            if (!ofs) {
-                std::cerr << "[writeFile] Failed to create temp file" << std::endl;
-                return -EIO;
-            }
-            ofs.close();
+    try {
+        if (const int error = fetchFile(path, temp_file)) {
+            std::filesystem::remove(temp_file);
+            return error;
         }
 
-        // Update file content at specified offset
         std::fstream fs(temp_file, std::ios::in | std::ios::out | std::ios::binary);
         if (!fs) {
             std::filesystem::remove(temp_file);
             return -EIO;
         }
 
-        // Get current file size
+        // Writing past the end leaves a zero-filled gap
         fs.seekp(0, std::ios::end);
-        size_t current_size = fs.tellp();
+        const auto current_size = static_cast<off_t>(fs.tellp());
 
-        // If offset is beyond current size, pad with zeros
         if (offset > current_size) {
-            fs.seekp(current_size);
             std::vector<char> padding(offset - current_size, 0);
-            fs.write(padding.data(), padding.size());
+            fs.write(padding.data(), static_cast<std::streamsize>(padding.size()));
         }
 
-        // Write the new data
         fs.seekp(offset);
         fs.write(buf, static_cast<std::streamsize>(size));
         fs.close();
 
-        // Calculate new file size
-        size_t new_size = std::max(static_cast<size_t>(offset) + size, current_size);
-
-        // Upload new version
-        int64_t new_message_id = api_.sendFile(temp_file, path.filename().string());
-        if (new_message_id <= 0) {
-            std::filesystem::remove(temp_file);
-            return -EIO;
-        }
-
-        // Delete old message if it exists
-        if (info->message_id > 0) {
-            api_.deleteMessage(info->message_id);
-        }
-
-        // Update metadata - completely remove old entries and add new one
-        removeFileInfo(path, metadata);
-
-        // Normalize path for consistency
-        std::string path_str = path.string();
-        if (path_str.empty() || path_str == ".") {
-            path_str = "/";
-        } else if (path_str[0] != '/') {
-            path_str = "/" + path_str;
-        }
-
-        // Add updated file info
-        time_t now = time(nullptr);
-        metadata["files"].push_back({
-            {"path", path_str},
-            {"message_id", new_message_id},
-            {"size", new_size},
-            {"is_dir", false},
-            {"ctime", info->ctime},
-            {"mtime", now}
-        });
-
-        updateMetadata(metadata);
+        const int result = storeFile(path, temp_file, {{offset, size}});
         std::filesystem::remove(temp_file);
-        return static_cast<int>(size);
+
+        return result == 0 ? static_cast<int>(size) : result;
     } catch (const std::exception& e) {
-        std::cerr << "[writeFile] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[writeFile] Error: " << e.what();
+        std::filesystem::remove(temp_file);
         return -EIO;
     }
 }
 
 int ftes::TelegramExternalStorage::unlinkFile(const std::filesystem::path& path) {
+    fuse_external_storage::TraceSpan span("storage", "unlinkFile", path.native());
+
     try {
-        json metadata = getMetadata();
-        FileInfo* info = findFileInfo(path, metadata);
+        uploads_.wait(MetadataIndex::normalizePath(path));
+        dropFailedUpload(MetadataIndex::normalizePath(path));
+
+        refreshMetadata();
+        std::lock_guard mutation_lock(mutation_mutex_);
+
+        const auto info = findFileInfo(path);
 
         if (!info || info->is_dir) {
             return -ENOENT;
         }
 
-        // Delete the message from Telegram if it has been uploaded
-        if (info->message_id > 0) {
-            if (!api_.deleteMessage(info->message_id)) {
-                std::cerr << "[unlinkFile] Failed to delete message: " << info->message_id << std::endl;
-                // Continue anyway to clean up metadata
-            }
-        }
+        removeFileInfo(path);
+        updateMetadata();
 
-        // Remove all entries with this path
-        removeFileInfo(path, metadata);
-        updateMetadata(metadata);
+        // Delete the messages from Telegram unless another file shares them
+        deleteContent(*info);
 
         return 0;
     } catch (const std::exception& e) {
-        std::cerr << "[unlinkFile] Error: " << e.what() << std::endl;
+        FES_LOG(kError) << "[unlinkFile] Error: " << e.what();
         return -EIO;
     }
 }
 
 int ftes::TelegramExternalStorage::createDir(const std::filesystem::path& path, mode_t mode) {
-    json metadata = getMetadata();
-    if (findFileInfo(path, metadata)) {
+    fuse_external_storage::TraceSpan span("storage", "createDir", path.native());
+
+    refreshMetadata();
+    std::lock_guard mutation_lock(mutation_mutex_);
+
+    if (findFileInfo(path)) {
         return -EEXIST;
     }
 
-    addFileInfo(path, 0, 0, true, metadata);
-    updateMetadata(metadata);
+    addFileInfo(path, 0, 0, true);
+    updateMetadata();
 
     return 0;
 }
 
 int ftes::TelegramExternalStorage::removeDir(const std::filesystem::path& path) {
-    json metadata = getMetadata();
-    const FileInfo* info = findFileInfo(path, metadata);
+    fuse_external_storage::TraceSpan span("storage", "removeDir", path.native());
+
+    refreshMetadata();
+    std::lock_guard mutation_lock(mutation_mutex_);
+
+    const auto info = findFileInfo(path);
 
     if (!info || !info->is_dir) {
         return -ENOENT;
     }
 
     // Check if directory is empty
-    const std::string target_path = path == "/" ? "/" : "/" + path.string();
-
-    for (const auto& file : metadata["files"]) {
-        if (std::filesystem::path(file["path"].get<std::string>()).parent_path() == target_path) {
+    {
+        std::shared_lock lock(index_mutex_);
+        if (index_.hasChildren(path)) {
             return -ENOTEMPTY;
         }
     }
 
-    removeFileInfo(path, metadata);
-    updateMetadata(metadata);
+    removeFileInfo(path);
+    updateMetadata();
 
     return 0;
 }
 
 int ftes::TelegramExternalStorage::rename(const std::filesystem::path& from, const std::filesystem::path& to) {
-    json metadata = getMetadata();
-    const FileInfo* info = findFileInfo(from, metadata);
+    fuse_external_storage::TraceSpan span("storage", "rename", from.native());
+
+    // Uploads commit by path, let the ones under either name land first
+    std::vector<std::string> keys = {MetadataIndex::normalizePath(from), MetadataIndex::normalizePath(to)};
+
+    if (const auto source = findFileInfo(from); source && source->is_dir) {
+        uploads_.waitAll();
+
+        std::shared_lock lock(index_mutex_);
+        const std::string prefix = keys.front() + "/";
+        for (const auto& key : failed_uploads_ | std::views::keys) {
+            if (key.starts_with(prefix)) {
+                keys.push_back(key);
+            }
+        }
+    }
+
+    // A failed upload would be left behind under the old name
+    for (const std::string& key : keys) {
+        if (const int error = waitForUpload(key)) {
+            return error;
+        }
+    }
+
+    refreshMetadata();
+    std::lock_guard mutation_lock(mutation_mutex_);
+
+    const auto info = findFileInfo(from);
 
     if (!info) {
         return -ENOENT;
     }
 
-    if (findFileInfo(to, metadata)) {
+    if (findFileInfo(to)) {
         return -EEXIST;
     }
 
-    removeFileInfo(from, metadata);
-    addFileInfo(to, info->message_id, info->size, info->is_dir, metadata);
-    updateMetadata(metadata);
+    // Directories are moved together with their whole subtree
+    {
+        std::unique_lock lock(index_mutex_);
+        index_.rename(from, to);
+        pending_ops_.push_back(MetadataIndex::renameRecord(from, to));
+    }
+
+    updateMetadata();
 
     return 0;
 }
 
-json ftes::TelegramExternalStorage::getMetadata() const {
-    json metadata = api_.getMetadata();
+int ftes::TelegramExternalStorage::fetchFile(const std::filesystem::path& path, const std::filesystem::path& local_path) {
+    fuse_external_storage::TraceSpan span("storage", "fetchFile", path.native());
 
-    if (metadata.is_null()) {
-        metadata = json{{"files", json::array()}};
+    if (const int error = waitForUpload(MetadataIndex::normalizePath(path))) {
+        return error;
     }
 
-    return metadata;
-}
+    refreshMetadata();
+    auto info = findFileInfo(path);
 
-void ftes::TelegramExternalStorage::updateMetadata(const json& metadata) const {
-    [[maybe_unused]] auto result = api_.updateMetadata(metadata);
-}
+    if (!info || info->is_dir) {
+        return -ENOENT;
+    }
 
-// Fix the findFileInfo to handle path normalization better
-ftes::FileInfo* ftes::TelegramExternalStorage::findFileInfo(const std::filesystem::path& path,
-                                                         nlohmann::json& metadata) const {
-    // Normalize path
-    std::string path_str = path.string();
-    if (path_str.empty() || path_str == ".") {
-        path_str = "/";
-    } else if (path_str[0] != '/') {
-        path_str = "/" + path_str;
+    std::ofstream ofs(local_path, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        return -EIO;
     }
 
-    std::cerr << "[findFileInfo] Looking for: " << path_str << std::endl;
+    // Nothing uploaded yet, the local copy is just an empty file
+    if (!info->hasContent()) {
+        return 0;
+    }
 
-    // Check if files array exists
-    if (!metadata.contains("files") || !metadata["files"].is_array()) {
-        std::cerr << "[findFileInfo] No files array in metadata" << std::endl;
-        return nullptr;
+    if (!info->hasRemoteFiles() && !(info = migrateRemoteFiles(*info))) {
+        return -EIO;
     }
 
-    // Find matching entry (return the one with a message_id if there are duplicates)
-    static FileInfo info;
-    FileInfo* result = nullptr;
+    if (info->chunks.empty()) {
+        ofs.close();
+
+        if (cache_.copyTo(info->message_id, local_path)) {
+            return 0;
+        }
 
-    for (auto& file : metadata["files"]) {
-        if (file["path"] == path_str) {
-            // If we already found an entry but this one has a message_id, prefer this one
-            int64_t message_id = file["message_id"].get<int64_t>();
+        if (!api_.downloadFile(info->file, local_path)) {
+            FES_LOG(kError) << "[fetchFile] Failed to download file: " << path;
+            return -EIO;
+        }
 
-            if (!result || (message_id > 0 && result->message_id == 0)) {
-                info.path = file["path"].get<std::string>();
-                info.message_id = message_id;
-                info.size = file["size"].get<size_t>();
-                info.is_dir = file["is_dir"].get<bool>();
-                info.ctime = file["ctime"].get<time_t>();
-                info.mtime = file["mtime"].get<time_t>();
-                result = &info;
+        return 0;
+    }
 
-                // If this entry has a message_id > 0, prefer it and stop searching
-                if (message_id > 0) {
-                    break;
-                }
+    std::vector<char> chunk(info->chunk_size);
+
+    for (size_t i = 0; i < info->chunks.size(); ++i) {
+        const int bytes_read = readObject(info->chunks[i], info->chunk_files[i], chunk.data(), chunk.size(), 0);
+        if (bytes_read < 0) {
+            FES_LOG(kError) << "[fetchFile] Failed to download chunk " << info->chunks[i] << " of " << path;
+            return bytes_read;
+        }
+
+        ofs.write(chunk.data(), bytes_read);
+    }
+
+    return ofs ? 0 : -EIO;
+}
+
+int ftes::TelegramExternalStorage::storeFile(const std::filesystem::path& path, const std::filesystem::path& local_path,
+                                             const std::vector<fuse_external_storage::ByteRange>& dirty_ranges) {
+    fuse_external_storage::TraceSpan span("storage", "storeFile", path.native());
+
+    const std::string key = MetadataIndex::normalizePath(path);
+
+    // A version is planned against the previous one, which has to have landed first
+    if (const int error = waitForUpload(key)) {
+        return error;
+    }
+
+    auto upload = std::make_shared<PendingUpload>();
+    uint64_t staged_bytes = 0;
+
+    try {
+        refreshMetadata();
+        std::unique_lock mutation_lock(mutation_mutex_);
+
+        // Another handle may have staged a version since the wait. Planning
+        // against the one before it would reuse chunks its commit deletes
+        while (hasStagedVersion(key)) {
+            mutation_lock.unlock();
+            if (const int error = waitForStagedVersion(key)) {
+                return error;
+            }
+            mutation_lock.lock();
+        }
+
+        const auto info = findFileInfo(path);
+
+        if (!info || info->is_dir) {
+            return -ENOENT;
+        }
+
+        const size_t chunk_size = options_.chunk_size_bytes;
+        const size_t new_size = std::filesystem::file_size(local_path);
+
+        // Clean chunks can only be kept if the file already uses the current layout
+        const bool same_layout = !info->chunks.empty() && info->chunk_size == chunk_size;
+        const std::vector<int64_t> old_chunks = same_layout ? info->chunks : std::vector<int64_t>{};
+
+        std::vector<bool> dirty((new_size + chunk_size - 1) / chunk_size, false);
+        for (const auto& [range_offset, range_size] : dirty_ranges) {
+            if (range_size == 0) {
+                continue;
             }
+
+            const size_t first = range_offset / chunk_size;
+            const size_t last = std::min((range_offset + range_size - 1) / chunk_size + 1, dirty.size());
+            std::fill(dirty.begin() + static_cast<std::ptrdiff_t>(std::min(first, last)), dirty.begin() + static_cast<std::ptrdiff_t>(last), true);
+        }
+
+        std::ifstream ifs(local_path, std::ios::binary);
+        if (!ifs) {
+            return -EIO;
+        }
+
+        std::vector<int64_t> new_chunks(dirty.size(), 0);
+        std::vector<RemoteFile> new_chunk_files(dirty.size());
+        std::vector<std::string> new_chunk_hashes(dirty.size());
+        std::vector<char> chunk(chunk_size);
+
+        for (size_t i = 0; i < new_chunks.size(); ++i) {
+            const size_t chunk_length = std::min(chunk_size, new_size - i * chunk_size);
+            const size_t old_length = i < old_chunks.size() ? std::min(chunk_size, info->size - i * chunk_size) : 0;
+
+            // Untouched chunks keep their message
+            if (i < old_chunks.size() && !dirty[i] && chunk_length == old_length) {
+                new_chunks[i] = old_chunks[i];
+                // Chunks of entries from before file IDs were kept are migrated on their next read
+                new_chunk_files[i] = i < info->chunk_files.size() ? info->chunk_files[i] : RemoteFile{};
+                new_chunk_hashes[i] = i < info->chunk_hashes.size() ? info->chunk_hashes[i] : std::string{};
+                continue;
+            }
+
+            ifs.seekg(static_cast<std::streamoff>(i * chunk_size));
+            if (!ifs.read(chunk.data(), static_cast<std::streamsize>(chunk_length))) {
+                throw std::runtime_error("Failed to read staged chunk");
+            }
+
+            // Changed chunks are copied out of the handle's staging file, which is gone once we return
+            const std::filesystem::path staged_file = cache_.downloadPath(0);
+            upload->staged_chunks.push_back({i, staged_file, ContentHash::sha256({chunk.data(), chunk_length})});
+
+            std::ofstream ofs(staged_file, std::ios::binary);
+            ofs.write(chunk.data(), static_cast<std::streamsize>(chunk_length));
+            ofs.close();
+
+            if (!ofs) {
+                throw std::runtime_error("Failed to write chunk to temp file");
+            }
+
+            staged_bytes += chunk_length;
+        }
+
+        upload->updated = *info;
+        upload->updated.message_id = 0;
+        upload->updated.size = new_size;
+        upload->updated.chunk_size = new_chunks.empty() ? 0 : chunk_size;
+        upload->updated.chunks = std::move(new_chunks);
+        upload->updated.file = {};
+        upload->updated.chunk_files = std::move(new_chunk_files);
+        upload->updated.chunk_hashes = std::move(new_chunk_hashes);
+        upload->updated.mtime = time(nullptr);
+
+        // getattr and readdir see the new size right away
+        std::unique_lock lock(index_mutex_);
+        staged_files_[key] = upload->updated;
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[storeFile] Error: " << e.what();
+
+        for (const auto& staged : upload->staged_chunks) {
+            std::filesystem::remove(staged.file);
         }
+
+        return -EIO;
     }
 
-    if (result) {
-        std::cerr << "[findFileInfo] Found file: " << path_str
-                  << " (message_id: " << result->message_id
-                  << ", size: " << result->size << ")" << std::endl;
-    } else {
-        std::cerr << "[findFileInfo] File not found: " << path_str << std::endl;
+    // Blocks while too much is already waiting to be uploaded
+    uploads_.submit(key, staged_bytes, [this, upload] { finishUpload(upload); });
+
+    return 0;
+}
+
+int ftes::TelegramExternalStorage::checkUpload(const std::filesystem::path& path, const bool wait) {
+    const std::string key = MetadataIndex::normalizePath(path);
+
+    if (wait) {
+        return waitForUpload(key);
     }
 
-    return result;
+    std::shared_lock lock(index_mutex_);
+    return failed_uploads_.contains(key) ? -EIO : 0;
 }
 
-void ftes::TelegramExternalStorage::addFileInfo(const std::filesystem::path& path,
-                                              int64_t message_id,
-                                              size_t size,
-                                              bool is_dir,
-                                              nlohmann::json& metadata) const {
-    // Normalize the path
-    std::string path_str = path.string();
-    if (path_str.empty() || path_str == ".") {
-        path_str = "/";
-    } else if (path_str[0] != '/') {
-        path_str = "/" + path_str;
-    }
-
-    // Make sure we have a files array
-    if (!metadata.contains("files")) {
-        metadata["files"] = json::array();
-    }
-
-    // Create the file info object
-    json file_info = {
-        {"path", path_str},
-        {"message_id", message_id},
-        {"size", size},
-        {"is_dir", is_dir},
-        {"ctime", time(nullptr)},
-        {"mtime", time(nullptr)}
+int ftes::TelegramExternalStorage::syncMetadata() {
+    fuse_external_storage::TraceSpan span("storage", "syncMetadata");
+
+    uploads_.waitAll();
+
+    try {
+        std::lock_guard mutation_lock(mutation_mutex_);
+        commitPending();
+
+        // Failed uploads are reported to their own path by checkUpload
+        return 0;
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[syncMetadata] Error: " << e.what();
+        return -EIO;
+    }
+}
+
+void ftes::TelegramExternalStorage::writeStats(std::string& out) const {
+    std::vector<fuse_external_storage::OperationStats::LabelledSource> sources = {
+        {"bot=\"" + std::to_string(api_.botId()) + "\"", &api_.requestStats()},
     };
 
-    // Add to the files array
-    metadata["files"].push_back(file_info);
+    for (const auto& bot : extra_bots_) {
+        sources.emplace_back("bot=\"" + std::to_string(bot->botId()) + "\"", &bot->requestStats());
+    }
+
+    fuse_external_storage::OperationStats::writePrometheus(out, "fes_telegram_api", "method", sources);
+}
 
-    std::cerr << "[addFileInfo] Added file to metadata: " << path_str
-              << " (message_id: " << message_id << ", size: " << size << ", is_dir: " << is_dir << ")" << std::endl;
+void ftes::TelegramExternalStorage::setRemoteChangeListener(std::function<void()> listener) {
+    std::lock_guard mutation_lock(mutation_mutex_);
+    remote_change_listener_ = std::move(listener);
 }
 
-void ftes::TelegramExternalStorage::removeFileInfo(const std::filesystem::path& path, nlohmann::json& metadata) const {
-    // Normalize path
-    std::string path_str = path.string();
-    if (path_str.empty() || path_str == ".") {
-        path_str = "/";
-    } else if (path_str[0] != '/') {
-        path_str = "/" + path_str;
+int ftes::TelegramExternalStorage::readObject(const int64_t message_id, const RemoteFile& file,
+                                             char* buf, const size_t size, const off_t offset) {
+    fuse_external_storage::TraceSpan span("storage", "readObject", message_id);
+
+    prefetcher_.onObjectAccess(message_id);
+
+    // Repeated and sequential reads are served from the local cache
+    if (const auto bytes_read = cache_.read(message_id, buf, size, offset)) {
+        return *bytes_read;
     }
 
-    std::cerr << "[removeFileInfo] Removing: " << path_str << std::endl;
+    // Compressed objects can't be streamed into the buffer, they are cached whole first
+    if (file.compression != ChunkCompression::kNone) {
+        if (!fetchCompressedObject(message_id, file)) {
+            return -EIO;
+        }
 
-    if (!metadata.contains("files") || !metadata["files"].is_array()) {
-        return;
+        const auto bytes_read = cache_.read(message_id, buf, size, offset);
+        return bytes_read ? *bytes_read : -EIO;
+    }
+
+    // Before anything is created that would have to be cleaned up
+    TelegramApiFacade* bot = botFor(message_id);
+    if (!bot) {
+        return -EIO;
+    }
+
+    const std::filesystem::path temp_file = cache_.downloadPath(message_id);
+
+    const int fd = open(temp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        FES_LOG(kError) << "[readObject] Failed to create cache file";
+        return -EIO;
     }
 
-    // Use erase-remove idiom to remove all entries with the matching path
-    auto& files = metadata["files"];
-    files.erase(
-        std::remove_if(files.begin(), files.end(),
-            [&path_str](const auto& file) {
-                return file.contains("path") && file["path"] == path_str;
-            }),
-        files.end()
-    );
+    // Each piece goes to the cache file and, where it overlaps the request,
+    // straight into the caller's buffer, so the file is never read back
+    const auto request_begin = static_cast<size_t>(offset);
+    const size_t request_end = request_begin + size;
+    size_t position = 0;
+    size_t bytes_read = 0;
+
+    const bool downloaded = bot->downloadFile(file, [&](const char* data, const size_t length) {
+        const size_t overlap_begin = std::max(position, request_begin);
+        const size_t overlap_end = std::min(position + length, request_end);
 
-    std::cerr << "[removeFileInfo] Metadata now contains " << metadata["files"].size() << " files" << std::endl;
-}
\ No newline at end of file
+        if (overlap_begin < overlap_end) {
+            std::memcpy(buf + (overlap_begin - request_begin), data + (overlap_begin - position), overlap_end - overlap_begin);
+            bytes_read = overlap_end - request_begin;
+        }
+
+        position += length;
+
+        for (size_t written = 0; written < length;) {
+            const ssize_t result = write(fd, data + written, length - written);
+            if (result < 0 && errno != EINTR) {
+                return false;
+            }
+            written += result > 0 ? result : 0;
+        }
+
+        return true;
+    });
+
+    if (close(fd) != 0 || !downloaded) {
+        FES_LOG(kError) << "[readObject] Failed to download message: " << message_id;
+        std::filesystem::remove(temp_file);
+        return -EIO;
+    }
+
+    cache_.insert(message_id, temp_file);
+    return static_cast<int>(bytes_read);
+}
+
+bool ftes::TelegramExternalStorage::fetchCompressedObject(const int64_t message_id, const RemoteFile& file) {
+    fuse_external_storage::TraceSpan span("storage", "fetchCompressedObject", message_id);
+
+    TelegramApiFacade* bot = botFor(message_id);
+    if (!bot) {
+        return false;
+    }
+
+    std::string compressed;
+
+    const bool downloaded = bot->downloadFile(file, [&compressed](const char* data, const size_t length) {
+        compressed.append(data, length);
+        return true;
+    });
+
+    if (!downloaded) {
+        FES_LOG(kError) << "[fetchCompressedObject] Failed to download message: " << message_id;
+        return false;
+    }
+
+    const std::filesystem::path temp_file = cache_.downloadPath(message_id);
+
+    try {
+        const std::string content = ChunkCompressor::decompress(compressed);
+
+        std::ofstream ofs(temp_file, std::ios::binary);
+        ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
+        ofs.close();
+
+        if (!ofs) {
+            throw std::runtime_error("Failed to write cache file");
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[fetchCompressedObject] Message " << message_id << ": " << e.what();
+        std::filesystem::remove(temp_file);
+        return false;
+    }
+
+    cache_.insert(message_id, temp_file);
+    return true;
+}
+
+bool ftes::TelegramExternalStorage::prefetchObject(const int64_t message_id, const RemoteFile& file) {
+    fuse_external_storage::TraceSpan span("storage", "prefetchObject", message_id);
+
+    if (cache_.contains(message_id)) {
+        return true;
+    }
+
+    // Reads someone is waiting for go first
+    RequestScheduler::PriorityScope priority(RequestPriority::kBackground);
+
+    if (file.compression != ChunkCompression::kNone) {
+        return fetchCompressedObject(message_id, file);
+    }
+
+    TelegramApiFacade* bot = botFor(message_id);
+    if (!bot) {
+        return false;
+    }
+
+    const std::filesystem::path temp_file = cache_.downloadPath(message_id);
+
+    if (!bot->downloadFile(file, temp_file)) {
+        std::filesystem::remove(temp_file);
+        return false;
+    }
+
+    cache_.insert(message_id, temp_file);
+    return true;
+}
+
+std::pair<int64_t, ftes::RemoteFile> ftes::TelegramExternalStorage::uploadChunk(const uint32_t slot,
+                                                                                 const std::filesystem::path& staged_file,
+                                                                                 const std::string& name) {
+    fuse_external_storage::TraceSpan span("upload", "uploadChunk", name);
+
+    TelegramApiFacade& bot = *bots_by_slot_.at(slot);
+    ++chunks_uploaded_;
+
+    std::optional<std::string> compressed;
+
+    // Compressed on the upload worker so storeFile doesn't pay for it
+    if (options_.compression.level > 0) {
+        std::ifstream ifs(staged_file, std::ios::binary);
+        if (!ifs) {
+            throw std::runtime_error("Failed to read staged chunk");
+        }
+
+        const std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+        compressed = ChunkCompressor::compress(content, options_.compression);
+
+        if (compressed) {
+            ++chunks_compressed_;
+            compressed_input_bytes_ += content.size();
+            compressed_output_bytes_ += compressed->size();
+        }
+    }
+
+    std::pair<int64_t, RemoteFile> uploaded;
+
+    if (compressed) {
+        const std::filesystem::path compressed_file = cache_.downloadPath(0);
+
+        std::ofstream ofs(compressed_file, std::ios::binary);
+        ofs.write(compressed->data(), static_cast<std::streamsize>(compressed->size()));
+        ofs.close();
+
+        if (!ofs) {
+            std::filesystem::remove(compressed_file);
+            throw std::runtime_error("Failed to write compressed chunk");
+        }
+
+        uploaded = bot.sendFile(compressed_file, name + ".zst");
+        uploaded.second.compression = ChunkCompression::kZstd;
+        std::filesystem::remove(compressed_file);
+    } else {
+        uploaded = bot.sendFile(staged_file, name);
+    }
+
+    if (uploaded.first <= 0 || uploaded.second.empty()) {
+        throw std::runtime_error("Failed to upload chunk");
+    }
+
+    uploaded.first = objectId(slot, uploaded.first);
+
+    // The staged bytes are exactly what a later read would produce
+    cache_.insert(uploaded.first, staged_file);
+    return uploaded;
+}
+
+std::optional<ftes::FileInfo> ftes::TelegramExternalStorage::migrateRemoteFiles(const FileInfo& info) {
+    fuse_external_storage::TraceSpan span("storage", "migrateRemoteFiles", info.path);
+
+    FileInfo migrated = info;
+
+    if (info.chunks.empty()) {
+        const auto file = api_.resolveMessage(info.message_id);
+        if (!file) {
+            return std::nullopt;
+        }
+
+        migrated.file = *file;
+    } else {
+        migrated.chunk_files.resize(info.chunks.size());
+
+        for (size_t i = 0; i < info.chunks.size(); ++i) {
+            if (!migrated.chunk_files[i].empty()) {
+                continue;
+            }
+
+            TelegramApiFacade* bot = botFor(info.chunks[i]);
+            const auto file = bot ? bot->resolveMessage(objectMessage(info.chunks[i])) : std::nullopt;
+            if (!file) {
+                return std::nullopt;
+            }
+
+            migrated.chunk_files[i] = *file;
+        }
+    }
+
+    FES_LOG(kDebug) << "[migrateRemoteFiles] Recorded file IDs of " << info.path;
+
+    // Recorded with the next metadata commit unless the file changed in the meantime
+    std::lock_guard mutation_lock(mutation_mutex_);
+
+    const auto current = findFileInfo(info.path);
+    if (current && current->message_id == info.message_id && current->chunks == info.chunks) {
+        putFileInfo(migrated);
+        updateMetadata();
+    }
+
+    return migrated;
+}
+
+void ftes::TelegramExternalStorage::finishUpload(const std::shared_ptr<PendingUpload>& pending) {
+    PendingUpload& upload = *pending;
+    fuse_external_storage::TraceSpan span("upload", "finishUpload", upload.updated.path);
+
+    RequestScheduler::PriorityScope priority(RequestPriority::kUpload);
+
+    FileInfo& updated = upload.updated;
+    std::vector<int64_t> uploaded;
+    std::vector<const StagedChunk*> deduplicated;
+
+    // Don't leave orphaned chunks of an attempt that never made it into the metadata
+    const auto delete_uploaded = [this, &uploaded] {
+        for (const int64_t message_id : uploaded) {
+            {
+                std::shared_lock lock(index_mutex_);
+                if (index_.references(message_id) > 0) {
+                    continue;
+                }
+            }
+
+            deleteObject(message_id);
+            cache_.erase(message_id);
+        }
+    };
+
+    const auto discard = [this, &upload, &delete_uploaded] {
+        delete_uploaded();
+
+        for (const auto& staged : upload.staged_chunks) {
+            std::filesystem::remove(staged.file);
+        }
+
+        std::unique_lock lock(index_mutex_);
+        staged_files_.erase(upload.updated.path);
+        staged_cv_.notify_all();
+    };
+
+    const std::string name = std::filesystem::path(updated.path).filename().string();
+
+    std::mutex uploaded_mutex;
+
+    const auto upload_chunk = [&](const StagedChunk& staged) {
+        auto [message_id, file] = uploadChunk(placeChunk(updated.path, staged.index), staged.file,
+                                              name + ".part" + std::to_string(staged.index));
+
+        updated.chunks[staged.index] = message_id;
+        updated.chunk_files[staged.index] = std::move(file);
+
+        std::lock_guard lock(uploaded_mutex);
+        uploaded.push_back(message_id);
+    };
+
+    try {
+        // Identical chunks within a file are common, only the first of them is stored
+        std::unordered_map<std::string, const StagedChunk*> first_with_hash;
+        std::vector<std::pair<const StagedChunk*, const StagedChunk*>> copies;
+        std::map<uint32_t, std::vector<const StagedChunk*>> uploads_by_slot;
+
+        for (const auto& staged : upload.staged_chunks) {
+            updated.chunk_hashes[staged.index] = staged.hash;
+
+            if (const auto [first, inserted] = first_with_hash.try_emplace(staged.hash, &staged); !inserted) {
+                copies.emplace_back(&staged, first->second);
+                continue;
+            }
+
+            std::optional<std::pair<int64_t, RemoteFile>> existing;
+            {
+                std::shared_lock lock(index_mutex_);
+                existing = index_.findObject(staged.hash);
+            }
+
+            // Identical content is already stored, refer to it instead of uploading it again
+            if (existing) {
+                std::tie(updated.chunks[staged.index], updated.chunk_files[staged.index]) = *existing;
+                deduplicated.push_back(&staged);
+                continue;
+            }
+
+            uploads_by_slot[placeChunk(updated.path, staged.index)].push_back(&staged);
+        }
+
+        // Bots are rate limited separately, so the chunks of each go through
+        // that bot's upload lane and the bots upload at the same time
+        std::vector<std::exception_ptr> errors(uploads_by_slot.size());
+        size_t bot = 0;
+
+        for (const auto& [slot, chunks] : uploads_by_slot) {
+            const auto upload_all = [&upload_chunk, &errors, &chunks, bot] {
+                RequestScheduler::PriorityScope priority(RequestPriority::kUpload);
+
+                try {
+                    for (const StagedChunk* staged : chunks) {
+                        upload_chunk(*staged);
+                    }
+                } catch (...) {
+                    errors[bot] = std::current_exception();
+                }
+            };
+
+            if (uploads_by_slot.size() == 1) {
+                upload_all();
+            } else {
+                upload_lanes_.at(slot)->submit(updated.path, 0, upload_all);
+            }
+            ++bot;
+        }
+
+        if (uploads_by_slot.size() > 1) {
+            for (const uint32_t slot : uploads_by_slot | std::views::keys) {
+                upload_lanes_.at(slot)->wait(updated.path);
+            }
+        }
+
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        std::unique_lock mutation_lock(mutation_mutex_);
+        std::optional<FileInfo> current;
+
+        while (true) {
+            current = findFileInfo(updated.path);
+            if (!current || current->is_dir) {
+                FES_LOG(kWarning) << "[finishUpload] " << updated.path << " was removed while uploading";
+                discard();
+                return;
+            }
+
+            // A reused message may have lost its last reference while this
+            // version was uploading, its chunks are uploaded after all then
+            std::vector<const StagedChunk*> lost;
+            {
+                std::shared_lock lock(index_mutex_);
+
+                for (const StagedChunk* staged : deduplicated) {
+                    const int64_t message_id = updated.chunks[staged->index];
+
+                    if (index_.references(message_id) == 0 && std::ranges::find(uploaded, message_id) == uploaded.end()) {
+                        lost.push_back(staged);
+                    }
+                }
+            }
+
+            if (lost.empty()) {
+                break;
+            }
+
+            // Uploads are rate limited, every other mutation would wait for them
+            // under the lock. Others may have gone meanwhile, so check again after
+            mutation_lock.unlock();
+
+            for (const StagedChunk* staged : lost) {
+                upload_chunk(*staged);
+            }
+            std::erase_if(deduplicated, [&lost](const StagedChunk* staged) {
+                return std::ranges::find(lost, staged) != lost.end();
+            });
+
+            mutation_lock.lock();
+        }
+
+        for (const StagedChunk* staged : deduplicated) {
+            cache_.insert(updated.chunks[staged->index], staged->file);
+        }
+
+        for (const auto& [copy, first] : copies) {
+            updated.chunks[copy->index] = updated.chunks[first->index];
+            updated.chunk_files[copy->index] = updated.chunk_files[first->index];
+        }
+
+        if (!deduplicated.empty()) {
+            FES_LOG(kDebug) << "[finishUpload] " << updated.path << ": " << deduplicated.size() << " of "
+                            << upload.staged_chunks.size() << " changed chunks were already stored";
+        }
+
+        {
+            std::unique_lock lock(index_mutex_);
+            staged_files_.erase(updated.path);
+        }
+        staged_cv_.notify_all();
+
+        putFileInfo(updated);
+        updateMetadata();
+
+        // Messages of the previous version that no entry refers to anymore
+        deleteContent(*current);
+
+        // Duplicates were never uploaded or cached, their staged copies are left over
+        for (const auto& [copy, first] : copies) {
+            std::error_code ec;
+            std::filesystem::remove(copy->file, ec);
+        }
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[finishUpload] Failed to store " << updated.path << ", keeping it for a retry: "
+                        << e.what();
+
+        // The staged chunks stay, the next use of the path retries the upload
+        delete_uploaded();
+        upload.failed_at = std::chrono::steady_clock::now();
+
+        std::unique_lock lock(index_mutex_);
+        failed_uploads_[updated.path] = pending;
+        staged_cv_.notify_all();
+    }
+}
+
+ftes::TelegramApiFacade* ftes::TelegramExternalStorage::botFor(const int64_t object_id) const {
+    const auto bot = bots_by_slot_.find(objectSlot(object_id));
+
+    if (bot == bots_by_slot_.end()) {
+        FES_LOG(kWarning) << "[botFor] Object " << objectMessage(object_id) << " is stored with bot slot "
+                          << objectSlot(object_id) << ", which isn't configured";
+        return nullptr;
+    }
+
+    return bot->second;
+}
+
+bool ftes::TelegramExternalStorage::deleteObject(const int64_t object_id) const {
+    TelegramApiFacade* bot = botFor(object_id);
+    return bot && bot->deleteMessage(objectMessage(object_id));
+}
+
+uint32_t ftes::TelegramExternalStorage::placeChunk(const std::string& path, const size_t index) const {
+    // FNV-1a, so a file starts on the same bot on every build
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char c : path) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+    }
+
+    return placement_slots_[(hash + index) % placement_slots_.size()];
+}
+
+void ftes::TelegramExternalStorage::registerBots() {
+    {
+        std::unique_lock lock(index_mutex_);
+        const size_t pending = pending_ops_.size();
+
+        for (const auto& bot : extra_bots_) {
+            const int64_t bot_id = bot->botId();
+            const auto& table = index_.bots();
+
+            const auto known = std::ranges::find(bots_by_slot_, bot.get(), [](const auto& entry) { return entry.second; });
+            const auto recorded = std::ranges::find(table, bot_id, [](const auto& entry) { return entry.second; });
+
+            // A bot keeps its slot for good, objects carry it in their IDs
+            uint32_t slot = table.empty() ? 1 : table.rbegin()->first + 1;
+            if (known != bots_by_slot_.end()) {
+                slot = known->first;
+            } else if (recorded != table.end()) {
+                slot = recorded->first;
+            }
+
+            if (const auto it = table.find(slot); it == table.end()) {
+                index_.setBot(slot, bot_id);
+                pending_ops_.push_back(MetadataIndex::botRecord(slot, bot_id));
+            } else if (it->second != bot_id) {
+                throw std::runtime_error("Bot slot " + std::to_string(slot) + " is taken by another bot");
+            }
+
+            if (known == bots_by_slot_.end()) {
+                bots_by_slot_.emplace(slot, bot.get());
+            }
+        }
+
+        if (pending_ops_.size() == pending) {
+            return;
+        }
+    }
+
+    FES_LOG(kInfo) << "[registerBots] Recorded " << extra_bots_.size() << " extra bots in the metadata";
+    updateMetadata();
+}
+
+void ftes::TelegramExternalStorage::deleteContent(const FileInfo& info) {
+    fuse_external_storage::TraceSpan span("storage", "deleteContent", info.path);
+
+    std::vector<int64_t> message_ids = info.chunks;
+    if (info.message_id > 0) {
+        message_ids.push_back(info.message_id);
+    }
+
+    // A file may use one message for several identical chunks
+    std::ranges::sort(message_ids);
+    message_ids.erase(std::ranges::unique(message_ids).begin(), message_ids.end());
+
+    for (const int64_t message_id : message_ids) {
+        {
+            std::shared_lock lock(index_mutex_);
+            if (index_.references(message_id) > 0) {
+                continue;
+            }
+        }
+
+        cache_.erase(message_id);
+
+        if (!deleteObject(message_id)) {
+            FES_LOG(kError) << "[deleteContent] Failed to delete message: " << message_id;
+            // Continue anyway to clean up metadata
+        }
+    }
+}
+
+void ftes::TelegramExternalStorage::loadMetadata() {
+    fuse_external_storage::TraceSpan span("metadata", "loadMetadata");
+
+    json metadata = api_.getMetadata();
+
+    if (metadata.is_null()) {
+        metadata = json{{"files", json::array()}};
+    }
+
+    // Mutations committed after the snapshot was written
+    const std::vector<json> journal = api_.getJournal();
+
+    std::unique_lock lock(index_mutex_);
+    index_.load(metadata);
+
+    for (const auto& record : journal) {
+        if (record.value("version", uint64_t{0}) > index_.version()) {
+            index_.apply(record);
+        }
+    }
+
+    pending_ops_ = json::array();
+    last_revalidation_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    last_snapshot_ = std::chrono::steady_clock::now();
+
+    FES_LOG(kInfo) << "[loadMetadata] Loaded " << index_.size() << " entries (version "
+                   << index_.version() << ", " << journal.size() << " journal records)";
+}
+
+void ftes::TelegramExternalStorage::refreshMetadata() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto last = std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last_revalidation_.load()));
+
+    if (now - last < revalidate_interval_) {
+        return;
+    }
+    last_revalidation_ = now.time_since_epoch().count();
+
+    // Only revalidations that go to the API are traced
+    fuse_external_storage::TraceSpan span("metadata", "refreshMetadata");
+
+    // A changed pinned message or journal means another mount committed newer metadata
+    const MetadataRevision pinned = api_.getPinnedRevision();
+    if (pinned.message_id == 0 || pinned == api_.getMetadataRevision()) {
+        return;
+    }
+
+    std::lock_guard mutation_lock(mutation_mutex_);
+    if (pinned != api_.getMetadataRevision()) {
+        FES_LOG(kInfo) << "[refreshMetadata] Pinned metadata changed, reloading";
+
+        // Committing the batch now would go against our stale index and could
+        // pin it over the newer snapshot. It is replayed on top of the remote
+        // metadata instead and committed against the new revision
+        json batch = std::exchange(pending_ops_, json::array());
+        loadMetadata();
+
+        if (!batch.empty()) {
+            {
+                std::unique_lock lock(index_mutex_);
+                index_.apply(json{{"ops", batch}});
+            }
+
+            FES_LOG(kInfo) << "[refreshMetadata] Replayed " << batch.size() << " batched operations";
+            pending_ops_ = std::move(batch);
+        }
+
+        registerBots();
+        commitPending();
+
+        if (remote_change_listener_) {
+            remote_change_listener_();
+        }
+    }
+}
+
+void ftes::TelegramExternalStorage::updateMetadata() {
+    // Without a batch window every mutation is committed before returning
+    if (!commit_thread_.joinable()) {
+        commitPending();
+        return;
+    }
+
+    commit_cv_.notify_one();
+}
+
+void ftes::TelegramExternalStorage::commitPending() {
+    if (pending_ops_.empty()) {
+        return;
+    }
+
+    fuse_external_storage::TraceSpan span("metadata", "commitPending");
+
+    json record;
+
+    {
+        std::unique_lock lock(index_mutex_);
+        index_.bumpVersion();
+
+        record = {{"version", index_.version()}, {"ops", std::move(pending_ops_)}};
+        pending_ops_ = json::array();
+    }
+
+    FES_LOG(kDebug) << "[commitPending] Committing " << record["ops"].size() << " operations (version "
+                    << record["version"] << ")";
+
+    // Mutations normally cost one small journal message; the full snapshot is
+    // only rewritten once the journal is long or old enough
+    const bool compaction_due =
+        options_.journal_max_records == 0 ||
+        api_.getMetadataRevision().journal_length >= options_.journal_max_records ||
+        std::chrono::steady_clock::now() - last_snapshot_ >= options_.journal_compaction_interval;
+
+    try {
+        if (!compaction_due && api_.appendJournal(record)) {
+            return;
+        }
+
+        writeSnapshot();
+    } catch (...) {
+        // Keep the operations so the next commit retries them
+        for (auto& op : pending_ops_) {
+            record["ops"].push_back(std::move(op));
+        }
+        pending_ops_ = std::move(record["ops"]);
+
+        throw;
+    }
+}
+
+void ftes::TelegramExternalStorage::commitLoop() {
+    RequestScheduler::PriorityScope priority(RequestPriority::kMetadata);
+    std::unique_lock mutation_lock(mutation_mutex_);
+
+    while (true) {
+        commit_cv_.wait(mutation_lock, [this] { return stopping_ || !pending_ops_.empty(); });
+
+        // The batch window starts with its first mutation, a full batch or a sync ends it early
+        const auto deadline = std::chrono::steady_clock::now() + options_.commit_delay;
+        commit_cv_.wait_until(mutation_lock, deadline, [this] {
+            return stopping_ || pending_ops_.empty() || pending_ops_.size() >= options_.commit_max_batch;
+        });
+
+        // The destructor commits what is left
+        if (stopping_) {
+            break;
+        }
+
+        try {
+            commitPending();
+        } catch (const std::exception& e) {
+            // The operations stay pending and are retried after another window
+            FES_LOG(kError) << "[commitLoop] Failed to commit metadata: " << e.what();
+        }
+    }
+}
+
+void ftes::TelegramExternalStorage::writeSnapshot() {
+    json metadata;
+
+    {
+        std::shared_lock lock(index_mutex_);
+        metadata = index_.toJson();
+    }
+
+    [[maybe_unused]] auto result = api_.updateMetadata(metadata);
+    last_snapshot_ = std::chrono::steady_clock::now();
+}
+
+bool ftes::TelegramExternalStorage::hasStagedVersion(const std::string& key) const {
+    std::shared_lock lock(index_mutex_);
+    return staged_files_.contains(key);
+}
+
+int ftes::TelegramExternalStorage::waitForStagedVersion(const std::string& key) {
+    {
+        // The version may not have been submitted yet, so the executor can't be asked
+        std::unique_lock lock(index_mutex_);
+        staged_cv_.wait(lock, [this, &key] { return !staged_files_.contains(key) || failed_uploads_.contains(key); });
+    }
+
+    return waitForUpload(key);
+}
+
+int ftes::TelegramExternalStorage::waitForUpload(const std::string& key) {
+    uploads_.wait(key);
+
+    std::shared_ptr<PendingUpload> failed;
+    {
+        std::unique_lock lock(index_mutex_);
+        const auto it = failed_uploads_.find(key);
+        if (it == failed_uploads_.end()) {
+            return 0;
+        }
+
+        // Reads come in small blocks, each of them mustn't upload the file again
+        if (std::chrono::steady_clock::now() - it->second->failed_at < kUploadRetryInterval) {
+            return -EIO;
+        }
+
+        failed = std::move(it->second);
+        failed_uploads_.erase(it);
+    }
+
+    FES_LOG(kInfo) << "[waitForUpload] Retrying the upload of " << key;
+
+    uploads_.submit(key, 0, [this, failed] { finishUpload(failed); });
+    uploads_.wait(key);
+
+    std::shared_lock lock(index_mutex_);
+    return failed_uploads_.contains(key) ? -EIO : 0;
+}
+
+void ftes::TelegramExternalStorage::dropFailedUpload(const std::string& key) {
+    std::shared_ptr<PendingUpload> failed;
+    {
+        std::unique_lock lock(index_mutex_);
+        const auto it = failed_uploads_.find(key);
+        if (it == failed_uploads_.end()) {
+            return;
+        }
+
+        failed = std::move(it->second);
+        failed_uploads_.erase(it);
+        staged_files_.erase(key);
+    }
+    staged_cv_.notify_all();
+
+    for (const auto& staged : failed->staged_chunks) {
+        std::error_code ec;
+        std::filesystem::remove(staged.file, ec);
+    }
+}
+
+std::optional<ftes::FileInfo> ftes::TelegramExternalStorage::findFileInfo(const std::filesystem::path& path) const {
+    std::shared_lock lock(index_mutex_);
+    auto result = index_.find(path);
+
+    if (result) {
+        FES_LOG(kDebug) << "[findFileInfo] Found file: " << result->path
+                        << " (message_id: " << result->message_id
+                        << ", size: " << result->size << ")";
+    } else {
+        FES_LOG(kDebug) << "[findFileInfo] File not found: " << MetadataIndex::normalizePath(path);
+    }
+
+    return result;
+}
+
+void ftes::TelegramExternalStorage::putFileInfo(FileInfo info) {
+    std::unique_lock lock(index_mutex_);
+
+    pending_ops_.push_back(MetadataIndex::putRecord(info));
+    index_.upsert(std::move(info));
+}
+
+void ftes::TelegramExternalStorage::addFileInfo(const std::filesystem::path& path,
+                                              int64_t message_id,
+                                              size_t size,
+                                              bool is_dir) {
+    const time_t now = time(nullptr);
+
+    FileInfo info;
+    info.path = MetadataIndex::normalizePath(path);
+    info.message_id = message_id;
+    info.size = size;
+    info.is_dir = is_dir;
+    info.ctime = now;
+    info.mtime = now;
+
+    FES_LOG(kDebug) << "[addFileInfo] Added file to metadata: " << info.path
+                    << " (message_id: " << message_id << ", size: " << size << ", is_dir: " << is_dir << ")";
+
+    putFileInfo(std::move(info));
+}
+
+void ftes::TelegramExternalStorage::removeFileInfo(const std::filesystem::path& path) {
+    FES_LOG(kDebug) << "[removeFileInfo] Removing: " << MetadataIndex::normalizePath(path);
+
+    std::unique_lock lock(index_mutex_);
+    if (index_.erase(path)) {
+        pending_ops_.push_back(MetadataIndex::eraseRecord(path));
+    }
+
+    FES_LOG(kDebug) << "[removeFileInfo] Metadata now contains " << index_.size() << " files";
+}
@@ -1,12 +1,26 @@
 #ifndef TELEGRAM_EXTERNAL_STORAGE_HPP
 #define TELEGRAM_EXTERNAL_STORAGE_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <nlohmann/json.hpp>
 #include "lib/telegram-api/telegram-api.hpp"
+#include "lib/chunk-compressor/chunk-compressor.hpp"
+#include "lib/metadata-index/metadata-index.hpp"
+#include "lib/content-cache/content-cache.hpp"
+#include "lib/prefetcher/prefetcher.hpp"
+#include "lib/upload-executor/upload-executor.hpp"
 #include "lib/external-storage-interface.hpp"
 
 #define FUSE_USE_VERSION 31
@@ -14,11 +28,56 @@
 
 namespace fuse_telegram_external_storage {
 
+    // A bot chunks are striped to besides the one holding the metadata,
+    // with the chat it stores them in
+    struct ExtraBot {
+        std::string api_token;
+        int64_t chat_id = 0;
+    };
+
+    struct TelegramStorageOptions {
+        // Connections, rate limits, chat and server of the main bot. Extra bots
+        // use the same settings with their own chat
+        TelegramApiOptions api;
+
+        // Each bot has rate limits of its own, so striping chunks across
+        // several of them multiplies upload and download throughput
+        std::vector<ExtraBot> extra_bots;
+
+        std::filesystem::path cache_dir = std::filesystem::temp_directory_path() / "fuse-external-storage";
+        uint64_t cache_size_bytes = 1ULL << 30;
+
+        // Files are stored as parts of this size, one message each
+        size_t chunk_size_bytes = 8ULL << 20;
+
+        // Chunks are zstd-compressed on upload when it pays off, off by default
+        CompressionOptions compression;
+
+        PrefetchOptions prefetch;
+
+        // Stored files are staged locally and uploaded in the background
+        UploadExecutorOptions upload;
+
+        // Mutations are journaled as small delta documents; the full snapshot is
+        // rewritten after this many records (0 disables journaling) or this much time
+        size_t journal_max_records = 64;
+        std::chrono::seconds journal_compaction_interval{600};
+
+        // Mutations are committed together once the oldest one has waited this
+        // long or this many have piled up; a zero delay commits every mutation
+        std::chrono::milliseconds commit_delay{1000};
+        size_t commit_max_batch = 512;
+    };
+
     class TelegramExternalStorage final : public fuse_external_storage::ExternalStorageInterface {
     public:
-        explicit TelegramExternalStorage(const std::string& api_token);
+        explicit TelegramExternalStorage(const std::string& api_token, const TelegramStorageOptions& options = {});
         ~TelegramExternalStorage() override;
 
+        // Long polling, background uploads, prefetching and batched commits.
+        // Until then uploads and commits finish before the call returns
+        void start() override;
+
         struct stat getAttr(std::filesystem::path& path) override;
         std::vector<FileInfo> listDir(const std::filesystem::path& path) override;
         int createFile(const std::filesystem::path& path, mode_t mode) override;
@@ -28,17 +87,163 @@ namespace fuse_telegram_external_storage {
         int createDir(const std::filesystem::path& path, mode_t mode) override;
         int removeDir(const std::filesystem::path& path) override;
         int rename(const std::filesystem::path& from, const std::filesystem::path& to) override;
+        int fetchFile(const std::filesystem::path& path, const std::filesystem::path& local_path) override;
+        int storeFile(const std::filesystem::path& path, const std::filesystem::path& local_path,
+                      const std::vector<fuse_external_storage::ByteRange>& dirty_ranges) override;
+        int syncMetadata() override;
+        int checkUpload(const std::filesystem::path& path, bool wait) override;
+
+        // Bot API calls of every bot, labelled with its ID
+        void writeStats(std::string& out) const override;
+
+        // Told when refreshMetadata reloads metadata committed by another mount
+        void setRemoteChangeListener(std::function<void()> listener) override;
 
     private:
+        TelegramStorageOptions options_;
         TelegramApiFacade api_;
         std::thread bot_thread_;
 
+        // Bots chunks are striped across besides api_, by the slot in the upper
+        // half of their object IDs. Slot 0 is api_, whose IDs are plain message IDs
+        std::vector<std::unique_ptr<TelegramApiFacade>> extra_bots_;
+        std::unordered_map<uint32_t, TelegramApiFacade*> bots_by_slot_;
+        std::vector<uint32_t> placement_slots_;
+
+        // Metadata is downloaded once at mount and then served from memory
+        MetadataIndex index_;
+        mutable std::shared_mutex index_mutex_;
+
+        // Downloaded content, keyed by message ID, in a subdirectory of
+        // options_.cache_dir for the main bot and its chat
+        ContentCache cache_;
+
+        // Fills cache_ ahead of sequential readers and directory walks
+        Prefetcher prefetcher_;
+
+        // With extra bots, a pool per placement slot the chunks of every upload
+        // are handed to, keyed by path, so the bots upload side by side
+        std::unordered_map<uint32_t, std::unique_ptr<UploadExecutor>> upload_lanes_;
+
+        // Uploads of stored files, keyed by normalized path so versions of a file land in order
+        UploadExecutor uploads_;
+
+        // Size and times of files whose new content is still uploading, guarded by index_mutex_
+        std::unordered_map<std::string, FileInfo> staged_files_;
+
+        // Signalled when a staged version is committed, dropped or fails to upload
+        std::condition_variable_any staged_cv_;
+
+        // Uploaded chunks and how many of them were stored compressed
+        std::atomic<uint64_t> chunks_uploaded_{0};
+        std::atomic<uint64_t> chunks_compressed_{0};
+        std::atomic<uint64_t> compressed_input_bytes_{0};
+        std::atomic<uint64_t> compressed_output_bytes_{0};
+
+        // Serializes mutations so the index and the remote copy change in the same order
+        std::mutex mutation_mutex_;
+
+        // How often the pinned message is checked for changes made by another mount
+        std::chrono::seconds revalidate_interval_{30};
+        std::atomic<std::chrono::steady_clock::rep> last_revalidation_{0};
+
+        // Called after such a reload, guarded by mutation_mutex_
+        std::function<void()> remote_change_listener_;
+
+        // Journal operations not committed yet, guarded by mutation_mutex_
+        nlohmann::json pending_ops_ = nlohmann::json::array();
+        std::chrono::steady_clock::time_point last_snapshot_;
+
+        // Background commit of batched mutations, woken through commit_cv_
+        std::condition_variable commit_cv_;
+        bool stopping_ = false;
+        std::jthread commit_thread_;
+
         // Helper methods
-        nlohmann::json getMetadata() const;
-        void updateMetadata(const nlohmann::json& metadata) const;
-        FileInfo* findFileInfo(const std::filesystem::path& path, nlohmann::json& metadata) const;
-        void addFileInfo(const std::filesystem::path& path, int64_t message_id, size_t size, bool is_dir, nlohmann::json& metadata) const;
-        void removeFileInfo(const std::filesystem::path& path, nlohmann::json& metadata) const;
+        void loadMetadata();
+        void refreshMetadata();
+        void updateMetadata();
+        void commitPending();
+        void commitLoop();
+        void writeSnapshot();
+        std::optional<FileInfo> findFileInfo(const std::filesystem::path& path) const;
+        bool hasStagedVersion(const std::string& key) const;
+
+        // Waits for the uploads of key and retries a failed one, -EIO if it failed again
+        int waitForUpload(const std::string& key);
+
+        // Waits until the staged version of key has landed, like waitForUpload
+        // but also for a version that is staged and not submitted yet
+        int waitForStagedVersion(const std::string& key);
+
+        // Forgets a failed upload of a path that is replaced or removed
+        void dropFailedUpload(const std::string& key);
+        void putFileInfo(FileInfo info);
+        void addFileInfo(const std::filesystem::path& path, int64_t message_id, size_t size, bool is_dir);
+        void removeFileInfo(const std::filesystem::path& path);
+
+        // Record the slots of the extra bots in the metadata, the first time
+        // they are used or again after a reload lost them
+        void registerBots();
+
+        static int64_t objectId(uint32_t slot, int64_t message_id) {
+            return static_cast<int64_t>(static_cast<uint64_t>(slot) << 32 | static_cast<uint32_t>(message_id));
+        }
+        static uint32_t objectSlot(const int64_t object_id) { return static_cast<uint64_t>(object_id) >> 32; }
+        static int64_t objectMessage(const int64_t object_id) { return object_id & 0xffffffff; }
+
+        // Bot an object is stored with, null if it isn't configured on this mount
+        TelegramApiFacade* botFor(int64_t object_id) const;
+        bool deleteObject(int64_t object_id) const;
+
+        // Slot a chunk of a new version goes to. Consecutive chunks of a file
+        // land on different bots, so sequential reads and writes use all of them
+        uint32_t placeChunk(const std::string& path, size_t index) const;
+
+        // Read from one stored object (a chunk or a whole legacy file) through the cache
+        int readObject(int64_t message_id, const RemoteFile& file, char* buf, size_t size, off_t offset);
+
+        // Download a compressed object and cache its decompressed content
+        bool fetchCompressedObject(int64_t message_id, const RemoteFile& file);
+
+        // Upload a staged chunk, compressed if that's enabled and worth it. The
+        // cache always holds the uncompressed bytes
+        std::pair<int64_t, RemoteFile> uploadChunk(uint32_t slot, const std::filesystem::path& staged_file,
+                                                   const std::string& name);
+
+        // Record the file IDs of an entry written before they were kept in the metadata
+        std::optional<FileInfo> migrateRemoteFiles(const FileInfo& info);
+
+        // A stored version whose changed chunks are staged in the cache directory
+        struct StagedChunk {
+            size_t index;
+            std::filesystem::path file;
+            std::string hash;
+        };
+
+        struct PendingUpload {
+            FileInfo updated;
+            std::vector<StagedChunk> staged_chunks;
+            std::chrono::steady_clock::time_point failed_at; // of the last attempt
+        };
+
+        // How long a failed upload rests before the path's next use retries it
+        static constexpr std::chrono::seconds kUploadRetryInterval{5};
+
+        // Versions whose upload failed after storeFile returned, by normalized
+        // path, guarded by index_mutex_. Their staged chunks and staged_files_
+        // entry are kept, the upload is retried when the path is used next
+        std::unordered_map<std::string, std::shared_ptr<PendingUpload>> failed_uploads_;
+
+        // Upload the staged chunks of a stored version and commit it, runs on
+        // an upload worker. A failed upload ends up in failed_uploads_
+        void finishUpload(const std::shared_ptr<PendingUpload>& pending);
+
+        // Download one object into the cache without reading it, used by the prefetcher
+        bool prefetchObject(int64_t message_id, const RemoteFile& file);
+
+        // Delete the messages of a removed or replaced entry that no entry refers to anymore
+        void deleteContent(const FileInfo& info);
     };
 
 } // namespace fuse_telegram_external_storage
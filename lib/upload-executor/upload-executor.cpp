@@ -0,0 +1,160 @@
+#include "upload-executor.hpp"
+
+#include <algorithm>
+
+#include "lib/logger/logger.hpp"
+#include "lib/span-tracer/span-tracer.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+ftes::UploadExecutor::UploadExecutor(UploadExecutorOptions options)
+    : options_(options)
+{
+    options_.workers = std::max<size_t>(options_.workers, 1);
+    options_.max_queued = std::max<size_t>(options_.max_queued, 1);
+}
+
+ftes::UploadExecutor::~UploadExecutor() {
+    waitAll();
+
+    for (auto& worker : workers_) {
+        worker.request_stop();
+    }
+    queue_cv_.notify_all();
+    workers_.clear();
+}
+
+void ftes::UploadExecutor::start() {
+    std::lock_guard lock(mutex_);
+
+    if (!workers_.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < options_.workers; ++i) {
+        workers_.emplace_back([this](const std::stop_token& stop_token) { workerLoop(stop_token); });
+    }
+}
+
+void ftes::UploadExecutor::submit(const std::string& key, const uint64_t bytes, std::function<void()> task) {
+    {
+        std::unique_lock lock(mutex_);
+
+        // Nothing would pick the task up, the submitter runs it
+        if (workers_.empty()) {
+            ++stats_.submitted;
+            lock.unlock();
+
+            run({key, bytes, std::move(task)});
+
+            lock.lock();
+            ++stats_.completed;
+            return;
+        }
+
+        const auto has_room = [this, bytes] {
+            return in_flight_ == 0 ||
+                   (in_flight_ < options_.max_queued && in_flight_bytes_ + bytes <= options_.max_queued_bytes);
+        };
+
+        // Backpressure: the writer waits here instead of staging without bound
+        if (!has_room()) {
+            ++stats_.throttled;
+            done_cv_.wait(lock, has_room);
+        }
+
+        ++in_flight_;
+        in_flight_bytes_ += bytes;
+        ++pending_[key];
+        queue_.push_back({key, bytes, std::move(task)});
+        ++stats_.submitted;
+    }
+
+    queue_cv_.notify_one();
+}
+
+void ftes::UploadExecutor::wait(const std::string& key) {
+    std::unique_lock lock(mutex_);
+    if (!pending_.contains(key)) {
+        return;
+    }
+
+    // Only calls that actually block are traced
+    fuse_external_storage::TraceSpan span("upload", "uploadWait", key);
+    done_cv_.wait(lock, [this, &key] { return !pending_.contains(key); });
+}
+
+void ftes::UploadExecutor::waitAll() {
+    std::unique_lock lock(mutex_);
+    if (in_flight_ == 0) {
+        return;
+    }
+
+    fuse_external_storage::TraceSpan span("upload", "uploadWaitAll");
+    done_cv_.wait(lock, [this] { return in_flight_ == 0; });
+}
+
+bool ftes::UploadExecutor::hasPending(const std::string& key) const {
+    std::lock_guard lock(mutex_);
+    return pending_.contains(key);
+}
+
+ftes::UploadExecutor::Stats ftes::UploadExecutor::stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+void ftes::UploadExecutor::workerLoop(const std::stop_token& stop_token) {
+    while (true) {
+        Task task;
+
+        {
+            std::unique_lock lock(mutex_);
+
+            // The oldest task whose key no other worker is busy with, which
+            // keeps the tasks of one key in submission order
+            auto next = queue_.end();
+            const auto runnable = [this, &next] {
+                next = std::ranges::find_if(queue_, [this](const Task& queued) {
+                    return !running_.contains(queued.key);
+                });
+                return next != queue_.end();
+            };
+
+            if (!queue_cv_.wait(lock, stop_token, runnable)) {
+                return;
+            }
+
+            task = std::move(*next);
+            queue_.erase(next);
+            running_.insert(task.key);
+        }
+
+        run(task);
+
+        {
+            std::lock_guard lock(mutex_);
+
+            running_.erase(task.key);
+            if (--pending_[task.key] == 0) {
+                pending_.erase(task.key);
+            }
+
+            --in_flight_;
+            in_flight_bytes_ -= task.bytes;
+            ++stats_.completed;
+        }
+
+        // Another task of the same key may have become runnable
+        queue_cv_.notify_all();
+        done_cv_.notify_all();
+    }
+}
+
+void ftes::UploadExecutor::run(const Task& task) {
+    try {
+        task.run();
+    } catch (const std::exception& e) {
+        FES_LOG(kError) << "[UploadExecutor] Error uploading " << task.key << ": " << e.what();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef UPLOAD_EXECUTOR_HPP
+#define UPLOAD_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fuse_telegram_external_storage {
+
+    struct UploadExecutorOptions {
+        size_t workers = 4;
+
+        // Limits on queued plus running uploads, submitters block beyond them
+        size_t max_queued = 16;
+        uint64_t max_queued_bytes = 256ULL << 20;
+    };
+
+    // Runs uploads on a fixed pool of worker threads. Tasks sharing a key run
+    // one at a time in submission order, tasks with different keys overlap.
+    // Until the pool is started, tasks run on the thread submitting them
+    class UploadExecutor {
+    public:
+        struct Stats {
+            uint64_t submitted = 0;
+            uint64_t completed = 0;
+            uint64_t throttled = 0; // submissions that had to wait for room in the queue
+        };
+
+        explicit UploadExecutor(UploadExecutorOptions options);
+
+        // Runs whatever is still queued before returning
+        ~UploadExecutor();
+
+        UploadExecutor(const UploadExecutor&) = delete;
+        UploadExecutor& operator=(const UploadExecutor&) = delete;
+
+        // Starts the workers, once the process won't fork anymore
+        void start();
+
+        // Blocks while the queue is full. A task larger than the byte limit
+        // is still accepted once the queue has drained
+        void submit(const std::string& key, uint64_t bytes, std::function<void()> task);
+
+        // Block until every task submitted so far under key, or under any key, has finished
+        void wait(const std::string& key);
+        void waitAll();
+
+        [[nodiscard]] bool hasPending(const std::string& key) const;
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct Task {
+            std::string key;
+            uint64_t bytes;
+            std::function<void()> run;
+        };
+
+        void workerLoop(const std::stop_token& stop_token);
+        static void run(const Task& task);
+
+        UploadExecutorOptions options_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable_any queue_cv_;
+        std::condition_variable done_cv_;
+        std::deque<Task> queue_;
+
+        // Queued plus running tasks per key, and the keys a worker is busy with
+        std::unordered_map<std::string, size_t> pending_;
+        std::unordered_set<std::string> running_;
+        size_t in_flight_ = 0;
+        uint64_t in_flight_bytes_ = 0;
+
+        Stats stats_;
+
+        std::vector<std::jthread> workers_;
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //UPLOAD_EXECUTOR_HPP
@@ -0,0 +1,607 @@
+#include "fake-bot-api.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace ftes = fuse_telegram_external_storage;
+
+using json = nlohmann::json;
+
+namespace {
+
+    // Bot tokens look like "<bot id>:<secret>", the id doubles as the bot's user id
+    int64_t botIdFromToken(const std::string& token) {
+        try {
+            return std::stoll(token.substr(0, token.find(':')));
+        } catch (const std::exception&) {
+            return 1;
+        }
+    }
+
+    bool sendAll(const int fd, const std::string_view data) {
+        size_t sent = 0;
+
+        while (sent < data.size()) {
+            const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n <= 0) {
+                return false;
+            }
+
+            sent += static_cast<size_t>(n);
+        }
+
+        return true;
+    }
+
+    std::string lower(std::string value) {
+        std::ranges::transform(value, value.begin(), [](const unsigned char c) { return std::tolower(c); });
+        return value;
+    }
+
+    std::string urlDecode(const std::string_view value) {
+        std::string result;
+        result.reserve(value.size());
+
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '+') {
+                result += ' ';
+            } else if (value[i] == '%' && i + 2 < value.size()) {
+                result += static_cast<char>(std::stoi(std::string(value.substr(i + 1, 2)), nullptr, 16));
+                i += 2;
+            } else {
+                result += value[i];
+            }
+        }
+
+        return result;
+    }
+
+    std::string_view statusText(const int status) {
+        switch (status) {
+            case 200: return "OK";
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            case 413: return "Request Entity Too Large";
+            case 429: return "Too Many Requests";
+            default: return "Internal Server Error";
+        }
+    }
+
+    // Quoted attribute of a Content-Disposition header, e.g. name="chat_id"
+    std::string dispositionValue(const std::string_view headers, const std::string_view attribute) {
+        const std::string key = " " + std::string(attribute) + "=\"";
+        const size_t start = headers.find(key);
+        if (start == std::string_view::npos) {
+            return {};
+        }
+
+        const size_t value_start = start + key.size();
+        return std::string(headers.substr(value_start, headers.find('"', value_start) - value_start));
+    }
+
+} // namespace
+
+ftes::FakeBotApi::FakeBotApi(FakeBotApiOptions options) : options_(options) {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    }
+
+    constexpr int enable = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(options_.port);
+
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listen_fd_, SOMAXCONN) != 0) {
+        const std::string reason = std::strerror(errno);
+        ::close(listen_fd_);
+        throw std::runtime_error("bind: " + reason);
+    }
+
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+
+    accept_thread_ = std::jthread([this] { acceptLoop(); });
+}
+
+ftes::FakeBotApi::~FakeBotApi() {
+    stopping_ = true;
+
+    // Wakes accept() and every blocked recv(), the threads then exit on their own
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    accept_thread_.join();
+    ::close(listen_fd_);
+
+    std::lock_guard lock(connections_mutex_);
+    for (const int fd : connection_fds_) {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+
+    connection_threads_.clear();
+
+    for (const int fd : connection_fds_) {
+        ::close(fd);
+    }
+}
+
+std::string ftes::FakeBotApi::url() const {
+    return "http://127.0.0.1:" + std::to_string(port_);
+}
+
+std::map<std::string, uint64_t> ftes::FakeBotApi::calls() const {
+    std::lock_guard lock(mutex_);
+    return calls_;
+}
+
+void ftes::FakeBotApi::acceptLoop() {
+    while (!stopping_) {
+        const int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        constexpr int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        std::lock_guard lock(connections_mutex_);
+        if (stopping_) {
+            ::close(fd);
+            return;
+        }
+
+        connection_fds_.push_back(fd);
+        connection_threads_.emplace_back([this, fd] { serve(fd); });
+    }
+}
+
+void ftes::FakeBotApi::serve(const int fd) {
+    std::string buffer;
+    Request request;
+
+    while (!stopping_ && readRequest(fd, buffer, request)) {
+        if (options_.latency.count() > 0) {
+            std::this_thread::sleep_for(options_.latency);
+        }
+
+        const Response response = handle(request);
+
+        std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " + std::string(statusText(response.status)) +
+                           "\r\nContent-Type: " + response.content_type +
+                           "\r\nContent-Length: " + std::to_string(response.body.size()) +
+                           "\r\nConnection: keep-alive\r\n\r\n";
+
+        if (!sendAll(fd, head) || !sendAll(fd, response.body)) {
+            break;
+        }
+    }
+
+    // The descriptor stays in connection_fds_ until destruction, so it is
+    // only shut down here and closed once nobody can shutdown() it anymore
+    ::shutdown(fd, SHUT_RDWR);
+}
+
+bool ftes::FakeBotApi::readRequest(const int fd, std::string& buffer, Request& request) const {
+    request = {};
+
+    const auto fill = [fd, &buffer] {
+        char chunk[64 * 1024];
+        const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+
+        buffer.append(chunk, static_cast<size_t>(n));
+        return true;
+    };
+
+    size_t head_end;
+    while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!fill()) {
+            return false;
+        }
+    }
+
+    const std::string_view head(buffer.data(), head_end);
+    const size_t line_end = head.find("\r\n");
+    const std::string_view request_line = head.substr(0, line_end);
+
+    const size_t method_end = request_line.find(' ');
+    const size_t target_end = request_line.find(' ', method_end + 1);
+    request.method = std::string(request_line.substr(0, method_end));
+    request.target = std::string(request_line.substr(method_end + 1, target_end - method_end - 1));
+
+    for (size_t pos = line_end + 2; pos < head.size() && line_end != std::string_view::npos;) {
+        size_t end = head.find("\r\n", pos);
+        if (end == std::string_view::npos) {
+            end = head.size();
+        }
+
+        const std::string_view line = head.substr(pos, end - pos);
+        if (const size_t colon = line.find(':'); colon != std::string_view::npos) {
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') {
+                value.remove_prefix(1);
+            }
+
+            request.headers[lower(std::string(line.substr(0, colon)))] = std::string(value);
+        }
+
+        pos = end + 2;
+    }
+
+    buffer.erase(0, head_end + 4);
+
+    // curl holds back large bodies until it is told to go on
+    if (const auto it = request.headers.find("expect"); it != request.headers.end() && lower(it->second) == "100-continue") {
+        if (!sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) {
+            return false;
+        }
+    }
+
+    size_t content_length = 0;
+    if (const auto it = request.headers.find("content-length"); it != request.headers.end()) {
+        content_length = std::stoull(it->second);
+    }
+
+    while (buffer.size() < content_length) {
+        if (!fill()) {
+            return false;
+        }
+    }
+
+    const std::string body = buffer.substr(0, content_length);
+    buffer.erase(0, content_length);
+
+    if (const size_t query = request.target.find('?'); query != std::string::npos) {
+        parseQuery(std::string_view(request.target).substr(query + 1), request);
+        request.target.resize(query);
+    }
+
+    const std::string content_type = request.headers["content-type"];
+    if (const size_t boundary = content_type.find("boundary="); content_type.starts_with("multipart/form-data") &&
+                                                                 boundary != std::string::npos) {
+        parseMultipart(body, content_type.substr(boundary + 9), request);
+    } else if (content_type.starts_with("application/x-www-form-urlencoded")) {
+        parseQuery(body, request);
+    }
+
+    return true;
+}
+
+void ftes::FakeBotApi::parseMultipart(const std::string& body, const std::string& boundary, Request& request) {
+    const std::string delimiter = "--" + boundary;
+
+    size_t pos = body.find(delimiter);
+    while (pos != std::string::npos) {
+        pos += delimiter.size();
+        if (body.compare(pos, 2, "--") == 0) {
+            break;
+        }
+
+        pos += 2; // CRLF after the delimiter
+        const size_t headers_end = body.find("\r\n\r\n", pos);
+        if (headers_end == std::string::npos) {
+            break;
+        }
+
+        const size_t next = body.find("\r\n" + delimiter, headers_end + 4);
+        if (next == std::string::npos) {
+            break;
+        }
+
+        const std::string_view headers(body.data() + pos, headers_end - pos);
+        std::string value = body.substr(headers_end + 4, next - headers_end - 4);
+        const std::string name = dispositionValue(headers, "name");
+
+        if (headers.find(" filename=\"") != std::string_view::npos) {
+            request.file_name = dispositionValue(headers, "filename");
+            request.file_data = std::move(value);
+        } else {
+            request.params[name] = std::move(value);
+        }
+
+        pos = next + 2;
+    }
+}
+
+void ftes::FakeBotApi::parseQuery(const std::string_view query, Request& request) {
+    size_t pos = 0;
+
+    while (pos < query.size()) {
+        size_t end = query.find('&', pos);
+        if (end == std::string_view::npos) {
+            end = query.size();
+        }
+
+        const std::string_view pair = query.substr(pos, end - pos);
+        const size_t equals = pair.find('=');
+        if (equals != std::string_view::npos) {
+            request.params[urlDecode(pair.substr(0, equals))] = urlDecode(pair.substr(equals + 1));
+        }
+
+        pos = end + 1;
+    }
+}
+
+ftes::FakeBotApi::Response ftes::FakeBotApi::handle(const Request& request) {
+    // /bot<token>/<method> for API calls, /file/bot<token>/<path> for downloads
+    const std::string_view target = request.target;
+
+    if (target.starts_with("/file/bot")) {
+        const size_t path_start = target.find('/', 9);
+        if (path_start == std::string_view::npos) {
+            return error(404, "Not Found");
+        }
+
+        return download(std::string(target.substr(path_start + 1)));
+    }
+
+    if (!target.starts_with("/bot")) {
+        return error(404, "Not Found");
+    }
+
+    const size_t method_start = target.find('/', 4);
+    if (method_start == std::string_view::npos) {
+        return error(404, "Not Found");
+    }
+
+    Request call = request;
+    call.params["_bot_id"] = std::to_string(botIdFromToken(std::string(target.substr(4, method_start - 4))));
+
+    return handleMethod(std::string(target.substr(method_start + 1)), call);
+}
+
+ftes::FakeBotApi::Response ftes::FakeBotApi::handleMethod(const std::string& method, const Request& request) {
+    const auto param = [&request](const std::string& name) -> std::string {
+        const auto it = request.params.find(name);
+        return it == request.params.end() ? std::string() : it->second;
+    };
+
+    const auto number = [&param](const std::string& name) -> int64_t {
+        const std::string value = param(name);
+        return value.empty() ? 0 : std::stoll(value);
+    };
+
+    if (method == "getUpdates") {
+        {
+            std::lock_guard lock(mutex_);
+            ++calls_[method];
+        }
+
+        // Nothing ever arrives, hold the poll like the real server would
+        const auto hold = std::min<std::chrono::milliseconds>(options_.long_poll_hold,
+                                                              std::chrono::seconds(number("timeout")));
+        std::this_thread::sleep_for(std::max(hold, std::chrono::milliseconds(0)));
+
+        return ok(json::array());
+    }
+
+    std::lock_guard lock(mutex_);
+    ++calls_[method];
+
+    const bool chat_message = method.starts_with("send") || method.starts_with("edit") || method == "forwardMessage" ||
+                              method == "pinChatMessage" || method == "unpinChatMessage";
+
+    if (chat_message && options_.rate_limit_every > 0 && ++chat_messages_ % options_.rate_limit_every == 0) {
+        ++calls_["rate_limited"];
+        return error(429, "Too Many Requests: retry after " + std::to_string(options_.retry_after_seconds),
+                     {{"retry_after", options_.retry_after_seconds}});
+    }
+
+    const int64_t chat_id = number("chat_id");
+
+    if (method == "getMe") {
+        const int64_t bot_id = number("_bot_id");
+        return ok({{"id", bot_id}, {"is_bot", true}, {"first_name", "fake"}, {"username", "fake_" + std::to_string(bot_id) + "_bot"}});
+    }
+
+    if (method == "getChat") {
+        const Chat& chat = chats_[chat_id];
+
+        json result = {{"id", chat_id}, {"type", "private"}};
+        if (const auto it = chat.messages.find(chat.pinned); chat.pinned != 0 && it != chat.messages.end()) {
+            result["pinned_message"] = messageJson(chat_id, it->second);
+        }
+
+        return ok(result);
+    }
+
+    if (method == "getFile") {
+        const std::string file_id = param("file_id");
+        const auto file = files_.find(file_id);
+        if (file == files_.end()) {
+            return error(400, "Bad Request: invalid file_id");
+        }
+
+        if (file->second.data.size() > options_.max_download_bytes) {
+            return error(400, "Bad Request: file is too big");
+        }
+
+        return ok({
+            {"file_id", file_id},
+            {"file_unique_id", file->second.unique_id},
+            {"file_size", file->second.data.size()},
+            {"file_path", "documents/" + file_id},
+        });
+    }
+
+    if (method == "sendDocument") {
+        if (request.file_data.size() > options_.max_upload_bytes) {
+            return error(413, "Request Entity Too Large");
+        }
+
+        uploaded_bytes_ += request.file_data.size();
+
+        const std::string file_id = "file" + std::to_string(next_file_++);
+        files_[file_id] = {"u" + file_id, request.file_name, request.file_data};
+
+        Message message;
+        message.file_id = file_id;
+        message.caption = param("caption");
+
+        return ok(messageJson(chat_id, addMessage(chat_id, std::move(message))));
+    }
+
+    if (method == "sendMessage") {
+        const std::string text = param("text");
+        if (text.empty()) {
+            return error(400, "Bad Request: message text is empty");
+        }
+
+        Message message;
+        message.text = text;
+
+        return ok(messageJson(chat_id, addMessage(chat_id, std::move(message))));
+    }
+
+    Chat& chat = chats_[chat_id];
+    const auto message = chat.messages.find(number("message_id"));
+
+    if (method == "unpinChatMessage") {
+        if (message == chat.messages.end() || chat.pinned != message->first) {
+            return error(400, "Bad Request: message to unpin not found");
+        }
+
+        chat.pinned = 0;
+        return ok(true);
+    }
+
+    if (method == "forwardMessage") {
+        const auto& source = chats_[number("from_chat_id")].messages;
+        const auto original = source.find(number("message_id"));
+        if (original == source.end()) {
+            return error(400, "Bad Request: message to forward not found");
+        }
+
+        Message copy = original->second;
+        return ok(messageJson(chat_id, addMessage(chat_id, std::move(copy))));
+    }
+
+    if (message == chat.messages.end()) {
+        return error(400, "Bad Request: message not found");
+    }
+
+    if (method == "pinChatMessage") {
+        chat.pinned = message->first;
+        return ok(true);
+    }
+
+    if (method == "editMessageCaption") {
+        if (message->second.file_id.empty()) {
+            return error(400, "Bad Request: there is no caption in the message to edit");
+        }
+
+        message->second.caption = param("caption");
+        return ok(messageJson(chat_id, message->second));
+    }
+
+    if (method == "deleteMessage") {
+        if (chat.pinned == message->first) {
+            chat.pinned = 0;
+        }
+
+        chat.messages.erase(message);
+        return ok(true);
+    }
+
+    return error(404, "Not Found: method " + method + " is not implemented by the fake server");
+}
+
+ftes::FakeBotApi::Response ftes::FakeBotApi::download(const std::string& file_path) {
+    std::lock_guard lock(mutex_);
+    ++calls_["download"];
+
+    // getFile hands out documents/<file_id>
+    const auto it = files_.find(file_path.substr(file_path.rfind('/') + 1));
+    if (it == files_.end()) {
+        return error(404, "Not Found");
+    }
+
+    downloaded_bytes_ += it->second.data.size();
+
+    Response response;
+    response.content_type = "application/octet-stream";
+    response.body = it->second.data;
+
+    return response;
+}
+
+nlohmann::json ftes::FakeBotApi::messageJson(const int64_t chat_id, const Message& message) const {
+    json result = {
+        {"message_id", message.message_id},
+        {"date", message.date},
+        {"chat", {{"id", chat_id}, {"type", "private"}}},
+    };
+
+    if (!message.text.empty()) {
+        result["text"] = message.text;
+    }
+
+    if (!message.caption.empty()) {
+        result["caption"] = message.caption;
+    }
+
+    if (!message.file_id.empty()) {
+        const StoredFile& file = files_.at(message.file_id);
+        result["document"] = {
+            {"file_id", message.file_id},
+            {"file_unique_id", file.unique_id},
+            {"file_name", file.name},
+            {"file_size", file.data.size()},
+        };
+    }
+
+    return result;
+}
+
+ftes::FakeBotApi::Message& ftes::FakeBotApi::addMessage(const int64_t chat_id, Message message) {
+    Chat& chat = chats_[chat_id];
+
+    message.message_id = chat.next_message_id++;
+    message.date = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    return chat.messages[message.message_id] = std::move(message);
+}
+
+ftes::FakeBotApi::Response ftes::FakeBotApi::ok(json result) {
+    Response response;
+    response.body = json{{"ok", true}, {"result", std::move(result)}}.dump();
+
+    return response;
+}
+
+ftes::FakeBotApi::Response ftes::FakeBotApi::error(const int code, const std::string& description, json parameters) {
+    json body = {{"ok", false}, {"error_code", code}, {"description", description}};
+    if (!parameters.is_null()) {
+        body["parameters"] = std::move(parameters);
+    }
+
+    Response response;
+    response.status = code;
+    response.body = body.dump();
+
+    return response;
+}
@@ -0,0 +1,139 @@
+#ifndef FAKE_BOT_API_HPP
+#define FAKE_BOT_API_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace fuse_telegram_external_storage {
+
+    struct FakeBotApiOptions {
+        // 0 picks a free port
+        uint16_t port = 0;
+
+        // Added to every API call and file download
+        std::chrono::microseconds latency{0};
+
+        // Every n-th message sent to or edited in a chat is answered with 429
+        // and this retry_after, 0 disables the injection
+        size_t rate_limit_every = 0;
+        int retry_after_seconds = 1;
+
+        // Bot API limits on sent documents and on files bots may download
+        uint64_t max_upload_bytes = 50ULL << 20;
+        uint64_t max_download_bytes = 20ULL << 20;
+
+        // getUpdates answers after this long, or its own timeout if shorter
+        std::chrono::milliseconds long_poll_hold{100};
+    };
+
+    // In-process stand-in for the Bot API HTTP server, covering what the
+    // facade uses: documents, text messages, forwarding, pinning, getChat,
+    // getFile and file downloads. Chats and files live in memory, every call
+    // is counted by method so load tests can report them
+    class FakeBotApi {
+    public:
+        explicit FakeBotApi(FakeBotApiOptions options = {});
+        ~FakeBotApi();
+
+        FakeBotApi(const FakeBotApi&) = delete;
+        FakeBotApi& operator=(const FakeBotApi&) = delete;
+
+        // Base URL to hand to TelegramApiOptions::api_url
+        [[nodiscard]] std::string url() const;
+
+        // Calls by method, file downloads under "download" and injected
+        // rate limit answers under "rate_limited"
+        [[nodiscard]] std::map<std::string, uint64_t> calls() const;
+
+        [[nodiscard]] uint64_t uploadedBytes() const { return uploaded_bytes_; }
+        [[nodiscard]] uint64_t downloadedBytes() const { return downloaded_bytes_; }
+
+    private:
+        struct Message {
+            int64_t message_id = 0;
+            int64_t date = 0;
+            std::string text;
+            std::string caption;
+            std::string file_id; // document, empty for text messages
+        };
+
+        struct Chat {
+            std::map<int64_t, Message> messages;
+            int64_t next_message_id = 1;
+            int64_t pinned = 0;
+        };
+
+        struct StoredFile {
+            std::string unique_id;
+            std::string name;
+            std::string data;
+        };
+
+        struct Request {
+            std::string method;
+            std::string target;
+            std::unordered_map<std::string, std::string> headers;
+            std::unordered_map<std::string, std::string> params;
+
+            // The document of sendDocument, name and content
+            std::string file_name;
+            std::string file_data;
+        };
+
+        struct Response {
+            int status = 200;
+            std::string content_type = "application/json";
+            std::string body;
+        };
+
+        void acceptLoop();
+        void serve(int fd);
+
+        bool readRequest(int fd, std::string& buffer, Request& request) const;
+        static void parseMultipart(const std::string& body, const std::string& boundary, Request& request);
+        static void parseQuery(std::string_view query, Request& request);
+
+        Response handle(const Request& request);
+        Response handleMethod(const std::string& method, const Request& request);
+        Response download(const std::string& file_path);
+
+        nlohmann::json messageJson(int64_t chat_id, const Message& message) const;
+        Message& addMessage(int64_t chat_id, Message message);
+
+        static Response ok(nlohmann::json result);
+        static Response error(int code, const std::string& description, nlohmann::json parameters = nullptr);
+
+        FakeBotApiOptions options_;
+        int listen_fd_ = -1;
+        uint16_t port_ = 0;
+
+        std::atomic<bool> stopping_{false};
+        std::jthread accept_thread_;
+
+        std::mutex connections_mutex_;
+        std::vector<int> connection_fds_;
+        std::vector<std::jthread> connection_threads_;
+
+        mutable std::mutex mutex_;
+        std::unordered_map<int64_t, Chat> chats_;
+        std::unordered_map<std::string, StoredFile> files_;
+        uint64_t next_file_ = 1;
+        uint64_t chat_messages_ = 0;
+        std::map<std::string, uint64_t> calls_;
+
+        std::atomic<uint64_t> uploaded_bytes_{0};
+        std::atomic<uint64_t> downloaded_bytes_{0};
+    };
+
+} // fuse_telegram_external_storage
+
+#endif //FAKE_BOT_API_HPP
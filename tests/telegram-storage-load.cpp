@@ -0,0 +1,224 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+
+#include "tests/fake-bot-api.hpp"
+#include "lib/telegram-external-storage/telegram-external-storage.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+constexpr int64_t kChatId = 1000;
+constexpr auto kToken = "1000001:fake-token";
+
+struct LoadOptions {
+    size_t small_files = 200;
+    size_t small_file_bytes = 4096;
+    size_t large_file_mib = 64;
+    size_t metadata_ops = 100;
+    size_t list_rounds = 100;
+    size_t read_block_bytes = 128 * 1024;
+};
+
+std::string randomBytes(const size_t size, const uint32_t seed) {
+    std::mt19937 random(seed);
+    std::string data(size, '\0');
+
+    for (auto& byte : data) {
+        byte = static_cast<char>(random());
+    }
+
+    return data;
+}
+
+// Writes a whole file through the interface the way the FUSE layer does on release
+int writeWhole(ftes::TelegramExternalStorage& storage, const std::filesystem::path& staging,
+               const std::filesystem::path& path, const std::string& data) {
+    if (const int result = storage.createFile(path, 0644); result != 0) {
+        return result;
+    }
+
+    std::ofstream(staging, std::ios::binary | std::ios::trunc).write(data.data(), static_cast<std::streamsize>(data.size()));
+    return storage.storeFile(path, staging, {{0, data.size()}});
+}
+
+class Report {
+public:
+    explicit Report(const ftes::FakeBotApi& server) : server_(server) {}
+
+    // Runs one workload and prints its wall time and the API calls it made
+    template <typename Workload>
+    void run(const std::string& name, Workload&& workload) {
+        const auto calls_before = server_.calls();
+        const uint64_t uploaded_before = server_.uploadedBytes();
+        const uint64_t downloaded_before = server_.downloadedBytes();
+        const auto start = std::chrono::steady_clock::now();
+
+        const int failures = workload();
+
+        const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << elapsed.count() << " ms"
+                  << std::setw(10) << (server_.uploadedBytes() - uploaded_before) / 1024 << " KiB up"
+                  << std::setw(10) << (server_.downloadedBytes() - downloaded_before) / 1024 << " KiB down";
+
+        failures_ += failures;
+        if (failures != 0) {
+            std::cout << "  " << failures << " failed";
+        }
+
+        std::cout << "\n";
+
+        for (const auto& [method, count] : server_.calls()) {
+            const auto before = calls_before.find(method);
+            const uint64_t delta = count - (before == calls_before.end() ? 0 : before->second);
+
+            if (delta != 0 && method != "getUpdates") {
+                std::cout << "    " << std::left << std::setw(20) << method << std::right << delta << "\n";
+            }
+        }
+    }
+
+    [[nodiscard]] int failures() const { return failures_; }
+
+private:
+    const ftes::FakeBotApi& server_;
+    int failures_ = 0;
+};
+
+} // namespace
+
+// Drives TelegramExternalStorage against the fake Bot API server and reports
+// wall time and API calls per workload. The storage is used directly rather
+// than through a mount, so it runs where FUSE isn't available
+int main(int argc, char** argv) {
+    CLI::App app{"Telegram storage load test against a local fake Bot API"};
+
+    ftes::FakeBotApiOptions server_options;
+    LoadOptions load;
+    double latency_ms = 0;
+    size_t chunk_mib = 8;
+
+    app.add_option("--latency", latency_ms, "Latency added to every API call, ms");
+    app.add_option("--rate-limit-every", server_options.rate_limit_every, "Answer every n-th chat message with 429");
+    app.add_option("--retry-after", server_options.retry_after_seconds, "retry_after of injected 429 answers, s");
+    app.add_option("--small-files", load.small_files, "Files written by the small-write workload");
+    app.add_option("--large-file", load.large_file_mib, "Size of the sequentially read file, MiB");
+    app.add_option("--chunk-size", chunk_mib, "Chunk size, MiB");
+    app.add_option("--metadata-ops", load.metadata_ops, "Directories created, renamed and removed by the metadata workload");
+    app.add_option("--list-rounds", load.list_rounds, "Listings of the small files' directory");
+
+    CLI11_PARSE(app, argc, argv);
+
+    server_options.latency = std::chrono::microseconds(static_cast<int64_t>(latency_ms * 1000));
+    ftes::FakeBotApi server(server_options);
+
+    // The facade keeps chat and metadata message IDs in files under HOME
+    const std::filesystem::path work_dir = std::filesystem::temp_directory_path() /
+                                           ("fes-load-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(work_dir);
+    setenv("HOME", work_dir.c_str(), 1);
+
+    ftes::TelegramStorageOptions options;
+    options.api.api_url = server.url();
+    options.api.chat_id = kChatId;
+    options.chunk_size_bytes = chunk_mib << 20;
+    options.cache_dir = work_dir / "cache";
+
+    const std::filesystem::path staging = work_dir / "staging";
+    const std::string large = randomBytes(load.large_file_mib << 20, 1);
+
+    std::cout << "fake Bot API at " << server.url() << ", latency " << latency_ms << " ms\n\n";
+
+    Report report(server);
+
+    {
+        auto storage = std::make_unique<ftes::TelegramExternalStorage>(kToken, options);
+        storage->start();
+
+        report.run("small-writes", [&] {
+            int failures = 0;
+            storage->createDir("/small", 0755);
+
+            for (size_t i = 0; i < load.small_files; ++i) {
+                const std::string data = randomBytes(load.small_file_bytes, static_cast<uint32_t>(i + 2));
+                failures += writeWhole(*storage, staging, "/small/file_" + std::to_string(i), data) != 0;
+            }
+
+            return failures + (storage->syncMetadata() != 0);
+        });
+
+        report.run("large-write", [&] {
+            return (writeWhole(*storage, staging, "/large", large) != 0) + (storage->syncMetadata() != 0);
+        });
+
+        report.run("metadata", [&] {
+            int failures = 0;
+
+            for (size_t i = 0; i < load.metadata_ops; ++i) {
+                const std::string dir = "/meta_" + std::to_string(i);
+                failures += storage->createDir(dir, 0755) != 0;
+                failures += storage->rename(dir, dir + "_renamed") != 0;
+                failures += storage->removeDir(dir + "_renamed") != 0;
+            }
+
+            return failures + (storage->syncMetadata() != 0);
+        });
+
+        report.run("list", [&] {
+            int failures = 0;
+
+            for (size_t i = 0; i < load.list_rounds; ++i) {
+                failures += storage->listDir("/small").size() != load.small_files;
+            }
+
+            return failures;
+        });
+    }
+
+    // A fresh instance with an empty cache has to load the metadata and fetch every chunk
+    options.cache_dir = work_dir / "cold-cache";
+
+    {
+        std::unique_ptr<ftes::TelegramExternalStorage> storage;
+
+        report.run("cold-mount", [&] {
+            storage = std::make_unique<ftes::TelegramExternalStorage>(kToken, options);
+            storage->start();
+            return storage->listDir("/small").size() != load.small_files;
+        });
+
+        report.run("sequential-read", [&] {
+            std::vector<char> buf(load.read_block_bytes);
+            int failures = 0;
+
+            for (size_t offset = 0; offset < large.size(); offset += buf.size()) {
+                const int bytes_read = storage->readFile("/large", buf.data(), buf.size(), static_cast<off_t>(offset));
+                const size_t expected = std::min(buf.size(), large.size() - offset);
+
+                failures += bytes_read != static_cast<int>(expected) ||
+                            large.compare(offset, expected, buf.data(), expected) != 0;
+            }
+
+            return failures;
+        });
+    }
+
+    std::filesystem::remove_all(work_dir);
+
+    // Run as a test, any failed operation fails it
+    return report.failures() == 0 ? 0 : 1;
+}
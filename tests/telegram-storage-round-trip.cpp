@@ -0,0 +1,214 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lib/telegram-external-storage/telegram-external-storage.hpp"
+#include "tests/fake-bot-api.hpp"
+
+namespace ftes = fuse_telegram_external_storage;
+
+namespace {
+
+constexpr int64_t kChatId = 1000;
+constexpr auto kToken = "1000001:fake-token";
+
+// Small enough that the files below span several chunks
+constexpr size_t kChunkSize = 64 * 1024;
+
+std::string randomBytes(const size_t size, const uint32_t seed) {
+    std::mt19937 random(seed);
+    std::string data(size, '\0');
+
+    for (auto& byte : data) {
+        byte = static_cast<char>(random());
+    }
+
+    return data;
+}
+
+class RoundTrip {
+public:
+    RoundTrip() : work_dir_(std::filesystem::temp_directory_path() / ("fes-round-trip-" + std::to_string(::getpid()))) {
+        std::filesystem::remove_all(work_dir_);
+        std::filesystem::create_directories(work_dir_);
+
+        // The facade keeps chat and metadata message IDs in files under HOME
+        setenv("HOME", work_dir_.c_str(), 1);
+    }
+
+    ~RoundTrip() { std::filesystem::remove_all(work_dir_); }
+
+    // Every mount talks to the same chat, each with a cache of its own so
+    // reads have to go to the server
+    std::unique_ptr<ftes::TelegramExternalStorage> mount(const std::string& cache_name,
+                                                         const std::chrono::milliseconds commit_delay) {
+        ftes::TelegramStorageOptions options;
+        options.api.api_url = server_.url();
+        options.api.chat_id = kChatId;
+        options.chunk_size_bytes = kChunkSize;
+        options.cache_dir = work_dir_ / cache_name;
+        options.commit_delay = commit_delay;
+
+        auto storage = std::make_unique<ftes::TelegramExternalStorage>(kToken, options);
+        storage->start();
+        return storage;
+    }
+
+    // Stores a whole file through the interface the way the FUSE layer does on release
+    int write(ftes::TelegramExternalStorage& storage, const std::filesystem::path& path, const std::string& data) {
+        if (const int result = storage.createFile(path, 0644); result != 0) {
+            return result;
+        }
+
+        return store(storage, path, data, {{0, data.size()}});
+    }
+
+    int store(ftes::TelegramExternalStorage& storage, const std::filesystem::path& path, const std::string& data,
+              const std::vector<fuse_external_storage::ByteRange>& dirty_ranges) {
+        const auto staging = work_dir_ / "staging";
+        std::ofstream(staging, std::ios::binary | std::ios::trunc).write(data.data(), static_cast<std::streamsize>(data.size()));
+        return storage.storeFile(path, staging, dirty_ranges);
+    }
+
+    [[nodiscard]] uint64_t calls(const std::string& method) const {
+        const auto calls = server_.calls();
+        const auto it = calls.find(method);
+        return it == calls.end() ? 0 : it->second;
+    }
+
+private:
+    ftes::FakeBotApi server_;
+    std::filesystem::path work_dir_;
+};
+
+int failures = 0;
+
+void expect(const bool condition, const std::string_view what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Reads the whole file in blocks that straddle chunk boundaries and compares it
+void expectContent(ftes::TelegramExternalStorage& storage, const std::filesystem::path& path,
+                   const std::string& expected, const std::string_view what) {
+    std::vector<char> buf(kChunkSize / 3 + 1);
+    std::string content;
+
+    for (;;) {
+        const int bytes_read = storage.readFile(path, buf.data(), buf.size(), static_cast<off_t>(content.size()));
+        if (bytes_read <= 0) {
+            expect(bytes_read == 0, std::string(what) + ": read failed");
+            break;
+        }
+        content.append(buf.data(), static_cast<size_t>(bytes_read));
+    }
+
+    expect(content == expected, std::string(what) + ": bytes read back differ");
+}
+
+std::vector<std::string> names(ftes::TelegramExternalStorage& storage, const std::filesystem::path& path) {
+    std::vector<std::string> names;
+    for (const auto& info : storage.listDir(path)) {
+        names.push_back(std::filesystem::path(info.path).filename());
+    }
+
+    std::ranges::sort(names);
+    return names;
+}
+
+// A file of several chunks plus a partial last one, rewritten in the middle,
+// read back by the mount that wrote it and by a fresh one with an empty cache
+void chunkedRoundTrip(RoundTrip& round_trip) {
+    std::string data = randomBytes(5 * kChunkSize + 1234, 1);
+
+    {
+        const auto storage = round_trip.mount("cache", std::chrono::milliseconds(0));
+
+        expect(round_trip.write(*storage, "/large", data) == 0, "storing the file");
+        expect(storage->syncMetadata() == 0, "uploading the file");
+        expect(round_trip.calls("sendDocument") >= 6, "every chunk is its own document");
+        expectContent(*storage, "/large", data, "writing mount");
+
+        // Only the chunk holding the dirty range is uploaded again
+        const size_t offset = 2 * kChunkSize + 100;
+        const std::string patch = randomBytes(500, 2);
+        data.replace(offset, patch.size(), patch);
+
+        const uint64_t sent_before = round_trip.calls("sendDocument");
+        expect(round_trip.store(*storage, "/large", data, {{offset, patch.size()}}) == 0, "storing the rewrite");
+        expect(storage->syncMetadata() == 0, "uploading the rewrite");
+
+        // The changed chunk and the journal record
+        expect(round_trip.calls("sendDocument") - sent_before <= 2, "the rewrite uploads only the changed chunk");
+        expectContent(*storage, "/large", data, "writing mount after the rewrite");
+    }
+
+    const auto storage = round_trip.mount("cold-cache", std::chrono::milliseconds(0));
+    expectContent(*storage, "/large", data, "fresh mount");
+}
+
+// Mutations committed to the journal, not as new snapshots, are replayed by
+// a second mount that loads while the first one is still up
+void journalReplay(RoundTrip& round_trip) {
+    const std::string kept = randomBytes(2 * kChunkSize + 17, 3);
+    const std::string removed = randomBytes(1000, 4);
+
+    const auto writer = round_trip.mount("cache", std::chrono::milliseconds(0));
+
+    // The first commit writes the snapshot the journal hangs off
+    expect(writer->createDir("/docs", 0755) == 0, "creating /docs");
+    const uint64_t pins_before = round_trip.calls("pinChatMessage");
+
+    expect(round_trip.write(*writer, "/docs/kept", kept) == 0, "storing /docs/kept");
+    expect(round_trip.write(*writer, "/docs/removed", removed) == 0, "storing /docs/removed");
+    expect(writer->rename("/docs/kept", "/docs/renamed") == 0, "renaming /docs/kept");
+    expect(writer->unlinkFile("/docs/removed") == 0, "removing /docs/removed");
+    expect(writer->createDir("/empty", 0755) == 0, "creating /empty");
+    expect(writer->removeDir("/empty") == 0, "removing /empty");
+    expect(writer->syncMetadata() == 0, "committing the uploads");
+
+    expect(round_trip.calls("pinChatMessage") == pins_before, "mutations go to the journal");
+
+    const auto reader = round_trip.mount("reader-cache", std::chrono::milliseconds(0));
+
+    expect(names(*reader, "/") == std::vector<std::string>{"docs"}, "replayed root listing");
+    expect(names(*reader, "/docs") == std::vector<std::string>{"renamed"}, "replayed /docs listing");
+    expectContent(*reader, "/docs/renamed", kept, "replayed file");
+}
+
+} // namespace
+
+// Round trips through TelegramExternalStorage against the fake Bot API
+// server, one per CTest case: "chunked" or "journal"
+int main(int argc, char** argv) {
+    const std::map<std::string_view, std::function<void(RoundTrip&)>> cases = {
+        {"chunked", chunkedRoundTrip},
+        {"journal", journalReplay},
+    };
+
+    const auto it = argc == 2 ? cases.find(argv[1]) : cases.end();
+    if (it == cases.end()) {
+        std::cerr << "usage: " << argv[0] << " chunked|journal\n";
+        return 2;
+    }
+
+    {
+        RoundTrip round_trip;
+        it->second(round_trip);
+    }
+
+    return failures == 0 ? 0 : 1;
+}